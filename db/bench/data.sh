@@ -0,0 +1,38 @@
+#!/bin/bash
+
+# Compares balance writes per second of bot.data with the old and the new index set
+# (the HOT share of the updates is reported as well).
+# Usage: ./data.sh [psql connection options]
+#   BOTS, USERS, ADDRESSES, CLIENTS, DURATION - workload (environment).
+#==============================================================================
+
+BOTS=${BOTS:-10}
+USERS=${USERS:-100}
+ADDRESSES=${ADDRESSES:-50}
+CLIENTS=${CLIENTS:-8}
+DURATION=${DURATION:-60}
+
+DIR="$(cd "$(dirname "$0")" && pwd)/data"
+
+run_layout()
+{
+    local LAYOUT="$1"
+    shift
+
+    echo
+    echo "********************** $LAYOUT **********************"
+    echo
+
+    psql -q -X -v ON_ERROR_STOP=1 -v bots=$BOTS -v users=$USERS -v addresses=$ADDRESSES "$@" \
+        -f "$DIR/setup.sql" -f "$DIR/indexes_$LAYOUT.sql" || exit 1
+
+    pgbench -n -c $CLIENTS -j $CLIENTS -T $DURATION -D bots=$BOTS -D users=$USERS -D addresses=$ADDRESSES \
+        -f "$DIR/balance.sql@9" -f "$DIR/lookup.sql@1" "$@" | grep -E "^(tps|latency|SQL script)"
+
+    psql -q -X -A -t "$@" -c "SELECT 'updates: ' || n_tup_upd || ', hot: ' || n_tup_hot_upd || ', size: ' || pg_size_pretty(pg_total_relation_size(relid)) FROM pg_stat_user_tables WHERE relid = 'bench.data'::regclass"
+}
+
+run_layout old "$@"
+run_layout new "$@"
+
+psql -q -X "$@" -c "DROP SCHEMA bench CASCADE"
@@ -0,0 +1,7 @@
+-- Blockchain response: the balance of an address is written to its subscribers (bot.bbd_blockchain_done)
+\set address random(0, :users * :addresses / 2 - 1)
+UPDATE bench.data
+   SET value = md5(random()::text),
+       updated = Now()
+ WHERE category = 'address'
+   AND key = 'addr-' || :address;
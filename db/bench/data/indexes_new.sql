@@ -0,0 +1,9 @@
+-- Workload-driven index set (see db/sql/bot/table.sql): addresses are polled by the plan of bot.bbd_address,
+-- bot.data is read and written by address key only
+
+ALTER TABLE bench.data SET (fillfactor = 90);
+VACUUM FULL bench.data;
+
+CREATE INDEX ON bench.data (key, category);
+
+VACUUM ANALYZE bench.data;
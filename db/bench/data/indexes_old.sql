@@ -0,0 +1,9 @@
+-- Index set before the polling redesign
+
+CREATE INDEX ON bench.data (bot_id, chat_id, user_id, category);
+CREATE INDEX ON bench.data (bot_id);
+CREATE INDEX ON bench.data (user_id);
+CREATE INDEX ON bench.data (category);
+CREATE INDEX ON bench.data (key);
+
+VACUUM ANALYZE bench.data;
@@ -0,0 +1,7 @@
+-- Blockchain response: subscribers of an address
+\set address random(0, :users * :addresses / 2 - 1)
+SELECT bot_id, chat_id, user_id
+  FROM bench.data
+ WHERE category = 'address'
+   AND key = 'addr-' || :address
+ GROUP BY bot_id, chat_id, user_id;
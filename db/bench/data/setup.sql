@@ -0,0 +1,27 @@
+--------------------------------------------------------------------------------
+-- bench.data: copy of bot.data with synthetic subscribers ---------------------
+--------------------------------------------------------------------------------
+-- psql -v bots=10 -v users=100 -v addresses=50
+
+DROP SCHEMA IF EXISTS bench CASCADE;
+CREATE SCHEMA bench;
+
+CREATE TABLE bench.data (
+  bot_id        uuid NOT NULL,
+  chat_id       bigint NOT NULL,
+  user_id       bigint NOT NULL,
+  category      text NOT NULL,
+  key           text NOT NULL,
+  value         text NOT NULL,
+  data          jsonb,
+  updated       timestamptz NOT NULL,
+  PRIMARY KEY (bot_id, chat_id, user_id, category, key)
+);
+
+INSERT INTO bench.data (bot_id, chat_id, user_id, category, key, value, updated)
+SELECT md5(b::text)::uuid, u, u, 'address', 'addr-' || ((u * :addresses + a) % (:users * :addresses / 2)), 'Not data', Now() - random() * INTERVAL '2 min'
+  FROM generate_series(1, :bots) b, generate_series(1, :users) u, generate_series(1, :addresses) a;
+
+INSERT INTO bench.data (bot_id, chat_id, user_id, category, key, value, updated)
+SELECT md5(b::text)::uuid, u, u, 'settings', 'interval', '60', Now()
+  FROM generate_series(1, :bots) b, generate_series(1, :users) u;
@@ -0,0 +1,35 @@
+#!/bin/bash
+
+# Compares the PL/pgSQL (SQL) helpers with pgtg_native (the extension must be created in the bot schema).
+# Usage: ./native.sh [psql connection options]
+#   CLIENTS, DURATION - workload (environment).
+#==============================================================================
+
+CLIENTS=${CLIENTS:-4}
+DURATION=${DURATION:-30}
+
+DIR="$(cd "$(dirname "$0")" && pwd)/native"
+
+run_script()
+{
+    local SCRIPT="$1"
+    shift
+
+    printf "%-20s" "$SCRIPT"
+    pgbench -n -c $CLIENTS -j $CLIENTS -T $DURATION -f "$DIR/$SCRIPT.sql" "$@" | grep -E "^tps" | sed -e 's/ (without initial connection time)//'
+}
+
+psql -q -X -v ON_ERROR_STOP=1 "$@" -c "SELECT 'bot.native_json_escape(text)'::regprocedure" > /dev/null || exit 1
+psql -q -X -v ON_ERROR_STOP=1 "$@" -f "$DIR/setup.sql" || exit 1
+
+for TEST in json address html; do
+    echo
+    echo "********************** $TEST **********************"
+    echo
+
+    for SCRIPT in "$DIR/${TEST}_"*.sql; do
+        run_script "$(basename "$SCRIPT" .sql)" "$@"
+    done
+done
+
+psql -q -X "$@" -c "DROP SCHEMA bench CASCADE"
@@ -0,0 +1,2 @@
+\set id random(1, 10000)
+SELECT bench.is_bitcoin_address(address) FROM bench.sample WHERE id = :id;
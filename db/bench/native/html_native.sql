@@ -0,0 +1,2 @@
+\set id random(1, 10000)
+SELECT bot.native_html_escape(html) FROM bench.sample WHERE id = :id;
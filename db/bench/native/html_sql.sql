@@ -0,0 +1,2 @@
+\set id random(1, 10000)
+SELECT bench.html_escape(html) FROM bench.sample WHERE id = :id;
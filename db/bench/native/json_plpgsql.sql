@@ -0,0 +1,2 @@
+\set id random(1, 10000)
+SELECT bench.encode_json_string(json) FROM bench.sample WHERE id = :id;
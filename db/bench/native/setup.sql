@@ -0,0 +1,92 @@
+--------------------------------------------------------------------------------
+-- bench: PL/pgSQL references and sample data for pgtg_native ------------------
+--------------------------------------------------------------------------------
+
+DROP SCHEMA IF EXISTS bench CASCADE;
+CREATE SCHEMA bench;
+
+-- bot.encode_json_string before pgtg_native
+CREATE FUNCTION bench.encode_json_string(str text) RETURNS text
+AS $$
+DECLARE
+  result    text;
+  ch        text;
+  chr       text;
+  chr_r     text;
+  quote     bool;
+BEGIN
+  quote := false;
+
+  FOR i IN 1..length(str)
+  LOOP
+    chr := substring(str FROM i FOR 1);
+    chr_r := substring(str FROM i + 1 FOR 1);
+
+    IF quote AND chr_r NOT IN (':', '}', ']', ',', E'\n') THEN
+      CASE chr
+      WHEN E'\r' THEN ch := '\r';
+      WHEN E'\n' THEN ch := '\n';
+      WHEN E'\t' THEN ch := '\t';
+      WHEN '"' THEN ch := '\"';
+      WHEN '\' THEN ch := '\\';
+      ELSE ch := chr;
+      END CASE;
+    ELSE
+      CASE chr
+      WHEN E'\r' THEN ch := '';
+      WHEN E'\n' THEN ch := '';
+      ELSE ch := chr;
+      END CASE;
+    END IF;
+
+    result := coalesce(result, '') || ch;
+
+    IF ch = '"' THEN
+      quote := NOT quote;
+    END IF;
+  END LOOP;
+
+  RETURN result;
+END
+$$ LANGUAGE plpgsql STRICT IMMUTABLE;
+
+-- bot.IsBitcoinAddress before pgtg_native (prefix and length only)
+CREATE FUNCTION bench.is_bitcoin_address(pAddress text) RETURNS bool
+AS $$
+DECLARE
+  ch        char;
+  hrp       text;
+BEGIN
+  IF NULLIF(pAddress, '') IS NOT NULL THEN
+    ch := SubStr(pAddress, 1, 1);
+    hrp := SubStr(pAddress, 1, 3);
+    RETURN ((ch = '1' OR ch = '2' OR ch = '3' OR ch = 'm' OR ch = 'n') AND (length(pAddress) >= 26 AND length(pAddress) <= 35))
+        OR ((hrp = 'bc1' OR hrp = 'tb1') AND (length(pAddress) = 42 OR length(pAddress) = 62));
+  END IF;
+
+  RETURN false;
+END
+$$ LANGUAGE plpgsql IMMUTABLE;
+
+-- HTML escaping without pgtg_native
+CREATE FUNCTION bench.html_escape(str text) RETURNS text
+AS $$
+  SELECT replace(replace(replace(replace(str, '&', '&amp;'), '<', '&lt;'), '>', '&gt;'), '"', '&quot;');
+$$ LANGUAGE sql STRICT IMMUTABLE;
+
+CREATE TABLE bench.sample (
+  id            integer PRIMARY KEY,
+  json          text NOT NULL,
+  address       text NOT NULL,
+  html          text NOT NULL
+);
+
+INSERT INTO bench.sample (id, json, address, html)
+SELECT i,
+       format(E'{\n"text": "%s",\n"id": %s\n}', repeat(E'line "with" quotes\n', 1 + i % 100), i),
+       (ARRAY['1A1zP1eP5QGefi2DMPTfTL5SLmv7DivfNa', '3J98t1WpEZ73CNmQviecrnyiWrnqRhWNLy',
+              'bc1qw508d6qejxtdg4y5r3zarvary0c5xw7kv8f3t4', 'bc1p0xlxvlhemja6c4dqv22uapctqupfhlxm9h8z3k2e72q4k9hcz7vqzk5jj0'])[1 + i % 4],
+       repeat('<b>Balance</b> & "change" ', 1 + i % 20)
+  FROM generate_series(1, 10000) i;
+
+ANALYZE bench.sample;
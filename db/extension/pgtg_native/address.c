@@ -0,0 +1,281 @@
+/*++
+
+Program name:
+
+  tgpg
+
+Module Name:
+
+  address.c
+
+Notices:
+
+  PostgreSQL extension pgtg_native: Bitcoin address validation
+
+Author:
+
+  Copyright (c) Prepodobny Alen
+
+  mailto: alienufo@inbox.ru
+  mailto: ufocomp@gmail.com
+
+--*/
+
+#include "address.h"
+
+#include <stdint.h>
+#include <string.h>
+
+/*----------------------------------------------------------------------------------------------------------------------
+
+  SHA-256 (FIPS 180-4), only what the checksum needs
+
+----------------------------------------------------------------------------------------------------------------------*/
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_block(uint32_t state[8], const unsigned char block[64]) {
+    uint32_t w[64];
+    uint32_t a, b, c, d, e, f, g, h;
+    int i;
+
+    for (i = 0; i < 16; i++)
+        w[i] = (uint32_t) block[i * 4] << 24 | (uint32_t) block[i * 4 + 1] << 16 | (uint32_t) block[i * 4 + 2] << 8 | block[i * 4 + 3];
+
+    for (i = 16; i < 64; i++) {
+        uint32_t s0 = ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    a = state[0]; b = state[1]; c = state[2]; d = state[3];
+    e = state[4]; f = state[5]; g = state[6]; h = state[7];
+
+    for (i = 0; i < 64; i++) {
+        uint32_t t1 = h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        uint32_t t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+/* Messages up to 55 bytes: one padded block */
+static void sha256_short(const unsigned char *data, size_t len, unsigned char digest[32]) {
+    uint32_t state[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    unsigned char block[64];
+    int i;
+
+    memset(block, 0, sizeof(block));
+    memcpy(block, data, len);
+
+    block[len] = 0x80;
+    block[62] = (unsigned char) ((len * 8) >> 8);
+    block[63] = (unsigned char) (len * 8);
+
+    sha256_block(state, block);
+
+    for (i = 0; i < 8; i++) {
+        digest[i * 4] = (unsigned char) (state[i] >> 24);
+        digest[i * 4 + 1] = (unsigned char) (state[i] >> 16);
+        digest[i * 4 + 2] = (unsigned char) (state[i] >> 8);
+        digest[i * 4 + 3] = (unsigned char) state[i];
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------
+
+  Base58Check
+
+----------------------------------------------------------------------------------------------------------------------*/
+
+#define LEGACY_SIZE 25
+
+static int base58_value(unsigned char ch) {
+    static const char *alphabet = "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz";
+    const char *p;
+
+    if (ch == 0)
+        return -1;
+
+    p = strchr(alphabet, ch);
+    return p == NULL ? -1 : (int) (p - alphabet);
+}
+
+int pgtg_is_legacy_address(const char *str, size_t len) {
+    unsigned char bytes[LEGACY_SIZE];
+    unsigned char digest[32];
+    size_t zeros = 0;
+    size_t i;
+    int j;
+
+    if (len < 26 || len > 35)
+        return 0;
+
+    memset(bytes, 0, sizeof(bytes));
+
+    /* Big-endian base 58 to base 256, the number must fit into 25 bytes */
+    for (i = 0; i < len; i++) {
+        int carry = base58_value((unsigned char) str[i]);
+        if (carry < 0)
+            return 0;
+
+        for (j = LEGACY_SIZE - 1; j >= 0; j--) {
+            carry += 58 * bytes[j];
+            bytes[j] = (unsigned char) carry;
+            carry >>= 8;
+        }
+
+        if (carry != 0)
+            return 0;
+    }
+
+    /* Every leading '1' is a leading zero byte */
+    while (zeros < len && str[zeros] == '1')
+        zeros++;
+
+    for (i = 0; i < LEGACY_SIZE && bytes[i] == 0; i++) {
+    }
+
+    if (i != zeros)
+        return 0;
+
+    /* P2PKH, P2SH; testnet P2PKH, P2SH */
+    if (bytes[0] != 0x00 && bytes[0] != 0x05 && bytes[0] != 0x6f && bytes[0] != 0xc4)
+        return 0;
+
+    sha256_short(bytes, LEGACY_SIZE - 4, digest);
+    sha256_short(digest, 32, digest);
+
+    return memcmp(digest, bytes + LEGACY_SIZE - 4, 4) == 0;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------
+
+  Bech32 / Bech32m
+
+----------------------------------------------------------------------------------------------------------------------*/
+
+#define BECH32_CONST 1
+#define BECH32M_CONST 0x2bc830a3
+
+static uint32_t bech32_polymod_step(uint32_t pre) {
+    uint8_t b = pre >> 25;
+    return ((pre & 0x1FFFFFF) << 5) ^
+           (-((b >> 0) & 1) & 0x3b6a57b2UL) ^
+           (-((b >> 1) & 1) & 0x26508e6dUL) ^
+           (-((b >> 2) & 1) & 0x1ea119faUL) ^
+           (-((b >> 3) & 1) & 0x3d4233ddUL) ^
+           (-((b >> 4) & 1) & 0x2a1462b3UL);
+}
+
+static int bech32_value(unsigned char ch) {
+    static const char *charset = "qpzry9x8gf2tvdw0s3jn54khce6mua7l";
+    const char *p;
+
+    if (ch == 0)
+        return -1;
+
+    p = strchr(charset, ch);
+    return p == NULL ? -1 : (int) (p - charset);
+}
+
+int pgtg_is_segwit_address(const char *str, size_t len) {
+    unsigned char data[90];
+    unsigned char program[40];
+    size_t hrp_len = 0;
+    size_t data_len;
+    size_t program_len = 0;
+    size_t i;
+    uint32_t chk = 1;
+    uint32_t acc = 0;
+    int bits = 0;
+    int lower = 0;
+    int upper = 0;
+
+    if (len < 8 || len > 90)
+        return 0;
+
+    for (i = 0; i < len; i++) {
+        unsigned char ch = (unsigned char) str[i];
+        if (ch < 33 || ch > 126)
+            return 0;
+        if (ch >= 'a' && ch <= 'z')
+            lower = 1;
+        if (ch >= 'A' && ch <= 'Z')
+            upper = 1;
+        if (ch == '1')
+            hrp_len = i;
+    }
+
+    if (lower && upper)
+        return 0;
+
+    /* Human-readable part: bc (mainnet), tb (testnet) */
+    if (hrp_len != 2)
+        return 0;
+    if (!((str[0] | 0x20) == 'b' && (str[1] | 0x20) == 'c') && !((str[0] | 0x20) == 't' && (str[1] | 0x20) == 'b'))
+        return 0;
+
+    data_len = len - hrp_len - 1;
+    if (data_len < 7)
+        return 0;
+
+    for (i = 0; i < hrp_len; i++)
+        chk = bech32_polymod_step(chk) ^ ((str[i] | 0x20) >> 5);
+    chk = bech32_polymod_step(chk);
+    for (i = 0; i < hrp_len; i++)
+        chk = bech32_polymod_step(chk) ^ ((str[i] | 0x20) & 0x1f);
+
+    for (i = 0; i < data_len; i++) {
+        unsigned char ch = (unsigned char) str[hrp_len + 1 + i];
+        int v = bech32_value(ch >= 'A' && ch <= 'Z' ? ch | 0x20 : ch);
+        if (v < 0)
+            return 0;
+        data[i] = (unsigned char) v;
+        chk = bech32_polymod_step(chk) ^ (uint32_t) v;
+    }
+
+    /* Witness version 0 uses Bech32, versions 1-16 use Bech32m */
+    if (data[0] > 16)
+        return 0;
+    if (chk != (data[0] == 0 ? BECH32_CONST : BECH32M_CONST))
+        return 0;
+
+    /* Witness program: 5-bit groups without the version and the checksum, to bytes without padding */
+    for (i = 1; i < data_len - 6; i++) {
+        acc = (acc << 5) | data[i];
+        bits += 5;
+        while (bits >= 8) {
+            bits -= 8;
+            if (program_len == sizeof(program))
+                return 0;
+            program[program_len++] = (unsigned char) (acc >> bits);
+        }
+    }
+
+    if (bits >= 5 || ((acc << (8 - bits)) & 0xff) != 0)
+        return 0;
+
+    if (program_len < 2 || program_len > 40)
+        return 0;
+
+    if (data[0] == 0 && program_len != 20 && program_len != 32)
+        return 0;
+
+    return 1;
+}
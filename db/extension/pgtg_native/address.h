@@ -0,0 +1,35 @@
+/*++
+
+Program name:
+
+  tgpg
+
+Module Name:
+
+  address.h
+
+Notices:
+
+  PostgreSQL extension pgtg_native: Bitcoin address validation
+
+Author:
+
+  Copyright (c) Prepodobny Alen
+
+  mailto: alienufo@inbox.ru
+  mailto: ufocomp@gmail.com
+
+--*/
+
+#ifndef PGTG_NATIVE_ADDRESS_H
+#define PGTG_NATIVE_ADDRESS_H
+
+#include <stddef.h>
+
+/* Base58Check address (P2PKH, P2SH; mainnet and testnet) with the double SHA-256 checksum */
+int pgtg_is_legacy_address(const char *str, size_t len);
+
+/* Bech32 (witness v0) or Bech32m (witness v1+) address of bc/tb with the BIP-173/BIP-350 checksum */
+int pgtg_is_segwit_address(const char *str, size_t len);
+
+#endif /* PGTG_NATIVE_ADDRESS_H */
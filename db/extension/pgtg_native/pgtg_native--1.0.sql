@@ -0,0 +1,26 @@
+-- complain if script is sourced in psql, rather than via CREATE EXTENSION
+\echo Use "CREATE EXTENSION pgtg_native" to load this file. \quit
+
+CREATE FUNCTION native_json_escape(text) RETURNS text
+AS 'MODULE_PATHNAME', 'native_json_escape'
+LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION native_html_escape(text) RETURNS text
+AS 'MODULE_PATHNAME', 'native_html_escape'
+LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION native_encode_json_string(text) RETURNS text
+AS 'MODULE_PATHNAME', 'native_encode_json_string'
+LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION native_is_legacy_address(text) RETURNS bool
+AS 'MODULE_PATHNAME', 'native_is_legacy_address'
+LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION native_is_segwit_address(text) RETURNS bool
+AS 'MODULE_PATHNAME', 'native_is_segwit_address'
+LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION native_is_bitcoin_address(text) RETURNS bool
+AS 'MODULE_PATHNAME', 'native_is_bitcoin_address'
+LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
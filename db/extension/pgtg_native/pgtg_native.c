@@ -0,0 +1,231 @@
+/*++
+
+Program name:
+
+  tgpg
+
+Module Name:
+
+  pgtg_native.c
+
+Notices:
+
+  PostgreSQL extension pgtg_native: native helpers of the bot schema
+
+Author:
+
+  Copyright (c) Prepodobny Alen
+
+  mailto: alienufo@inbox.ru
+  mailto: ufocomp@gmail.com
+
+--*/
+
+#include "postgres.h"
+
+#include "fmgr.h"
+#include "lib/stringinfo.h"
+#include "utils/builtins.h"
+
+#include "address.h"
+
+PG_MODULE_MAGIC;
+
+PG_FUNCTION_INFO_V1(native_json_escape);
+PG_FUNCTION_INFO_V1(native_html_escape);
+PG_FUNCTION_INFO_V1(native_encode_json_string);
+PG_FUNCTION_INFO_V1(native_is_legacy_address);
+PG_FUNCTION_INFO_V1(native_is_segwit_address);
+PG_FUNCTION_INFO_V1(native_is_bitcoin_address);
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+/* Escapes the contents of a JSON string (RFC 8259): the quotation mark, the reverse solidus and control characters */
+Datum native_json_escape(PG_FUNCTION_ARGS) {
+    text *str = PG_GETARG_TEXT_PP(0);
+    const char *data = VARDATA_ANY(str);
+    int len = VARSIZE_ANY_EXHDR(str);
+    StringInfoData buf;
+    int i;
+
+    for (i = 0; i < len; i++) {
+        unsigned char ch = (unsigned char) data[i];
+        if (ch < 0x20 || ch == '"' || ch == '\\')
+            break;
+    }
+
+    /* Nothing to escape: the argument is returned as is */
+    if (i == len)
+        PG_RETURN_TEXT_P(str);
+
+    initStringInfo(&buf);
+    enlargeStringInfo(&buf, len + 16);
+    appendBinaryStringInfo(&buf, data, i);
+
+    for (; i < len; i++) {
+        unsigned char ch = (unsigned char) data[i];
+
+        switch (ch) {
+            case '"':
+                appendStringInfoString(&buf, "\\\"");
+                break;
+            case '\\':
+                appendStringInfoString(&buf, "\\\\");
+                break;
+            case '\b':
+                appendStringInfoString(&buf, "\\b");
+                break;
+            case '\f':
+                appendStringInfoString(&buf, "\\f");
+                break;
+            case '\n':
+                appendStringInfoString(&buf, "\\n");
+                break;
+            case '\r':
+                appendStringInfoString(&buf, "\\r");
+                break;
+            case '\t':
+                appendStringInfoString(&buf, "\\t");
+                break;
+            default:
+                if (ch < 0x20)
+                    appendStringInfo(&buf, "\\u%04x", ch);
+                else
+                    appendStringInfoChar(&buf, (char) ch);
+                break;
+        }
+    }
+
+    PG_RETURN_TEXT_P(cstring_to_text_with_len(buf.data, buf.len));
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+/* Escapes text for parse_mode 'HTML' of the Bot API: &, <, > and " */
+Datum native_html_escape(PG_FUNCTION_ARGS) {
+    text *str = PG_GETARG_TEXT_PP(0);
+    const char *data = VARDATA_ANY(str);
+    int len = VARSIZE_ANY_EXHDR(str);
+    StringInfoData buf;
+    int i;
+
+    for (i = 0; i < len; i++) {
+        char ch = data[i];
+        if (ch == '&' || ch == '<' || ch == '>' || ch == '"')
+            break;
+    }
+
+    if (i == len)
+        PG_RETURN_TEXT_P(str);
+
+    initStringInfo(&buf);
+    enlargeStringInfo(&buf, len + 16);
+    appendBinaryStringInfo(&buf, data, i);
+
+    for (; i < len; i++) {
+        char ch = data[i];
+
+        switch (ch) {
+            case '&':
+                appendStringInfoString(&buf, "&amp;");
+                break;
+            case '<':
+                appendStringInfoString(&buf, "&lt;");
+                break;
+            case '>':
+                appendStringInfoString(&buf, "&gt;");
+                break;
+            case '"':
+                appendStringInfoString(&buf, "&quot;");
+                break;
+            default:
+                appendStringInfoChar(&buf, ch);
+                break;
+        }
+    }
+
+    PG_RETURN_TEXT_P(cstring_to_text_with_len(buf.data, buf.len));
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+/*
+ * The same repair of a JSON text as bot.encode_json_string() in one pass: line breaks between values are dropped,
+ * control characters and quotation marks inside strings are escaped (a quotation mark followed by ':', '}', ']',
+ * ',' or a line break closes the string). A reverse solidus inside a string is escaped as "\\".
+ */
+Datum native_encode_json_string(PG_FUNCTION_ARGS) {
+    text *str = PG_GETARG_TEXT_PP(0);
+    const char *data = VARDATA_ANY(str);
+    int len = VARSIZE_ANY_EXHDR(str);
+    StringInfoData buf;
+    bool quote = false;
+    int i;
+
+    /* As the PL/pgSQL version: no characters - no result */
+    if (len == 0)
+        PG_RETURN_NULL();
+
+    initStringInfo(&buf);
+    enlargeStringInfo(&buf, len + 16);
+
+    for (i = 0; i < len; i++) {
+        char ch = data[i];
+        char next = i + 1 < len ? data[i + 1] : '\0';
+
+        if (quote && next != ':' && next != '}' && next != ']' && next != ',' && next != '\n') {
+            switch (ch) {
+                case '\r':
+                    appendStringInfoString(&buf, "\\r");
+                    break;
+                case '\n':
+                    appendStringInfoString(&buf, "\\n");
+                    break;
+                case '\t':
+                    appendStringInfoString(&buf, "\\t");
+                    break;
+                case '"':
+                    appendStringInfoString(&buf, "\\\"");
+                    break;
+                case '\\':
+                    appendStringInfoString(&buf, "\\\\");
+                    break;
+                default:
+                    appendStringInfoChar(&buf, ch);
+                    break;
+            }
+        } else {
+            if (ch != '\r' && ch != '\n')
+                appendStringInfoChar(&buf, ch);
+
+            if (ch == '"')
+                quote = !quote;
+        }
+    }
+
+    PG_RETURN_TEXT_P(cstring_to_text_with_len(buf.data, buf.len));
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+Datum native_is_legacy_address(PG_FUNCTION_ARGS) {
+    text *str = PG_GETARG_TEXT_PP(0);
+    PG_RETURN_BOOL(pgtg_is_legacy_address(VARDATA_ANY(str), VARSIZE_ANY_EXHDR(str)));
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+Datum native_is_segwit_address(PG_FUNCTION_ARGS) {
+    text *str = PG_GETARG_TEXT_PP(0);
+    PG_RETURN_BOOL(pgtg_is_segwit_address(VARDATA_ANY(str), VARSIZE_ANY_EXHDR(str)));
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+Datum native_is_bitcoin_address(PG_FUNCTION_ARGS) {
+    text *str = PG_GETARG_TEXT_PP(0);
+    const char *data = VARDATA_ANY(str);
+    size_t len = VARSIZE_ANY_EXHDR(str);
+
+    PG_RETURN_BOOL(pgtg_is_legacy_address(data, len) || pgtg_is_segwit_address(data, len));
+}
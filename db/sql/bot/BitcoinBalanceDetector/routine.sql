@@ -2,28 +2,195 @@
 -- WEBHOOK FUNCTION ------------------------------------------------------------
 --------------------------------------------------------------------------------
 
+-- Fallback: the typed handlers below are called while bot.dispatch resolves them, other update types
+-- (edited_message, channel_post...) are logged
 CREATE OR REPLACE FUNCTION bot.BitcoinBalanceDetectorBot_webhook (
   pBotId    uuid,
   pBody     jsonb
 ) RETURNS   void
 AS $$
-DECLARE
-  b         record;
 BEGIN
-  SELECT * INTO b FROM jsonb_to_record(pBody) AS x(message jsonb, callback_query jsonb, update_id bigint);
+  CASE
+  WHEN pBody ? 'message' THEN
+    PERFORM bot.bbd_parse_message(pBotId, bot.decode_message(pBody));
+  WHEN pBody ? 'callback_query' THEN
+    PERFORM bot.bbd_parse_callback_query(pBotId, bot.decode_callback_query(pBody));
+  ELSE
+    PERFORM WriteToEventLog('W', 0, format('Unhandled update %s: %s', pBody->>'update_id',
+      (SELECT string_agg(k, ', ') FROM jsonb_object_keys(pBody) AS k WHERE k <> 'update_id')), 'webhook');
+  END CASE;
+END
+$$ LANGUAGE plpgsql
+  SECURITY DEFINER
+  SET search_path = bot, pg_temp;
 
-  IF b.message IS NOT NULL THEN
-    PERFORM bot.bbd_parse_message(pBotId, b.message, b.update_id);
-  END IF;
+--------------------------------------------------------------------------------
 
-  IF b.callback_query IS NOT NULL THEN
-    PERFORM bot.bbd_parse_callback_query(pBotId, b.callback_query, b.update_id);
-  END IF;
+-- Typed handlers: the update is decoded by the webhook worker (or bot.webhook when polling)
+CREATE OR REPLACE FUNCTION bot.BitcoinBalanceDetectorBot_message (
+  pBotId    uuid,
+  pMessage  bot.tg_message
+) RETURNS   void
+AS $$
+BEGIN
+  PERFORM bot.bbd_parse_message(pBotId, pMessage);
+END
+$$ LANGUAGE plpgsql
+  SECURITY DEFINER
+  SET search_path = bot, pg_temp;
+
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.BitcoinBalanceDetectorBot_callback_query (
+  pBotId    uuid,
+  pQuery    bot.tg_callback_query
+) RETURNS   void
+AS $$
+BEGIN
+  PERFORM bot.bbd_parse_callback_query(pBotId, pQuery);
 END
 $$ LANGUAGE plpgsql
   SECURITY DEFINER
   SET search_path = bot, pg_temp;
 
+--------------------------------------------------------------------------------
+-- POLLING PLAN ----------------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.bbd_plan (
+  pBotId        uuid,
+  pAddresses    text[] DEFAULT null
+) RETURNS       void
+AS $$
+BEGIN
+  -- One entry per address whatever the number of subscribers, polled with the shortest interval among them
+  INSERT INTO bot.bbd_address AS t (bot_id, address, period, subscribers)
+  SELECT a.bot_id, a.key, min(coalesce(make_interval(secs => i.value::int), INTERVAL '1 min')), count(*)
+    FROM bot.data a LEFT JOIN bot.data i ON i.bot_id = a.bot_id AND i.chat_id = a.chat_id AND i.user_id = a.user_id AND i.category = 'settings' AND i.key = 'interval'
+   WHERE a.bot_id = pBotId
+     AND a.category = 'address'
+     AND (pAddresses IS NULL OR a.key = ANY (pAddresses))
+   GROUP BY a.bot_id, a.key
+  ON CONFLICT (bot_id, address) DO UPDATE
+     SET period = EXCLUDED.period,
+         subscribers = EXCLUDED.subscribers,
+         next = least(t.next, coalesce(t.polled, t.next) + EXCLUDED.period)
+   WHERE (t.period, t.subscribers) IS DISTINCT FROM (EXCLUDED.period, EXCLUDED.subscribers);
+
+  DELETE FROM bot.bbd_address t
+   WHERE t.bot_id = pBotId
+     AND (pAddresses IS NULL OR t.address = ANY (pAddresses))
+     AND NOT EXISTS (SELECT FROM bot.data d WHERE d.key = t.address AND d.category = 'address' AND d.bot_id = t.bot_id);
+END
+$$ LANGUAGE plpgsql
+  SECURITY DEFINER
+  SET search_path = bot, pg_temp;
+
+--------------------------------------------------------------------------------
+-- bot.ft_bbd_plan -------------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.ft_bbd_plan()
+RETURNS trigger AS $$
+DECLARE
+  r             record;
+BEGIN
+  -- Addresses added or deleted and the addresses of the users whose interval is set or deleted
+  FOR r IN
+    SELECT x.bot_id, array_agg(DISTINCT x.address) AS addresses
+      FROM (SELECT c.bot_id, c.key AS address
+              FROM changed c
+             WHERE c.category = 'address'
+             UNION ALL
+            SELECT a.bot_id, a.key
+              FROM changed c INNER JOIN bot.data a ON a.bot_id = c.bot_id AND a.chat_id = c.chat_id AND a.user_id = c.user_id AND a.category = 'address'
+             WHERE c.category = 'settings'
+               AND c.key = 'interval') x
+     GROUP BY x.bot_id
+  LOOP
+    PERFORM bot.bbd_plan(r.bot_id, r.addresses);
+  END LOOP;
+
+  RETURN null;
+END;
+$$ LANGUAGE plpgsql
+   SECURITY DEFINER
+   SET search_path = bot, pg_temp;
+
+--------------------------------------------------------------------------------
+-- bot.ft_bbd_plan_update ------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.ft_bbd_plan_update()
+RETURNS trigger AS $$
+DECLARE
+  r             record;
+BEGIN
+  -- Only the rows whose address key or interval value is changed: balance writes to the value of the
+  -- addresses are not planned again
+  FOR r IN
+    WITH moved AS (
+      (SELECT n.bot_id, n.chat_id, n.user_id, n.category, n.key, CASE WHEN n.category = 'settings' THEN n.value END AS value
+         FROM new_rows n
+        WHERE n.category = 'address' OR (n.category = 'settings' AND n.key = 'interval')
+       EXCEPT
+       SELECT o.bot_id, o.chat_id, o.user_id, o.category, o.key, CASE WHEN o.category = 'settings' THEN o.value END
+         FROM old_rows o
+        WHERE o.category = 'address' OR (o.category = 'settings' AND o.key = 'interval'))
+      UNION
+      (SELECT o.bot_id, o.chat_id, o.user_id, o.category, o.key, CASE WHEN o.category = 'settings' THEN o.value END
+         FROM old_rows o
+        WHERE o.category = 'address' OR (o.category = 'settings' AND o.key = 'interval')
+       EXCEPT
+       SELECT n.bot_id, n.chat_id, n.user_id, n.category, n.key, CASE WHEN n.category = 'settings' THEN n.value END
+         FROM new_rows n
+        WHERE n.category = 'address' OR (n.category = 'settings' AND n.key = 'interval'))
+    )
+    SELECT x.bot_id, array_agg(DISTINCT x.address) AS addresses
+      FROM (SELECT m.bot_id, m.key AS address
+              FROM moved m
+             WHERE m.category = 'address'
+             UNION ALL
+            SELECT a.bot_id, a.key
+              FROM moved m INNER JOIN bot.data a ON a.bot_id = m.bot_id AND a.chat_id = m.chat_id AND a.user_id = m.user_id AND a.category = 'address'
+             WHERE m.category = 'settings') x
+     GROUP BY x.bot_id
+  LOOP
+    PERFORM bot.bbd_plan(r.bot_id, r.addresses);
+  END LOOP;
+
+  RETURN null;
+END;
+$$ LANGUAGE plpgsql
+   SECURITY DEFINER
+   SET search_path = bot, pg_temp;
+
+--------------------------------------------------------------------------------
+
+DROP TRIGGER IF EXISTS t_bbd_plan_insert ON bot.data;
+
+CREATE TRIGGER t_bbd_plan_insert
+  AFTER INSERT ON bot.data
+  REFERENCING NEW TABLE AS changed
+  FOR EACH STATEMENT
+  EXECUTE PROCEDURE bot.ft_bbd_plan();
+
+DROP TRIGGER IF EXISTS t_bbd_plan_update ON bot.data;
+
+CREATE TRIGGER t_bbd_plan_update
+  AFTER UPDATE ON bot.data
+  REFERENCING OLD TABLE AS old_rows NEW TABLE AS new_rows
+  FOR EACH STATEMENT
+  EXECUTE PROCEDURE bot.ft_bbd_plan_update();
+
+DROP TRIGGER IF EXISTS t_bbd_plan_delete ON bot.data;
+
+CREATE TRIGGER t_bbd_plan_delete
+  AFTER DELETE ON bot.data
+  REFERENCING OLD TABLE AS changed
+  FOR EACH STATEMENT
+  EXECUTE PROCEDURE bot.ft_bbd_plan();
+
 --------------------------------------------------------------------------------
 -- HEARTBEAT FUNCTION ----------------------------------------------------------
 --------------------------------------------------------------------------------
@@ -33,62 +200,50 @@ CREATE OR REPLACE FUNCTION bot.BitcoinBalanceDetectorBot_heartbeat (
 ) RETURNS       void
 AS $$
 DECLARE
-  r             record;
-  d             record;
-
-  i             interval;
+  cBatch        CONSTANT integer DEFAULT 100;            -- addresses in one multiaddr request
+  cPause        CONSTANT interval DEFAULT '10 sec';      -- between requests to blockchain.info
 
-  address       text;
+  vAddresses    text;
 
   vMessage      text;
   vContext      text;
 BEGIN
-  FOR d IN
-    SELECT bot_id, chat_id, user_id
-      FROM bot.data td INNER JOIN bot.list tl ON td.bot_id = tl.id AND tl.downtime < Now()
-     WHERE bot_id = pBotId
-     GROUP BY bot_id, chat_id, user_id
-     ORDER BY bot_id, chat_id, user_id
-  LOOP
-    UPDATE bot.list SET downtime = Now() + INTERVAL '30 sec' WHERE id = d.bot_id;
-
-    SELECT make_interval(secs => value::int) INTO i
-      FROM bot.data
-     WHERE bot_id = d.bot_id
-       AND chat_id = d.chat_id
-       AND user_id = d.user_id
-       AND category = 'settings'
-       AND key = 'interval';
-
-    i := coalesce(i, INTERVAL '1 min');
-
-    FOR r IN
-      SELECT key
-        FROM bot.data
-       WHERE bot_id = d.bot_id
-         AND chat_id = d.chat_id
-         AND user_id = d.user_id
-         AND category = 'address'
-         AND updated + i <= Now()
-       ORDER BY updated
-       LIMIT 50
-    LOOP
-      UPDATE bot.data
-         SET updated = Now()
-       WHERE bot_id = d.bot_id
-         AND chat_id = d.chat_id
-         AND user_id = d.user_id
-         AND category = 'address'
-         AND key = r.key;
-
-      address := coalesce(address || '|', '') || r.key;
-    END LOOP;
+  PERFORM FROM bot.list WHERE id = pBotId AND downtime < Now();
 
-    IF address IS NOT NULL THEN
-      PERFORM http.fetch(format('https://blockchain.info/multiaddr?active=%s&n=0', address), 'GET', null, null, 'bot.bbd_blockchain_done', 'bot.bbd_blockchain_fail', 'blockchain', pBotId::text, 'multiaddr');
-      EXIT WHEN true; -- one circle - one user
-    END IF;
-  END LOOP;
+  IF NOT FOUND THEN
+    RETURN;
+  END IF;
+
+  -- The pause between requests is kept by the plan: bot.list is written on upstream errors only
+  PERFORM FROM bot.bbd_address WHERE bot_id = pBotId AND polled > Now() - cPause;
+
+  IF FOUND THEN
+    RETURN;
+  END IF;
+
+  -- The most overdue addresses of all subscribers in one request; the response is sent to every subscriber
+  WITH due AS (
+    SELECT t.address
+      FROM bot.bbd_address t
+     WHERE t.bot_id = pBotId
+       AND t.next <= Now()
+     ORDER BY t.next
+     LIMIT cBatch
+       FOR UPDATE SKIP LOCKED
+  ), polled AS (
+    UPDATE bot.bbd_address t
+       SET polled = Now(),
+           next = Now() + t.period
+      FROM due
+     WHERE t.bot_id = pBotId
+       AND t.address = due.address
+    RETURNING t.address
+  )
+  SELECT string_agg(p.address, '|') INTO vAddresses FROM polled p;
+
+  IF vAddresses IS NOT NULL THEN
+    PERFORM bot.fetch_cached(format('https://blockchain.info/multiaddr?active=%s&n=0', vAddresses), 'GET', null, null, 'bot.bbd_blockchain_done', 'bot.bbd_blockchain_fail', 'blockchain', pBotId::text, 'multiaddr');
+  END IF;
 EXCEPTION
 WHEN others THEN
   GET STACKED DIAGNOSTICS vMessage = MESSAGE_TEXT, vContext = PG_EXCEPTION_CONTEXT;
@@ -102,18 +257,16 @@ $$ LANGUAGE plpgsql
 -- MESSAGE ---------------------------------------------------------------------
 --------------------------------------------------------------------------------
 
+DROP FUNCTION IF EXISTS bot.bbd_parse_message(uuid, jsonb, bigint);
+
 CREATE OR REPLACE FUNCTION bot.bbd_parse_message (
   pBotId        uuid,
-  pMessage      jsonb,
-  pUpdateId     bigint
+  pMessage      bot.tg_message
 ) RETURNS       void
 AS $$
 DECLARE
   b             record;
-  m             record;
-  c             record;
-  u             record;
-  f             record;
+  m             ALIAS FOR pMessage;
 
   isCommand     bool;
 
@@ -132,32 +285,27 @@ BEGIN
     RETURN;
   END IF;
 
-  SELECT * INTO m FROM jsonb_to_record(pMessage) AS x(chat jsonb, date double precision, "from" jsonb, caption text, text text, entities jsonb, document jsonb, message_id bigint);
-  SELECT * INTO c FROM jsonb_to_record(m.chat) AS x(id bigint, type text, username text, last_name text, first_name text);
-  SELECT * INTO u FROM jsonb_to_record(m."from") AS x(id bigint, is_bot bool, username text, last_name text, first_name text, language_code text);
-  SELECT * INTO f FROM jsonb_to_record(m.document) AS x(file_id text, file_name text, file_size int, mime_type text, file_unique_id text);
-
-  IF m.document IS NOT NULL THEN
-    IF f.mime_type = 'text/csv' THEN
-      IF u.language_code = 'ru' THEN
-        vMessage := format('Загрузка файла: "%s".', f.file_name);
+  IF m.file_id IS NOT NULL THEN
+    IF m.mime_type = 'text/csv' THEN
+      IF m.language_code = 'ru' THEN
+        vMessage := format('Загрузка файла: "%s".', m.file_name);
       ELSE
-        vMessage := format('Downloading file: "%s".', f.file_name);
+        vMessage := format('Downloading file: "%s".', m.file_name);
       END IF;
 
-      PERFORM bot.new_file(f.file_id, b.id, c.id, u.id, f.file_name, '/', f.file_size, Now(), null, f.file_unique_id, m.caption, f.mime_type);
-      PERFORM tg.get_file(b.id, f.file_id, 'bot.get_file_done', 'bot.get_file_fail');
+      PERFORM bot.new_file(m.file_id, b.id, m.chat_id, m.user_id, m.file_name, '/', m.file_size, Now(), null, m.file_unique_id, m.caption, m.mime_type);
+      PERFORM tg.get_file(b.id, m.file_id, 'bot.get_file_done', 'bot.get_file_fail');
     ELSE
-      IF u.language_code = 'ru' THEN
-        vMessage := format('Неверный тип файла: %s', f.mime_type);
+      IF m.language_code = 'ru' THEN
+        vMessage := format('Неверный тип файла: %s', m.mime_type);
       ELSE
-        vMessage := format('Invalid file type: %s', f.mime_type);
+        vMessage := format('Invalid file type: %s', m.mime_type);
       END IF;
     END IF;
   END IF;
 
   IF m.text IS NOT NULL THEN
-    PERFORM WriteToEventLog('M', 0, m.text, 'message', c.username, 'telegram');
+    PERFORM WriteToEventLog('M', 0, m.text, 'message', m.chat_username, 'telegram');
 
     isCommand := SubStr(m.text, 1, 1) = '/';
 
@@ -165,73 +313,73 @@ BEGIN
       vParam := string_to_array(m.text, ' ');
       vCommand := replace(vParam[1], '@' || b.username, '');
     ELSE
-      SELECT command INTO vCommand FROM bot.context WHERE bot_id = b.id AND chat_id = c.id AND user_id = u.id;
+      SELECT command INTO vCommand FROM bot.context WHERE bot_id = b.id AND chat_id = m.chat_id AND user_id = m.user_id;
     END IF;
 
-    PERFORM bot.context(b.id, c.id, u.id, vCommand, m.text, pMessage, to_timestamp(m.date));
+    PERFORM bot.context(b.id, m.chat_id, m.user_id, vCommand, m.text, to_jsonb(m), to_timestamp(m.date));
 
     CASE vCommand
     WHEN '/start' THEN
-        IF u.language_code = 'ru' THEN
+        IF m.language_code = 'ru' THEN
 	    vMessage := format('Здравствуйте, Вас приветствует бот %s!', b.full_name);
       ELSE
 	    vMessage := format('Hello, you are welcomed by a bot %s!', b.full_name);
       END IF;
 
-      PERFORM bot.bbd_command_start(u.language_code, to_timestamp(m.date));
+      PERFORM bot.bbd_command_start(m.language_code, to_timestamp(m.date));
     WHEN '/help' THEN
-      vMessage := bot.bbd_command_help(u.language_code);
+      vMessage := bot.bbd_command_help(m.language_code);
     WHEN '/add' THEN
       IF isCommand THEN
-        IF u.language_code = 'ru' THEN
+        IF m.language_code = 'ru' THEN
           vMessage := 'Введите, пожалуйста, один или несколько Bitcoin адресов.';
         ELSE
           vMessage := 'Please enter one or more Bitcoin addresses.';
         END IF;
 
         IF array_length(vParam, 1) > 1 THEN
-          vMessage := bot.bbd_command_add(vParam[2:], u.language_code, to_timestamp(m.date));
+          vMessage := bot.bbd_command_add(vParam[2:], m.language_code, to_timestamp(m.date));
         END IF;
       ELSE
-        vMessage := bot.bbd_command_add(string_to_array(replace(m.text, E'\n', ' '), ' '), u.language_code, to_timestamp(m.date));
+        vMessage := bot.bbd_command_add(string_to_array(replace(m.text, E'\n', ' '), ' '), m.language_code, to_timestamp(m.date));
       END IF;
     WHEN '/delete' THEN
       IF isCommand THEN
-        IF u.language_code = 'ru' THEN
+        IF m.language_code = 'ru' THEN
           vMessage := 'Введите, пожалуйста, один или несколько Bitcoin адресов.';
         ELSE
           vMessage := 'Please enter one or more Bitcoin addresses.';
         END IF;
 
         IF array_length(vParam, 1) > 1 THEN
-          vMessage := bot.bbd_command_delete(vParam[2:], u.language_code);
+          vMessage := bot.bbd_command_delete(vParam[2:], m.language_code);
         END IF;
       ELSE
-        vMessage := bot.bbd_command_delete(string_to_array(replace(m.text, E'\n', ' '), ' '), u.language_code);
+        vMessage := bot.bbd_command_delete(string_to_array(replace(m.text, E'\n', ' '), ' '), m.language_code);
       END IF;
     WHEN '/list' THEN
       IF isCommand THEN
-        vMessage := bot.bbd_command_list(u.language_code);
+        vMessage := bot.bbd_command_list(m.language_code);
       END IF;
     WHEN '/check' THEN
       IF isCommand THEN
-        vMessage := bot.bbd_command_check(u.language_code);
+        vMessage := bot.bbd_command_check(m.language_code);
       END IF;
     WHEN '/settings' THEN
       IF isCommand THEN
-        IF u.language_code = 'ru' THEN
+        IF m.language_code = 'ru' THEN
           vMessage := E'Введите одно или несколько настроек в формате:\r\n<pre>ключ=значение</pre>';
           vMessage := concat(vMessage, E'\r\n\r\nТекущие настройки:\r\n\r\n');
         ELSE
           vMessage := 'Enter one or more settings in the format:\r\n<pre>key=value</pre>';
           vMessage := concat(vMessage, E'\r\n\r\nCurrent settings:\r\n\r\n');
         END IF;
-        vMessage := concat(vMessage, bot.bbd_command_settings(null, u.language_code));
+        vMessage := concat(vMessage, bot.bbd_command_settings(null, m.language_code));
       ELSE
-        vMessage := bot.bbd_command_settings(string_to_array(m.text, E'\n'), u.language_code);
+        vMessage := bot.bbd_command_settings(string_to_array(m.text, E'\n'), m.language_code);
       END IF;
     ELSE
-      IF u.language_code = 'ru' THEN
+      IF m.language_code = 'ru' THEN
         vMessage := 'Неизвестная команда.';
       ELSE
         vMessage := 'Unknown command.';
@@ -241,14 +389,14 @@ BEGIN
   END IF;
 
   IF vMessage IS NOT NULL THEN
-    PERFORM tg.send_message(b.id, c.id, vMessage, 'HTML', keyboard, 'telegram_message_done');
+    PERFORM tg.send_message(b.id, m.chat_id, vMessage, 'HTML', keyboard, 'telegram_message_done');
   END IF;
 
   IF vFileName IS NOT NULL AND vDocument IS NOT NULL THEN
-    PERFORM tg.send_document_multipart(b.id, c.id, vFileName, vDocument, 'text/csv');
+    PERFORM tg.send_document_multipart(b.id, m.chat_id, vFileName, vDocument, 'text/csv');
   ELSE
     IF vDocument IS NOT NULL THEN
-      PERFORM tg.send_document(b.id, c.id, vDocument, 'HTML', keyboard);
+      PERFORM tg.send_document(b.id, m.chat_id, vDocument, 'HTML', keyboard);
     END IF;
   END IF;
 END
@@ -260,18 +408,16 @@ $$ LANGUAGE plpgsql
 -- CALLBACK QUERY --------------------------------------------------------------
 --------------------------------------------------------------------------------
 
+DROP FUNCTION IF EXISTS bot.bbd_parse_callback_query(uuid, jsonb, bigint);
+
 CREATE OR REPLACE FUNCTION bot.bbd_parse_callback_query (
   pBotId        uuid,
-  pQuery        jsonb,
-  pUpdateId     bigint
+  pQuery        bot.tg_callback_query
 ) RETURNS       void
 AS $$
 DECLARE
   b             record;
-  q             record;
-  u             record;
-  m             record;
-  c             record;
+  q             ALIAS FOR pQuery;
 
   showAlert     bool DEFAULT false;
   editMessage   bool DEFAULT false;
@@ -293,12 +439,7 @@ BEGIN
     RETURN;
   END IF;
 
-  SELECT * INTO q FROM jsonb_to_record(pQuery) AS x(id text, data text, "from" jsonb, message jsonb, chat_instance text);
-  SELECT * INTO u FROM jsonb_to_record(q."from") AS x(id bigint, is_bot bool, username text, last_name text, first_name text, language_code text);
-  SELECT * INTO m FROM jsonb_to_record(q.message) AS x(chat jsonb, date double precision, "from" jsonb, text text, entities jsonb, message_id bigint, reply_markup jsonb);
-  SELECT * INTO c FROM jsonb_to_record(m.chat) AS x(id bigint, type text, username text, last_name text, first_name text);
-
-  IF u.language_code = 'ru' THEN
+  IF q.language_code = 'ru' THEN
 	vText := 'Что-то пошло не так :(';
   ELSE
 	vText := 'Something went wrong :(';
@@ -313,11 +454,11 @@ BEGIN
 	vText := '';
     vMessage = null;
 
-    PERFORM tg.delete_message(b.id, c.id, m.message_id);
+    PERFORM tg.delete_message(b.id, q.chat_id, q.message_id);
 
   ELSE
 
-    IF u.language_code = 'ru' THEN
+    IF q.language_code = 'ru' THEN
       vMessage := 'Неизвестные данные.';
     ELSE
       vMessage := 'Unknown data.';
@@ -327,21 +468,21 @@ BEGIN
 
   PERFORM tg.answer_callback_query(b.id, q.id, vText, showAlert);
 
-  PERFORM WriteToEventLog('M', 0, coalesce(NULLIF(vText, ''), m.text), q.data, u.username, 'telegram');
+  PERFORM WriteToEventLog('M', 0, coalesce(NULLIF(vText, ''), q.message_text), q.data, q.username, 'telegram');
 
   IF vMessage IS NOT NULL THEN
     IF editMessage THEN
-      PERFORM tg.edit_message_text(b.id, c.id, m.message_id, vMessage, 'HTML', keyboard);
+      PERFORM tg.edit_message_text(b.id, q.chat_id, q.message_id, vMessage, 'HTML', keyboard);
 	ELSE
-      PERFORM tg.send_message(b.id, c.id, vMessage, 'HTML', keyboard, 'telegram_message_done');
+      PERFORM tg.send_message(b.id, q.chat_id, vMessage, 'HTML', keyboard, 'telegram_message_done');
     END IF;
   END IF;
 
   IF vFileName IS NOT NULL AND vDocument IS NOT NULL THEN
-    PERFORM tg.send_document_multipart(b.id, c.id, vFileName, vDocument, vContentType);
+    PERFORM tg.send_document_multipart(b.id, q.chat_id, vFileName, vDocument, vContentType);
   ELSE
     IF vDocument IS NOT NULL THEN
-      PERFORM tg.send_document(b.id, c.id, vDocument, 'HTML');
+      PERFORM tg.send_document(b.id, q.chat_id, vDocument, 'HTML');
     END IF;
   END IF;
 END
@@ -359,15 +500,12 @@ CREATE OR REPLACE FUNCTION bot.bbd_blockchain_done (
 AS $$
 DECLARE
   r             record;
-  e             record;
-  d             record;
 
   reply         jsonb;
 
-  vLanguageCode text;
-
-  vOld          text;
-  vNew          text;
+  vBotId        uuid[];
+  vChatId       bigint[];
+  vText         text[];
 
   vMessage      text;
   vContext      text;
@@ -380,41 +518,62 @@ BEGIN
 
     IF r.agent = 'blockchain' AND r.command = 'multiaddr' THEN
 
-      FOR e IN SELECT * FROM jsonb_to_recordset(reply->'addresses') AS x(address text, n_tx int, total_received double precision, total_sent double precision, final_balance double precision)
-      LOOP
-        vNew := format(E'%s\t%s\t%s\t%s', e.n_tx, to_char(e.total_received / 100000000, 'FM999999990.00000000'), to_char(e.total_sent / 100000000, 'FM999999990.00000000'), to_char(e.final_balance / 100000000, 'FM999999990.00000000'));
-
-        FOR d IN SELECT bot_id, chat_id, user_id FROM bot.data WHERE category = 'address' AND key = e.address GROUP BY bot_id, chat_id, user_id
-        LOOP
-          SELECT language_code INTO vLanguageCode FROM bot.list WHERE id = d.bot_id;
-
-          IF vLanguageCode = 'ru' THEN
-            vMessage := E'Обнаружено изменение баланса:';
-          ELSE
-            vMessage := E'Balance Change Detected:';
-          END IF;
-
-          SELECT value INTO vOld
-            FROM bot.data
-           WHERE bot_id = d.bot_id
-             AND chat_id = d.chat_id
-             AND user_id = d.user_id
-             AND category = 'address'
-             AND key = e.address;
-
-          PERFORM bot.set_data('address', e.address, vNew, row_to_json(e)::jsonb, Now(), d.user_id, d.chat_id, d.bot_id);
-
-          IF encode(digest(vOld, 'md5'), 'hex') != encode(digest(vNew, 'md5'), 'hex') THEN
-            IF vOld = 'Not data' THEN
-              vMessage := concat(vMessage, E'\r\n\r\n<pre>', e.address, E'\r\n', vNew, '</pre>');
-			ELSE
-              vMessage := concat(vMessage, E'\r\n\r\n<pre>', e.address, E'\r\n', vOld, E'\r\n', vNew, '</pre>');
-			END IF;
-
-            PERFORM tg.send_message(d.bot_id, d.user_id, vMessage, 'HTML');
-          END IF;
-        END LOOP;
-      END LOOP;
+      -- Balances are written once per address and once per subscriber whose stored value differs from the
+      -- response (a new subscriber of a polled address included), the changes are sent as one message per chat
+      -- (by 20 addresses: the message text is limited) with one outbox insert
+      WITH response AS (
+        SELECT x.address, x.n_tx, x.total_received, x.total_sent, x.final_balance,
+               format(E'%s\t%s\t%s\t%s', x.n_tx,
+                      to_char(x.total_received / 100000000.0, 'FM999999990.00000000'),
+                      to_char(x.total_sent / 100000000.0, 'FM999999990.00000000'),
+                      to_char(x.final_balance / 100000000.0, 'FM999999990.00000000')) AS value,
+               to_jsonb(x) AS data
+          FROM jsonb_to_recordset(reply->'addresses') AS x(address text, n_tx bigint, total_received bigint, total_sent bigint, final_balance bigint)
+      ), balances AS (
+        UPDATE bot.bbd_address t
+           SET n_tx = x.n_tx,
+               received = x.total_received,
+               sent = x.total_sent,
+               balance = x.final_balance
+          FROM response x
+         WHERE t.address = x.address
+           AND (t.n_tx, t.received, t.sent, t.balance) IS DISTINCT FROM (x.n_tx, x.total_received, x.total_sent, x.final_balance)
+        RETURNING t.address
+      ), subscribers AS (
+        UPDATE bot.data d
+           SET value = x.value,
+               data = x.data,
+               updated = Now()
+          FROM response x INNER JOIN bot.data o ON o.category = 'address' AND o.key = x.address AND o.value IS DISTINCT FROM x.value
+         WHERE d.bot_id = o.bot_id
+           AND d.chat_id = o.chat_id
+           AND d.user_id = o.user_id
+           AND d.category = 'address'
+           AND d.key = o.key
+        RETURNING d.bot_id, d.chat_id, d.key AS address, o.value AS old_value, x.value AS new_value
+      ), changes AS (
+        -- Subscribers of one chat (a group) get the address once
+        SELECT DISTINCT ON (bot_id, chat_id, address) bot_id, chat_id, address, old_value, new_value
+          FROM subscribers
+         ORDER BY bot_id, chat_id, address
+      ), messages AS (
+        SELECT s.bot_id, s.chat_id, l.language_code,
+               string_agg(CASE WHEN s.old_value = 'Not data'
+                               THEN concat('<pre>', s.address, E'\r\n', s.new_value, '</pre>')
+                               ELSE concat('<pre>', s.address, E'\r\n', s.old_value, E'\r\n', s.new_value, '</pre>')
+                          END, E'\r\n\r\n' ORDER BY s.address) AS text
+          FROM (SELECT *, (row_number() OVER (PARTITION BY bot_id, chat_id ORDER BY address) - 1) / 20 AS part
+                  FROM changes) s INNER JOIN bot.list l ON l.id = s.bot_id
+         GROUP BY s.bot_id, s.chat_id, l.language_code, s.part
+      )
+      SELECT array_agg(bot_id), array_agg(chat_id),
+             array_agg(concat(CASE WHEN language_code = 'ru' THEN 'Обнаружено изменение баланса:' ELSE 'Balance Change Detected:' END, E'\r\n\r\n', text))
+        INTO vBotId, vChatId, vText
+        FROM messages;
+
+      IF vBotId IS NOT NULL THEN
+        PERFORM bot.send_messages(vBotId, vChatId, vText, 'HTML');
+      END IF;
 
       --DELETE FROM http.response WHERE request = pRequest;
       --DELETE FROM http.request WHERE id = pRequest;
@@ -477,23 +636,17 @@ DECLARE
   r             record;
   f             record;
   e             record;
-  b             record;
-
-  count         int;
 
   uBotId        uuid;
-  vFileId       text;
 
   reply         jsonb;
 
-  vLanguageCode text;
   vMessage      text;
   vContext      text;
 BEGIN
   SELECT agent, profile, command, resource, status, status_text, response, message INTO r FROM http.fetch WHERE id = pRequest;
 
   uBotId := r.profile::uuid;
-  SELECT language_code INTO vLanguageCode FROM bot.list WHERE id = uBotId;
 
   IF coalesce(r.status, 0) = 200 THEN
 
@@ -507,35 +660,12 @@ BEGIN
 		RETURN;
 	  END IF;
 
-      FOR e IN SELECT * FROM jsonb_to_record(f.result) AS x(file_id text, file_unique_id text, file_size int, file_path text)
+      FOR e IN SELECT * FROM jsonb_to_record(f.result) AS x(file_id text, file_unique_id text, file_size bigint, file_path text)
       LOOP
         PERFORM bot.update_file(e.file_id, psize => e.file_size, plink => e.file_path);
-        PERFORM tg.file_path(uBotId, e.file_id, e.file_path, 'bot.bbd_get_file_done', 'bot.bbd_get_file_fail');
+        PERFORM bot.download_add(uBotId, e.file_id, e.file_path, 'bot.bbd_file_downloaded');
       END LOOP;
 
-    ELSIF r.agent = 'telegram' AND r.command = 'file_path' THEN
-
-      vFileId := r.message;
-      PERFORM bot.update_file(vFileId, pdata => convert_to(r.response, 'utf8'));
-
-      SELECT bot_id, chat_id, user_id INTO b FROM bot.file WHERE file_id = vFileId;
-      PERFORM bot.context(uBotId, b.chat_id, b.user_id, '/parse', null, null, Now());
-
-      BEGIN
-        count := bot.bbd_parse_file(vFileId);
-
-        IF vLanguageCode = 'ru' THEN
-          vMessage := format('Обработано <b>%s</b> строк.', count);
-	    ELSE
-          vMessage := format('Processed <b>%s</b> rows.', count);
-	    END IF;
-      EXCEPTION
-      WHEN others THEN
-        GET STACKED DIAGNOSTICS vMessage = MESSAGE_TEXT, vContext = PG_EXCEPTION_CONTEXT;
-        PERFORM WriteDiagnostics(vMessage, vContext);
-      END;
-
-      PERFORM tg.send_message(b.bot_id, b.chat_id, vMessage, 'HTML');
     END IF;
 
   ELSE
@@ -552,6 +682,76 @@ $$ LANGUAGE plpgsql
   SECURITY DEFINER
   SET search_path = bot, public, pg_temp;
 
+--------------------------------------------------------------------------------
+-- bot.bbd_file_downloaded -----------------------------------------------------
+--------------------------------------------------------------------------------
+
+DROP FUNCTION IF EXISTS bot.bbd_file_downloaded(text, text);
+
+CREATE OR REPLACE FUNCTION bot.bbd_file_downloaded (
+  pFileId       text
+) RETURNS       void
+AS $$
+DECLARE
+  f             record;
+BEGIN
+  SELECT bot_id, chat_id, user_id, file_path INTO f FROM bot.file WHERE file_id = pFileId;
+
+  IF NOT FOUND THEN
+    RETURN;
+  END IF;
+
+  -- The file is parsed by the bot process and merged into bot.data in one statement
+  PERFORM bot.import_add(f.bot_id, f.chat_id, f.user_id, f.file_path, 'address', 'Not data', pFileId, 'bot.bbd_file_imported');
+END
+$$ LANGUAGE plpgsql
+  SECURITY DEFINER
+  SET search_path = bot, public, pg_temp;
+
+--------------------------------------------------------------------------------
+-- bot.bbd_file_imported -------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.bbd_file_imported (
+  pId           bigint
+) RETURNS       void
+AS $$
+DECLARE
+  r             record;
+
+  vLanguageCode text;
+  vMessage      text;
+BEGIN
+  SELECT bot_id, chat_id, user_id, rows, rejected, error INTO r FROM bot.import WHERE id = pId;
+
+  IF NOT FOUND THEN
+    RETURN;
+  END IF;
+
+  SELECT language_code INTO vLanguageCode FROM bot.list WHERE id = r.bot_id;
+
+  PERFORM bot.context(r.bot_id, r.chat_id, r.user_id, '/parse', null, null, Now());
+
+  IF r.error IS NOT NULL THEN
+    vMessage := r.error;
+  ELSIF vLanguageCode = 'ru' THEN
+    vMessage := format('Обработано <b>%s</b> строк.', r.rows);
+    IF r.rejected > 0 THEN
+      vMessage := concat(vMessage, format(E'\r\nОтклонено строк: <b>%s</b>.', r.rejected));
+    END IF;
+  ELSE
+    vMessage := format('Processed <b>%s</b> rows.', r.rows);
+    IF r.rejected > 0 THEN
+      vMessage := concat(vMessage, format(E'\r\nRejected rows: <b>%s</b>.', r.rejected));
+    END IF;
+  END IF;
+
+  PERFORM bot.send_message(r.bot_id, r.chat_id, vMessage, 'HTML');
+END
+$$ LANGUAGE plpgsql
+  SECURITY DEFINER
+  SET search_path = bot, public, pg_temp;
+
 --------------------------------------------------------------------------------
 -- bot.bbd_get_file_fail -------------------------------------------------------
 --------------------------------------------------------------------------------
@@ -636,6 +836,28 @@ $$ LANGUAGE plpgsql
   SECURITY DEFINER
   SET search_path = bot, public, pg_temp;
 
+--------------------------------------------------------------------------------
+-- With the pgtg_native extension the address is decoded and its checksum is verified
+-- (Base58Check, Bech32/Bech32m); without it only the prefix and the length are checked.
+
+DO $$
+BEGIN
+  IF to_regprocedure('bot.native_is_bitcoin_address(text)') IS NOT NULL THEN
+    CREATE OR REPLACE FUNCTION bot.IsLegacyAddress(pAddress text) RETURNS bool
+    AS 'SELECT coalesce(bot.native_is_legacy_address(pAddress), false)'
+    LANGUAGE sql IMMUTABLE;
+
+    CREATE OR REPLACE FUNCTION bot.IsSegWitAddress(pAddress text) RETURNS bool
+    AS 'SELECT coalesce(bot.native_is_segwit_address(pAddress), false)'
+    LANGUAGE sql IMMUTABLE;
+
+    CREATE OR REPLACE FUNCTION bot.IsBitcoinAddress(pAddress text) RETURNS bool
+    AS 'SELECT coalesce(bot.native_is_bitcoin_address(pAddress), false)'
+    LANGUAGE sql IMMUTABLE;
+  END IF;
+END;
+$$;
+
 --------------------------------------------------------------------------------
 -- FUNCTION command_start ------------------------------------------------------
 --------------------------------------------------------------------------------
@@ -826,28 +1048,39 @@ CREATE OR REPLACE FUNCTION bot.bbd_command_check (
 ) RETURNS   text
 AS $$
 DECLARE
-  r         record;
-  i         interval;
+  vTtl      interval;
+  vFresh    text;
   vMessage  text;
 BEGIN
   pLanguage := coalesce(pLanguage, 'en');
-  SELECT make_interval(secs => max(value::int)) INTO i FROM bot.data WHERE category = 'settings' AND key = 'interval';
 
-  FOR r IN SELECT * FROM get_data('address')
-  LOOP
-    UPDATE bot.data
-       SET updated = Now() - i
-     WHERE category = 'address'
-       AND bot_id = current_bot_id()
-       AND chat_id = current_chat_id()
-       and user_id = current_user_id();
+  SELECT ttl INTO vTtl FROM bot.fetch_policy WHERE agent = 'blockchain' AND command = 'multiaddr';
+  vTtl := coalesce(vTtl, interval '0');
+
+  -- Balances polled within the cache lifetime are answered at once, the rest are polled now
+  SELECT string_agg(concat(d.key, E'\r\n', d.value), E'\r\n\r\n' ORDER BY d.key) INTO vFresh
+    FROM get_data('address') d INNER JOIN bot.bbd_address t ON t.bot_id = current_bot_id() AND t.address = d.key
+   WHERE t.n_tx IS NOT NULL
+     AND t.polled >= Now() - vTtl;
 
+  UPDATE bot.bbd_address t
+     SET next = Now()
+    FROM get_data('address') d
+   WHERE t.bot_id = current_bot_id()
+     AND t.address = d.key
+     AND (t.n_tx IS NULL OR t.polled IS NULL OR t.polled < Now() - vTtl);
+
+  IF FOUND THEN
     IF pLanguage = 'ru' THEN
       vMessage := 'Принято.';
     ELSE
       vMessage := 'Accepted.';
     END IF;
-  END LOOP;
+  END IF;
+
+  IF vFresh IS NOT NULL THEN
+    vMessage := concat('<pre>', vFresh, '</pre>', E'\r\n\r\n' || vMessage);
+  END IF;
 
   IF vMessage IS NULL THEN
     IF pLanguage = 'ru' THEN
@@ -937,45 +1170,6 @@ $$ LANGUAGE plpgsql
 -- FUNCTION bbd_parse_file -----------------------------------------------------
 --------------------------------------------------------------------------------
 
-CREATE OR REPLACE FUNCTION bot.bbd_parse_file (
-  pFileId       text
-) RETURNS       int
-AS $$
-DECLARE
-  f             record;
-  r             record;
-  c             record;
-
-  arValues      text[];
-
-  encoding      text;
-  count         int DEFAULT 0;
-BEGIN
-  SELECT value INTO encoding FROM bot.get_data('settings', 'encoding');
-
-  arValues := array_cat(null, ARRAY['#', 'address', 'count', 'received', 'sent', 'balance', 'description']);
-
-  FOR f IN SELECT convert_from(file_data, 'UTF-8') AS data FROM bot.file WHERE file_id = pFileId
-  LOOP
-    FOR r IN SELECT * FROM string_to_table(f.data, E'\n') AS line
-    LOOP
-      FOR c IN SELECT * FROM string_to_table(r.line, E';') AS data
-      LOOP
-        IF count = 0 THEN
-          IF NOT c.data = ANY (arValues) THEN
-            RAISE EXCEPTION 'Invalid value "%" in header. Valid values: [%]', c.data, arValues;
-          END IF;
-        ELSE
-
-		END IF;
-      END LOOP;
-
-      count := count + 1;
-    END LOOP;
-  END LOOP;
-
-  RETURN count;
-END
-$$ LANGUAGE plpgsql
-  SECURITY DEFINER
-  SET search_path = bot, public, pg_temp;
+-- Replaced by bot.import (parsed by the bot process)
+DROP FUNCTION IF EXISTS bot.bbd_parse_file(text);
+DROP FUNCTION IF EXISTS bot.bbd_parse_file(text, text);
@@ -0,0 +1,33 @@
+--------------------------------------------------------------------------------
+-- bot.bbd_address -------------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE TABLE bot.bbd_address (
+  bot_id        uuid NOT NULL REFERENCES bot.list ON DELETE CASCADE,
+  address       text NOT NULL,
+  period        interval NOT NULL,
+  subscribers   integer NOT NULL,
+  polled        timestamptz,
+  next          timestamptz NOT NULL DEFAULT Now(),
+  n_tx          bigint,
+  received      bigint,
+  sent          bigint,
+  balance       bigint,
+  PRIMARY KEY (bot_id, address)
+);
+
+COMMENT ON TABLE bot.bbd_address IS 'Polling plan: watched addresses without duplicates (maintained by bot.bbd_plan).';
+
+COMMENT ON COLUMN bot.bbd_address.bot_id IS 'Bot ID';
+COMMENT ON COLUMN bot.bbd_address.address IS 'Bitcoin address';
+COMMENT ON COLUMN bot.bbd_address.period IS 'Polling interval: the shortest interval of the subscribers';
+COMMENT ON COLUMN bot.bbd_address.subscribers IS 'Number of subscribers';
+COMMENT ON COLUMN bot.bbd_address.polled IS 'Last polled';
+COMMENT ON COLUMN bot.bbd_address.next IS 'Next poll';
+COMMENT ON COLUMN bot.bbd_address.n_tx IS 'Number of transactions (null - not polled yet)';
+COMMENT ON COLUMN bot.bbd_address.received IS 'Total received (satoshi)';
+COMMENT ON COLUMN bot.bbd_address.sent IS 'Total sent (satoshi)';
+COMMENT ON COLUMN bot.bbd_address.balance IS 'Final balance (satoshi)';
+
+CREATE INDEX ON bot.bbd_address (bot_id, next);
+CREATE INDEX ON bot.bbd_address (bot_id, polled);
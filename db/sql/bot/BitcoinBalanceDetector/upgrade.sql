@@ -0,0 +1,10 @@
+--------------------------------------------------------------------------------
+-- bot.bbd_address: balances ---------------------------------------------------
+--------------------------------------------------------------------------------
+
+ALTER TABLE bot.bbd_address ADD COLUMN IF NOT EXISTS n_tx bigint;
+ALTER TABLE bot.bbd_address ADD COLUMN IF NOT EXISTS received bigint;
+ALTER TABLE bot.bbd_address ADD COLUMN IF NOT EXISTS sent bigint;
+ALTER TABLE bot.bbd_address ADD COLUMN IF NOT EXISTS balance bigint;
+
+CREATE INDEX IF NOT EXISTS bbd_address_bot_id_polled_idx ON bot.bbd_address (bot_id, polled);
@@ -0,0 +1,247 @@
+--------------------------------------------------------------------------------
+-- FUNCTION bot.fetch_cached ---------------------------------------------------
+--------------------------------------------------------------------------------
+-- http.fetch with a response cache: a fresh response is passed to the done callback at once,
+-- identical requests in flight are collapsed into one, a stale response is revalidated with
+-- If-None-Match/If-Modified-Since. The callbacks receive the ID of the request that holds the response.
+-- Waiting callers are collapsed by callback: the request carries the profile of the caller that sent it,
+-- so a callback must not depend on the profile (pass what it needs in the resource or look it up).
+
+CREATE OR REPLACE FUNCTION bot.fetch_cached (
+  pResource     text,
+  pMethod       text DEFAULT 'GET',
+  pHeaders      jsonb DEFAULT null,
+  pContent      text DEFAULT null,
+  pDone         text DEFAULT null,
+  pFail         text DEFAULT null,
+  pAgent        text DEFAULT null,
+  pProfile      text DEFAULT null,
+  pCommand      text DEFAULT null,
+  pTtl          interval DEFAULT null
+) RETURNS       uuid
+AS $$
+DECLARE
+  cFlight       CONSTANT interval DEFAULT '1 min';   -- a request in flight for longer is considered lost
+
+  c             record;
+
+  uRequest      uuid;
+  vKey          text;
+  vHeaders      jsonb;
+BEGIN
+  pMethod := coalesce(pMethod, 'GET');
+  pTtl := coalesce(pTtl, (SELECT p.ttl FROM bot.fetch_policy p WHERE p.agent = pAgent AND p.command = pCommand), interval '0');
+
+  vKey := encode(digest(concat_ws(E'\n', pMethod, pResource, pContent), 'sha256'), 'hex');
+
+  INSERT INTO bot.fetch_cache (key, agent, command, method, resource, ttl)
+  VALUES (vKey, pAgent, pCommand, pMethod, pResource, pTtl)
+  ON CONFLICT (key) DO UPDATE SET ttl = EXCLUDED.ttl;
+
+  -- Concurrent callers of the same key are serialized here
+  SELECT * INTO c FROM bot.fetch_cache WHERE key = vKey FOR UPDATE;
+
+  IF c.request IS NOT NULL AND c.expires > Now() THEN
+    PERFORM FROM http.fetch WHERE id = c.request;
+
+    IF FOUND THEN
+      UPDATE bot.fetch_cache SET hits = hits + 1 WHERE key = vKey;
+
+      IF pDone IS NOT NULL THEN
+        EXECUTE format('SELECT %s($1);', pDone) USING c.request;
+      END IF;
+
+      RETURN c.request;
+    END IF;
+  END IF;
+
+  INSERT INTO bot.fetch_wait (key, done, fail) VALUES (vKey, pDone, pFail);
+
+  IF c.pending IS NOT NULL AND c.requested > Now() - cFlight THEN
+    UPDATE bot.fetch_cache SET hits = hits + 1 WHERE key = vKey;
+    RETURN c.pending;
+  END IF;
+
+  vHeaders := pHeaders;
+
+  IF c.request IS NOT NULL AND coalesce(c.etag, c.modified) IS NOT NULL THEN
+    vHeaders := coalesce(vHeaders, '{}'::jsonb) || jsonb_strip_nulls(jsonb_build_object('If-None-Match', c.etag, 'If-Modified-Since', c.modified));
+  END IF;
+
+  uRequest := http.fetch(pResource, pMethod, vHeaders, pContent, 'bot.fetch_cache_done', 'bot.fetch_cache_fail', pAgent, pProfile, pCommand);
+
+  UPDATE bot.fetch_cache SET pending = uRequest, requested = Now() WHERE key = vKey;
+
+  RETURN uRequest;
+END;
+$$ LANGUAGE plpgsql
+  SECURITY DEFINER
+  SET search_path = bot, public, pg_temp;
+
+--------------------------------------------------------------------------------
+-- FUNCTION bot.fetch_cache_notify ---------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.fetch_cache_notify (
+  pKey          text,
+  pRequest      uuid,
+  pDone         bool
+) RETURNS       integer
+AS $$
+DECLARE
+  r             record;
+
+  nCount        integer DEFAULT 0;
+
+  vMessage      text;
+  vContext      text;
+BEGIN
+  -- Each callback is called once however many callers were waiting with it
+  FOR r IN
+    WITH waiting AS (
+      DELETE FROM bot.fetch_wait WHERE key = pKey RETURNING id, CASE WHEN pDone THEN done ELSE fail END AS callback
+    )
+    SELECT callback FROM waiting WHERE callback IS NOT NULL GROUP BY callback ORDER BY min(id)
+  LOOP
+    BEGIN
+      EXECUTE format('SELECT %s($1);', r.callback) USING pRequest;
+      nCount := nCount + 1;
+    EXCEPTION
+    WHEN others THEN
+      GET STACKED DIAGNOSTICS vMessage = MESSAGE_TEXT, vContext = PG_EXCEPTION_CONTEXT;
+      PERFORM WriteDiagnostics(vMessage, vContext);
+    END;
+  END LOOP;
+
+  RETURN nCount;
+END;
+$$ LANGUAGE plpgsql
+  SECURITY DEFINER
+  SET search_path = bot, public, pg_temp;
+
+--------------------------------------------------------------------------------
+-- FUNCTION bot.fetch_cache_done -----------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.fetch_cache_done (
+  pRequest      uuid
+) RETURNS       void
+AS $$
+DECLARE
+  c             record;
+
+  nStatus       integer;
+  uResponse     uuid;
+  vHeaders      jsonb;
+BEGIN
+  SELECT * INTO c FROM bot.fetch_cache WHERE pending = pRequest FOR UPDATE;
+
+  IF NOT FOUND THEN
+    RETURN;
+  END IF;
+
+  SELECT status INTO nStatus FROM http.fetch WHERE id = pRequest;
+
+  uResponse := pRequest;
+
+  -- The cached response may have been removed from http.fetch meanwhile
+  IF nStatus = 304 AND c.request IS NOT NULL THEN
+    PERFORM FROM http.fetch WHERE id = c.request;
+
+    IF NOT FOUND THEN
+      c.request := null;
+    END IF;
+  END IF;
+
+  IF nStatus = 304 AND c.request IS NOT NULL THEN
+
+    -- Not modified: the cached response is fresh again
+    UPDATE bot.fetch_cache
+       SET pending = null,
+           fetched = Now(),
+           expires = Now() + c.ttl
+     WHERE key = c.key;
+
+    uResponse := c.request;
+
+  ELSIF nStatus BETWEEN 200 AND 299 THEN
+
+    SELECT jsonb_object_agg(lower(h.key), h.value) INTO vHeaders
+      FROM http.response p, jsonb_each_text(p.headers) h
+     WHERE p.request = pRequest;
+
+    UPDATE bot.fetch_cache
+       SET request = pRequest,
+           pending = null,
+           etag = vHeaders->>'etag',
+           modified = vHeaders->>'last-modified',
+           fetched = Now(),
+           expires = Now() + c.ttl
+     WHERE key = c.key;
+
+  ELSE
+
+    -- Errors are not cached: the waiting callers handle them. A 304 without the cached response
+    -- drops the validators, the next request is unconditional.
+    UPDATE bot.fetch_cache
+       SET pending = null,
+           request = CASE WHEN nStatus = 304 THEN null ELSE request END,
+           etag = CASE WHEN nStatus = 304 THEN null ELSE etag END,
+           modified = CASE WHEN nStatus = 304 THEN null ELSE modified END
+     WHERE key = c.key;
+
+  END IF;
+
+  PERFORM bot.fetch_cache_notify(c.key, uResponse, true);
+END;
+$$ LANGUAGE plpgsql
+  SECURITY DEFINER
+  SET search_path = bot, public, pg_temp;
+
+--------------------------------------------------------------------------------
+-- FUNCTION bot.fetch_cache_fail -----------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.fetch_cache_fail (
+  pRequest      uuid
+) RETURNS       void
+AS $$
+DECLARE
+  vKey          text;
+BEGIN
+  SELECT key INTO vKey FROM bot.fetch_cache WHERE pending = pRequest FOR UPDATE;
+
+  IF NOT FOUND THEN
+    RETURN;
+  END IF;
+
+  UPDATE bot.fetch_cache SET pending = null WHERE key = vKey;
+
+  PERFORM bot.fetch_cache_notify(vKey, pRequest, false);
+END;
+$$ LANGUAGE plpgsql
+  SECURITY DEFINER
+  SET search_path = bot, public, pg_temp;
+
+--------------------------------------------------------------------------------
+-- FUNCTION bot.fetch_cache_clean ----------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.fetch_cache_clean (
+  pExpired      interval DEFAULT '1 day'
+) RETURNS       integer
+AS $$
+DECLARE
+  nCount        integer;
+BEGIN
+  -- Requests whose callback never came: a later caller of the key would notify the waiters, there may be none
+  DELETE FROM bot.fetch_wait WHERE created < Now() - pExpired;
+  UPDATE bot.fetch_cache SET pending = null WHERE pending IS NOT NULL AND requested < Now() - pExpired;
+
+  DELETE FROM bot.fetch_cache WHERE expires < Now() - pExpired AND pending IS NULL;
+  GET DIAGNOSTICS nCount = ROW_COUNT;
+  RETURN nCount;
+END;
+$$ LANGUAGE plpgsql
+   SECURITY DEFINER
+   SET search_path = bot, pg_temp;
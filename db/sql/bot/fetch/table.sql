@@ -0,0 +1,82 @@
+--------------------------------------------------------------------------------
+-- bot.fetch_policy ------------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE TABLE bot.fetch_policy (
+  agent         text NOT NULL,
+  command       text NOT NULL,
+  ttl           interval NOT NULL,
+  PRIMARY KEY (agent, command)
+);
+
+COMMENT ON TABLE bot.fetch_policy IS 'Response cache lifetime of the upstream requests by agent and command.';
+
+COMMENT ON COLUMN bot.fetch_policy.agent IS 'Agent (http.fetch)';
+COMMENT ON COLUMN bot.fetch_policy.command IS 'Command (http.fetch)';
+COMMENT ON COLUMN bot.fetch_policy.ttl IS 'Time to live of the response (0 - identical requests in flight are collapsed only)';
+
+INSERT INTO bot.fetch_policy (agent, command, ttl) VALUES ('blockchain', 'multiaddr', '30 sec') ON CONFLICT DO NOTHING;
+
+--------------------------------------------------------------------------------
+-- bot.fetch_cache -------------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE TABLE bot.fetch_cache (
+  key           text PRIMARY KEY,
+  agent         text,
+  command       text,
+  method        text NOT NULL,
+  resource      text NOT NULL,
+  ttl           interval NOT NULL DEFAULT '0',
+  request       uuid,
+  pending       uuid,
+  requested     timestamptz,
+  etag          text,
+  modified      text,
+  fetched       timestamptz,
+  expires       timestamptz NOT NULL DEFAULT Now(),
+  hits          bigint NOT NULL DEFAULT 0
+);
+
+COMMENT ON TABLE bot.fetch_cache IS 'Upstream responses by method, resource and content hash.';
+
+COMMENT ON COLUMN bot.fetch_cache.key IS 'SHA-256 of the method, resource and content';
+COMMENT ON COLUMN bot.fetch_cache.agent IS 'Agent';
+COMMENT ON COLUMN bot.fetch_cache.command IS 'Command';
+COMMENT ON COLUMN bot.fetch_cache.method IS 'HTTP method';
+COMMENT ON COLUMN bot.fetch_cache.resource IS 'URL';
+COMMENT ON COLUMN bot.fetch_cache.ttl IS 'Time to live of the response';
+COMMENT ON COLUMN bot.fetch_cache.request IS 'HTTP request ID of the cached response (http.fetch)';
+COMMENT ON COLUMN bot.fetch_cache.pending IS 'HTTP request ID in flight';
+COMMENT ON COLUMN bot.fetch_cache.requested IS 'Date and time the request in flight was sent';
+COMMENT ON COLUMN bot.fetch_cache.etag IS 'ETag of the cached response';
+COMMENT ON COLUMN bot.fetch_cache.modified IS 'Last-Modified of the cached response';
+COMMENT ON COLUMN bot.fetch_cache.fetched IS 'Date and time the response was fetched or revalidated';
+COMMENT ON COLUMN bot.fetch_cache.expires IS 'The response is fresh until';
+COMMENT ON COLUMN bot.fetch_cache.hits IS 'Number of requests served without upstream';
+
+CREATE INDEX ON bot.fetch_cache (pending);
+CREATE INDEX ON bot.fetch_cache (expires);
+
+--------------------------------------------------------------------------------
+-- bot.fetch_wait --------------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE TABLE bot.fetch_wait (
+  id            bigserial PRIMARY KEY,
+  key           text NOT NULL REFERENCES bot.fetch_cache ON DELETE CASCADE,
+  done          text,
+  fail          text,
+  created       timestamptz NOT NULL DEFAULT Now()
+);
+
+COMMENT ON TABLE bot.fetch_wait IS 'Callers waiting for the request in flight (single-flight), each callback is called once.';
+
+COMMENT ON COLUMN bot.fetch_wait.id IS 'Identifier';
+COMMENT ON COLUMN bot.fetch_wait.key IS 'Cache key';
+COMMENT ON COLUMN bot.fetch_wait.done IS 'Done callback';
+COMMENT ON COLUMN bot.fetch_wait.fail IS 'Fail callback';
+COMMENT ON COLUMN bot.fetch_wait.created IS 'Date and time of creation';
+
+CREATE INDEX ON bot.fetch_wait (key, id);
+CREATE INDEX ON bot.fetch_wait (created);
@@ -0,0 +1,5 @@
+--------------------------------------------------------------------------------
+-- bot.fetch_wait: cleanup -----------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE INDEX IF NOT EXISTS fetch_wait_created_idx ON bot.fetch_wait (created);
@@ -2,6 +2,8 @@
 -- bot.new_file ----------------------------------------------------------------
 --------------------------------------------------------------------------------
 
+DROP FUNCTION IF EXISTS bot.new_file(text, uuid, bigint, bigint, text, text, integer, timestamptz, bytea, text, text, text, text);
+
 CREATE OR REPLACE FUNCTION bot.new_file (
   pFileId       text,
   pBotId        uuid,
@@ -9,7 +11,7 @@ CREATE OR REPLACE FUNCTION bot.new_file (
   pUserId       bigint,
   pName		    text,
   pPath		    text,
-  pSize		    integer,
+  pSize		    bigint,
   pDate		    timestamptz,
   pData		    bytea DEFAULT null,
   pHash		    text DEFAULT null,
@@ -30,11 +32,13 @@ $$ LANGUAGE plpgsql
 -- bot.update_file -------------------------------------------------------------
 --------------------------------------------------------------------------------
 
+DROP FUNCTION IF EXISTS bot.update_file(text, text, text, integer, timestamptz, bytea, text, text, text, text, timestamptz);
+
 CREATE OR REPLACE FUNCTION bot.update_file (
   pFileId       text,
   pName		    text DEFAULT null,
   pPath		    text DEFAULT null,
-  pSize		    integer DEFAULT null,
+  pSize		    bigint DEFAULT null,
   pDate		    timestamptz DEFAULT null,
   pData		    bytea DEFAULT null,
   pHash		    text DEFAULT null,
@@ -66,6 +70,8 @@ $$ LANGUAGE plpgsql
 -- bot.set_file ----------------------------------------------------------------
 --------------------------------------------------------------------------------
 
+DROP FUNCTION IF EXISTS bot.set_file(text, uuid, bigint, bigint, text, text, integer, timestamptz, bytea, text, text, text, text, timestamptz);
+
 CREATE OR REPLACE FUNCTION bot.set_file (
   pFileId       text,
   pBotId        uuid DEFAULT null,
@@ -73,7 +79,7 @@ CREATE OR REPLACE FUNCTION bot.set_file (
   pUserId       bigint DEFAULT null,
   pName		    text DEFAULT null,
   pPath		    text DEFAULT null,
-  pSize		    integer DEFAULT null,
+  pSize		    bigint DEFAULT null,
   pDate		    timestamptz DEFAULT null,
   pData		    bytea DEFAULT null,
   pHash		    text DEFAULT null,
@@ -81,7 +87,7 @@ CREATE OR REPLACE FUNCTION bot.set_file (
   pType		    text DEFAULT null,
   pLink		    text DEFAULT null,
   pLoad		    timestamptz DEFAULT null
-) RETURNS       int
+) RETURNS       bigint
 AS $$
 BEGIN
   IF coalesce(pSize, 0) >= 0 THEN
@@ -137,3 +143,597 @@ END;
 $$ LANGUAGE plpgsql
    SECURITY DEFINER
    SET search_path = bot, pg_temp;
+
+--------------------------------------------------------------------------------
+-- bot.download_add ------------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.download_add (
+  pBotId        uuid,
+  pFileId       text,
+  pFilePath     text,
+  pCallback     text DEFAULT null
+) RETURNS       bigint
+AS $$
+DECLARE
+  nId           bigint;
+BEGIN
+  INSERT INTO bot.download (bot_id, file_id, url, callback)
+  SELECT id, pFileId, format('%s/file/bot%s/%s', api_url, token, pFilePath), pCallback
+    FROM bot.list
+   WHERE id = pBotId
+  RETURNING id INTO nId;
+
+  IF nId IS NOT NULL THEN
+    PERFORM pg_notify('tg_download', nId::text);
+  END IF;
+
+  RETURN nId;
+END;
+$$ LANGUAGE plpgsql
+   SECURITY DEFINER
+   SET search_path = bot, pg_temp;
+
+--------------------------------------------------------------------------------
+-- bot.download_fetch ----------------------------------------------------------
+--------------------------------------------------------------------------------
+
+DROP FUNCTION IF EXISTS bot.download_fetch(integer);
+
+CREATE OR REPLACE FUNCTION bot.download_fetch (
+  pLimit        integer DEFAULT 100
+) RETURNS       TABLE (
+  id            bigint,
+  url           text
+)
+AS $$
+BEGIN
+  RETURN QUERY
+    UPDATE bot.download d
+       SET state = 1, updated = Now()
+     WHERE d.id IN (
+       SELECT t.id
+         FROM bot.download t
+        WHERE t.state = 0
+        ORDER BY t.id
+        LIMIT pLimit
+          FOR UPDATE SKIP LOCKED
+     )
+    RETURNING d.id, d.url;
+END;
+$$ LANGUAGE plpgsql
+   SECURITY DEFINER
+   SET search_path = bot, pg_temp;
+
+--------------------------------------------------------------------------------
+-- bot.download_reset ----------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.download_reset (
+) RETURNS       integer
+AS $$
+DECLARE
+  nCount        integer;
+BEGIN
+  UPDATE bot.download SET state = 0, updated = Now() WHERE state = 1;
+  GET DIAGNOSTICS nCount = ROW_COUNT;
+  RETURN nCount;
+END;
+$$ LANGUAGE plpgsql
+   SECURITY DEFINER
+   SET search_path = bot, pg_temp;
+
+--------------------------------------------------------------------------------
+-- bot.download_done -----------------------------------------------------------
+--------------------------------------------------------------------------------
+
+DROP FUNCTION IF EXISTS bot.download_done(bigint, text, bigint, text, text, text);
+
+CREATE OR REPLACE FUNCTION bot.download_done (
+  pId           bigint,
+  pPath         text,
+  pSize         bigint,
+  pHash         text,
+  pError        text DEFAULT null
+) RETURNS       void
+AS $$
+DECLARE
+  r             record;
+
+  vMessage      text;
+  vContext      text;
+BEGIN
+  SELECT id, file_id, callback, attempts INTO r FROM bot.download WHERE id = pId AND state = 1;
+
+  IF NOT FOUND THEN
+    RETURN;
+  END IF;
+
+  IF pPath IS NOT NULL THEN
+
+    UPDATE bot.download SET state = 2, error = null, updated = Now() WHERE id = r.id;
+
+    PERFORM bot.update_file(r.file_id, ppath => pPath, psize => pSize, phash => pHash, pload => Now());
+
+    IF r.callback IS NOT NULL THEN
+      EXECUTE format('SELECT %s($1);', r.callback) USING r.file_id;
+    END IF;
+
+  ELSIF r.attempts < 2 THEN
+
+    UPDATE bot.download SET state = 0, attempts = attempts + 1, error = pError, updated = Now() WHERE id = r.id;
+    PERFORM pg_notify('tg_download', r.id::text);
+
+  ELSE
+
+    UPDATE bot.download SET state = 3, attempts = attempts + 1, error = pError, updated = Now() WHERE id = r.id;
+    PERFORM WriteToEventLog('E', -1, coalesce(pError, 'Download failed.'), 'download');
+
+  END IF;
+EXCEPTION
+WHEN others THEN
+  GET STACKED DIAGNOSTICS vMessage = MESSAGE_TEXT, vContext = PG_EXCEPTION_CONTEXT;
+  PERFORM WriteDiagnostics(vMessage, vContext);
+END
+$$ LANGUAGE plpgsql
+   SECURITY DEFINER
+   SET search_path = bot, public, pg_temp;
+
+--------------------------------------------------------------------------------
+-- bot.upload_add --------------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.upload_add (
+  pBotId        uuid,
+  pChatId       bigint,
+  pFileName     text,
+  pContentType  text DEFAULT null,
+  pPath         text DEFAULT null,
+  pQuery        text DEFAULT null,
+  pCaption      text DEFAULT null,
+  pCallback     text DEFAULT null
+) RETURNS       bigint
+AS $$
+DECLARE
+  nId           bigint;
+BEGIN
+  INSERT INTO bot.upload (bot_id, chat_id, file_name, content_type, path, query, hash, caption, callback)
+  VALUES (pBotId, pChatId, pFileName, coalesce(pContentType, 'application/octet-stream'), pPath, pQuery, substring(pPath FROM '/[0-9a-f]{2}/[0-9a-f]{2}/([0-9a-f]{64})$'), pCaption, pCallback)
+  RETURNING id INTO nId;
+
+  PERFORM pg_notify('tg_upload', nId::text);
+
+  RETURN nId;
+END;
+$$ LANGUAGE plpgsql
+   SECURITY DEFINER
+   SET search_path = bot, pg_temp;
+
+--------------------------------------------------------------------------------
+-- bot.send_document_file ------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.send_document_file (
+  pBotId        uuid,
+  pChatId       bigint,
+  pPath         text,
+  pFileName     text,
+  pContentType  text DEFAULT null,
+  pCaption      text DEFAULT null,
+  pCallback     text DEFAULT null
+) RETURNS       bigint
+AS $$
+BEGIN
+  RETURN bot.upload_add(pBotId, pChatId, pFileName, pContentType, pPath => pPath, pCaption => pCaption, pCallback => pCallback);
+END;
+$$ LANGUAGE plpgsql
+   SECURITY DEFINER
+   SET search_path = bot, pg_temp;
+
+--------------------------------------------------------------------------------
+-- bot.send_document_query -----------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.send_document_query (
+  pBotId        uuid,
+  pChatId       bigint,
+  pQuery        text,
+  pFileName     text,
+  pContentType  text DEFAULT 'text/csv',
+  pCaption      text DEFAULT null,
+  pCallback     text DEFAULT null
+) RETURNS       bigint
+AS $$
+BEGIN
+  RETURN bot.upload_add(pBotId, pChatId, pFileName, pContentType, pQuery => pQuery, pCaption => pCaption, pCallback => pCallback);
+END;
+$$ LANGUAGE plpgsql
+   SECURITY DEFINER
+   SET search_path = bot, pg_temp;
+
+--------------------------------------------------------------------------------
+-- bot.upload_fetch ------------------------------------------------------------
+--------------------------------------------------------------------------------
+
+DROP FUNCTION IF EXISTS bot.upload_fetch(integer);
+
+CREATE OR REPLACE FUNCTION bot.upload_fetch (
+  pLimit        integer DEFAULT 100
+) RETURNS       TABLE (
+  id            bigint,
+  url           text,
+  chat_id       bigint,
+  file_name     text,
+  content_type  text,
+  caption       text,
+  path          text,
+  query         text,
+  bot_id        uuid,
+  hash          text,
+  file_id       text
+)
+AS $$
+BEGIN
+  RETURN QUERY
+    UPDATE bot.upload u
+       SET state = 1, updated = Now()
+      FROM bot.list l
+     WHERE l.id = u.bot_id
+       AND u.id IN (
+         SELECT t.id
+           FROM bot.upload t
+          WHERE t.state = 0
+          ORDER BY t.id
+          LIMIT pLimit
+            FOR UPDATE SKIP LOCKED
+       )
+    RETURNING u.id, format('%s/bot%s/sendDocument', l.api_url, l.token), u.chat_id, u.file_name, u.content_type, u.caption, u.path, u.query,
+              u.bot_id, u.hash, (SELECT c.file_id FROM bot.upload_cache c WHERE c.bot_id = u.bot_id AND c.hash = u.hash);
+END;
+$$ LANGUAGE plpgsql
+   SECURITY DEFINER
+   SET search_path = bot, pg_temp;
+
+--------------------------------------------------------------------------------
+-- bot.upload_reset ------------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.upload_reset (
+) RETURNS       integer
+AS $$
+DECLARE
+  nCount        integer;
+BEGIN
+  UPDATE bot.upload SET state = 0, updated = Now() WHERE state = 1;
+  GET DIAGNOSTICS nCount = ROW_COUNT;
+  RETURN nCount;
+END;
+$$ LANGUAGE plpgsql
+   SECURITY DEFINER
+   SET search_path = bot, pg_temp;
+
+--------------------------------------------------------------------------------
+-- bot.upload_done -------------------------------------------------------------
+--------------------------------------------------------------------------------
+
+DROP FUNCTION IF EXISTS bot.upload_done(bigint, integer, text, text, text, text);
+
+CREATE OR REPLACE FUNCTION bot.upload_done (
+  pId           bigint,
+  pStatus       integer,
+  pResponse     text,
+  pError        text DEFAULT null,
+  pPath         text DEFAULT null,
+  pHash         text DEFAULT null,
+  pFileId       text DEFAULT null
+) RETURNS       void
+AS $$
+DECLARE
+  r             record;
+  reply         jsonb;
+  fileId        text;
+
+  vMessage      text;
+  vContext      text;
+BEGIN
+  SELECT id, bot_id, hash, callback, attempts INTO r FROM bot.upload WHERE id = pId AND state = 1;
+
+  IF NOT FOUND THEN
+    RETURN;
+  END IF;
+
+  -- A truncated or non-JSON body (proxy error page) is a failed request, not an error of the function:
+  -- otherwise the upload would stay in progress
+  IF pResponse IS NOT NULL AND pResponse LIKE '{%' THEN
+    BEGIN
+      reply := pResponse::jsonb;
+    EXCEPTION
+    WHEN invalid_text_representation THEN
+      reply := null;
+      pError := coalesce(pError, 'Invalid response: ' || left(pResponse, 200));
+    END;
+  END IF;
+
+  IF pStatus = 200 AND coalesce((reply->>'ok')::bool, false) THEN
+
+    fileId := coalesce(pFileId, reply#>>'{result,document,file_id}');
+
+    UPDATE bot.upload
+       SET state = 2,
+           path = coalesce(pPath, path),
+           hash = coalesce(pHash, hash),
+           file_id = fileId,
+           response = reply,
+           error = null,
+           updated = Now()
+     WHERE id = r.id;
+
+    IF coalesce(pHash, r.hash) IS NOT NULL AND fileId IS NOT NULL THEN
+      INSERT INTO bot.upload_cache (bot_id, hash, file_id)
+      VALUES (r.bot_id, coalesce(pHash, r.hash), fileId)
+      ON CONFLICT (bot_id, hash) DO UPDATE SET file_id = EXCLUDED.file_id, used = Now();
+    END IF;
+
+    IF r.callback IS NOT NULL THEN
+      EXECUTE format('SELECT %s($1);', r.callback) USING r.id;
+    END IF;
+
+  ELSIF pFileId IS NOT NULL AND pStatus = 400 THEN
+
+    -- The cached file_id is no longer accepted: forget it and upload the content
+    DELETE FROM bot.upload_cache WHERE bot_id = r.bot_id AND file_id = pFileId;
+
+    UPDATE bot.upload
+       SET state = 0,
+           path = coalesce(pPath, path),
+           hash = coalesce(pHash, hash),
+           error = reply->>'description',
+           updated = Now()
+     WHERE id = r.id;
+
+    PERFORM pg_notify('tg_upload', r.id::text);
+
+  ELSIF r.attempts < 2 AND (pStatus = 0 OR pStatus = 429 OR pStatus >= 500) THEN
+
+    UPDATE bot.upload
+       SET state = 0,
+           path = coalesce(pPath, path),
+           hash = coalesce(pHash, hash),
+           attempts = attempts + 1,
+           error = coalesce(pError, reply->>'description'),
+           updated = Now()
+     WHERE id = r.id;
+
+    PERFORM pg_notify('tg_upload', r.id::text);
+
+  ELSE
+
+    UPDATE bot.upload
+       SET state = 3,
+           attempts = attempts + 1,
+           response = reply,
+           error = coalesce(pError, reply->>'description'),
+           updated = Now()
+     WHERE id = r.id;
+
+    PERFORM WriteToEventLog('E', pStatus, coalesce(pError, reply->>'description', 'Upload failed.'), 'upload');
+
+  END IF;
+EXCEPTION
+WHEN others THEN
+  GET STACKED DIAGNOSTICS vMessage = MESSAGE_TEXT, vContext = PG_EXCEPTION_CONTEXT;
+  PERFORM WriteDiagnostics(vMessage, vContext);
+END
+$$ LANGUAGE plpgsql
+   SECURITY DEFINER
+   SET search_path = bot, public, pg_temp;
+
+--------------------------------------------------------------------------------
+-- bot.upload_cache_load -------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.upload_cache_load (
+  pLimit        integer DEFAULT 10000
+) RETURNS       TABLE (
+  bot_id        uuid,
+  hash          text,
+  file_id       text
+)
+AS $$
+  SELECT c.bot_id, c.hash, c.file_id
+    FROM bot.upload_cache c
+   ORDER BY c.used DESC
+   LIMIT pLimit;
+$$ LANGUAGE sql STABLE
+   SECURITY DEFINER
+   SET search_path = bot, pg_temp;
+
+--------------------------------------------------------------------------------
+-- bot.upload_cache_clean ------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.upload_cache_clean (
+  pUnused       interval DEFAULT '90 days'
+) RETURNS       integer
+AS $$
+DECLARE
+  nCount        integer;
+BEGIN
+  DELETE FROM bot.upload_cache WHERE used < Now() - pUnused;
+  GET DIAGNOSTICS nCount = ROW_COUNT;
+  RETURN nCount;
+END;
+$$ LANGUAGE plpgsql
+   SECURITY DEFINER
+   SET search_path = bot, pg_temp;
+
+--------------------------------------------------------------------------------
+-- bot.import_add --------------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.import_add (
+  pBotId        uuid,
+  pChatId       bigint,
+  pUserId       bigint,
+  pPath         text,
+  pCategory     text,
+  pValue        text,
+  pFileId       text DEFAULT null,
+  pCallback     text DEFAULT null
+) RETURNS       bigint
+AS $$
+DECLARE
+  nId           bigint;
+BEGIN
+  INSERT INTO bot.import (bot_id, chat_id, user_id, file_id, path, category, value, callback)
+  VALUES (pBotId, pChatId, pUserId, pFileId, pPath, pCategory, pValue, pCallback)
+  RETURNING id INTO nId;
+
+  PERFORM pg_notify('tg_import', nId::text);
+
+  RETURN nId;
+END;
+$$ LANGUAGE plpgsql
+   SECURITY DEFINER
+   SET search_path = bot, pg_temp;
+
+--------------------------------------------------------------------------------
+-- bot.import_fetch ------------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.import_fetch (
+  pLimit        integer DEFAULT 10
+) RETURNS       TABLE (
+  id            bigint,
+  path          text,
+  encoding      text
+)
+AS $$
+BEGIN
+  RETURN QUERY
+    UPDATE bot.import i
+       SET state = 1, updated = Now()
+     WHERE i.id IN (
+         SELECT t.id
+           FROM bot.import t
+          WHERE t.state = 0
+          ORDER BY t.id
+          LIMIT pLimit
+            FOR UPDATE SKIP LOCKED
+       )
+    RETURNING i.id, i.path,
+              (SELECT d.value FROM bot.data d WHERE d.bot_id = i.bot_id AND d.chat_id = i.chat_id AND d.user_id = i.user_id AND d.category = 'settings' AND d.key = 'encoding');
+END;
+$$ LANGUAGE plpgsql
+   SECURITY DEFINER
+   SET search_path = bot, pg_temp;
+
+--------------------------------------------------------------------------------
+-- bot.import_reset ------------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.import_reset (
+) RETURNS       integer
+AS $$
+DECLARE
+  nCount        integer;
+BEGIN
+  DELETE FROM bot.import_data d USING bot.import i WHERE d.import_id = i.id AND i.state = 1;
+
+  UPDATE bot.import SET state = 0, updated = Now() WHERE state = 1;
+  GET DIAGNOSTICS nCount = ROW_COUNT;
+  RETURN nCount;
+END;
+$$ LANGUAGE plpgsql
+   SECURITY DEFINER
+   SET search_path = bot, pg_temp;
+
+--------------------------------------------------------------------------------
+-- bot.import_merge ------------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.import_merge (
+  pId           bigint
+) RETURNS       integer
+AS $$
+DECLARE
+  r             record;
+  nCount        integer;
+  nRejected     integer DEFAULT 0;
+BEGIN
+  SELECT bot_id, chat_id, user_id, category, value INTO r FROM bot.import WHERE id = pId AND state = 1;
+
+  IF NOT FOUND THEN
+    RAISE EXCEPTION 'Import (%) not found.', pId;
+  END IF;
+
+  -- The process checks the charset, the prefix and the length only: the checksums are verified here, as by /add
+  IF r.category = 'address' AND to_regprocedure('bot.isbitcoinaddress(text)') IS NOT NULL THEN
+    DELETE FROM bot.import_data WHERE import_id = pId AND NOT bot.IsBitcoinAddress(key);
+    GET DIAGNOSTICS nRejected = ROW_COUNT;
+
+    UPDATE bot.import SET rejected = nRejected WHERE id = pId;
+  END IF;
+
+  -- The last line of a key wins; the value of the existing keys is kept
+  INSERT INTO bot.data (bot_id, chat_id, user_id, category, key, value, data, updated)
+  SELECT r.bot_id, r.chat_id, r.user_id, r.category, d.key, r.value, d.data, Now()
+    FROM (SELECT DISTINCT ON (t.key) t.key, t.data
+            FROM bot.import_data t
+           WHERE t.import_id = pId
+           ORDER BY t.key, t.line DESC) d
+  ON CONFLICT (bot_id, chat_id, user_id, category, key)
+  DO UPDATE SET data = CASE WHEN EXCLUDED.data IS NULL THEN bot.data.data ELSE coalesce(bot.data.data, '{}') || EXCLUDED.data END,
+                updated = EXCLUDED.updated;
+
+  GET DIAGNOSTICS nCount = ROW_COUNT;
+
+  DELETE FROM bot.import_data WHERE import_id = pId;
+
+  RETURN nCount;
+END;
+$$ LANGUAGE plpgsql
+   SECURITY DEFINER
+   SET search_path = bot, pg_temp;
+
+--------------------------------------------------------------------------------
+-- bot.import_done -------------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.import_done (
+  pId           bigint,
+  pRows         integer,
+  pRejected     integer,
+  pError        text DEFAULT null
+) RETURNS       void
+AS $$
+DECLARE
+  r             record;
+
+  vMessage      text;
+  vContext      text;
+BEGIN
+  SELECT id, callback INTO r FROM bot.import WHERE id = pId AND state = 1;
+
+  IF NOT FOUND THEN
+    RETURN;
+  END IF;
+
+  IF pError IS NULL THEN
+    UPDATE bot.import SET state = 2, rows = pRows, rejected = coalesce(rejected, 0) + pRejected, error = null, updated = Now() WHERE id = r.id;
+  ELSE
+    DELETE FROM bot.import_data WHERE import_id = r.id;
+    UPDATE bot.import SET state = 3, rows = 0, rejected = pRejected, error = pError, updated = Now() WHERE id = r.id;
+  END IF;
+
+  IF r.callback IS NOT NULL THEN
+    EXECUTE format('SELECT %s($1);', r.callback) USING r.id;
+  END IF;
+EXCEPTION
+WHEN others THEN
+  GET STACKED DIAGNOSTICS vMessage = MESSAGE_TEXT, vContext = PG_EXCEPTION_CONTEXT;
+  PERFORM WriteDiagnostics(vMessage, vContext);
+END
+$$ LANGUAGE plpgsql
+   SECURITY DEFINER
+   SET search_path = bot, public, pg_temp;
@@ -9,7 +9,7 @@ CREATE TABLE bot.file (
   user_id       bigint NOT NULL,
   file_name     text NOT NULL,
   file_path     text NOT NULL,
-  file_size     integer DEFAULT 0,
+  file_size     bigint DEFAULT 0,
   file_date     timestamptz,
   file_data     bytea,
   file_hash     text,
@@ -25,11 +25,11 @@ COMMENT ON COLUMN bot.file.bot_id IS 'Bot ID';
 COMMENT ON COLUMN bot.file.chat_id IS 'Char ID';
 COMMENT ON COLUMN bot.file.user_id IS 'User ID';
 COMMENT ON COLUMN bot.file.file_name IS 'Name';
-COMMENT ON COLUMN bot.file.file_path IS 'Path';
+COMMENT ON COLUMN bot.file.file_path IS 'Path (in the file store after download)';
 COMMENT ON COLUMN bot.file.file_size IS 'Size';
 COMMENT ON COLUMN bot.file.file_date IS 'Date';
-COMMENT ON COLUMN bot.file.file_data IS 'Data';
-COMMENT ON COLUMN bot.file.file_hash IS 'Hash';
+COMMENT ON COLUMN bot.file.file_data IS 'Data (deprecated: downloaded files are kept in the file store)';
+COMMENT ON COLUMN bot.file.file_hash IS 'Hash (SHA-256 of the content in the file store)';
 COMMENT ON COLUMN bot.file.file_text IS 'Text';
 COMMENT ON COLUMN bot.file.file_type IS 'MIME type';
 COMMENT ON COLUMN bot.file.file_link IS 'Link';
@@ -58,3 +58,168 @@ CREATE TRIGGER t_bot_file
   FOR EACH ROW
   WHEN (OLD.file_data IS DISTINCT FROM NEW.file_data)
   EXECUTE PROCEDURE bot.ft_file();
+
+--------------------------------------------------------------------------------
+-- bot.download ----------------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE TABLE bot.download (
+  id            bigserial PRIMARY KEY,
+  bot_id        uuid NOT NULL REFERENCES bot.list ON DELETE CASCADE,
+  file_id       text NOT NULL REFERENCES bot.file ON DELETE CASCADE,
+  url           text NOT NULL,
+  callback      text,
+  state         integer NOT NULL DEFAULT 0 CHECK (state BETWEEN 0 AND 3),
+  attempts      integer NOT NULL DEFAULT 0,
+  error         text,
+  created       timestamptz NOT NULL DEFAULT Now(),
+  updated       timestamptz NOT NULL DEFAULT Now()
+);
+
+COMMENT ON TABLE bot.download IS 'Files downloaded by the telegram bot process to the file store.';
+
+COMMENT ON COLUMN bot.download.id IS 'Identifier';
+COMMENT ON COLUMN bot.download.bot_id IS 'Bot ID';
+COMMENT ON COLUMN bot.download.file_id IS 'File ID';
+COMMENT ON COLUMN bot.download.url IS 'File URL';
+COMMENT ON COLUMN bot.download.callback IS 'Done callback: function (file_id text), the file is in bot.file.file_path';
+COMMENT ON COLUMN bot.download.state IS 'State: 0 - queued, 1 - downloading, 2 - done, 3 - failed';
+COMMENT ON COLUMN bot.download.attempts IS 'Number of attempts';
+COMMENT ON COLUMN bot.download.error IS 'Last error';
+COMMENT ON COLUMN bot.download.created IS 'Date and time of creation';
+COMMENT ON COLUMN bot.download.updated IS 'Last updated';
+
+CREATE INDEX ON bot.download (state, id) WHERE state < 2;
+CREATE INDEX ON bot.download (file_id);
+
+--------------------------------------------------------------------------------
+-- bot.upload ------------------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE TABLE bot.upload (
+  id            bigserial PRIMARY KEY,
+  bot_id        uuid NOT NULL REFERENCES bot.list ON DELETE CASCADE,
+  chat_id       bigint NOT NULL,
+  file_name     text NOT NULL,
+  content_type  text NOT NULL DEFAULT 'application/octet-stream',
+  caption       text,
+  path          text,
+  query         text,
+  hash          text,
+  file_id       text,
+  callback      text,
+  state         integer NOT NULL DEFAULT 0 CHECK (state BETWEEN 0 AND 3),
+  attempts      integer NOT NULL DEFAULT 0,
+  response      jsonb,
+  error         text,
+  created       timestamptz NOT NULL DEFAULT Now(),
+  updated       timestamptz NOT NULL DEFAULT Now(),
+  CHECK (path IS NOT NULL OR query IS NOT NULL)
+);
+
+COMMENT ON TABLE bot.upload IS 'Documents uploaded by the telegram bot process from the file store.';
+
+COMMENT ON COLUMN bot.upload.id IS 'Identifier';
+COMMENT ON COLUMN bot.upload.bot_id IS 'Bot ID';
+COMMENT ON COLUMN bot.upload.chat_id IS 'Chat ID';
+COMMENT ON COLUMN bot.upload.file_name IS 'File name';
+COMMENT ON COLUMN bot.upload.content_type IS 'MIME type';
+COMMENT ON COLUMN bot.upload.caption IS 'Document caption';
+COMMENT ON COLUMN bot.upload.path IS 'File in the file store';
+COMMENT ON COLUMN bot.upload.query IS 'Query returning one text column, rows are written to the file store as lines';
+COMMENT ON COLUMN bot.upload.hash IS 'SHA-256 of the content';
+COMMENT ON COLUMN bot.upload.file_id IS 'Telegram file_id the document was sent by (from bot.upload_cache)';
+COMMENT ON COLUMN bot.upload.callback IS 'Done callback: function (id bigint)';
+COMMENT ON COLUMN bot.upload.state IS 'State: 0 - queued, 1 - uploading, 2 - sent, 3 - failed';
+COMMENT ON COLUMN bot.upload.attempts IS 'Number of attempts';
+COMMENT ON COLUMN bot.upload.response IS 'Bot API response';
+COMMENT ON COLUMN bot.upload.error IS 'Last error';
+COMMENT ON COLUMN bot.upload.created IS 'Date and time of creation';
+COMMENT ON COLUMN bot.upload.updated IS 'Last updated';
+
+CREATE INDEX ON bot.upload (state, id) WHERE state < 2;
+
+--------------------------------------------------------------------------------
+-- bot.upload_cache ------------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE TABLE bot.upload_cache (
+  bot_id        uuid NOT NULL REFERENCES bot.list ON DELETE CASCADE,
+  hash          text NOT NULL,
+  file_id       text NOT NULL,
+  created       timestamptz NOT NULL DEFAULT Now(),
+  used          timestamptz NOT NULL DEFAULT Now(),
+  PRIMARY KEY (bot_id, hash)
+);
+
+COMMENT ON TABLE bot.upload_cache IS 'Telegram file_id of the uploaded documents by content hash.';
+
+COMMENT ON COLUMN bot.upload_cache.bot_id IS 'Bot ID';
+COMMENT ON COLUMN bot.upload_cache.hash IS 'SHA-256 of the content';
+COMMENT ON COLUMN bot.upload_cache.file_id IS 'Telegram file_id (valid for the bot only)';
+COMMENT ON COLUMN bot.upload_cache.created IS 'Date and time of creation';
+COMMENT ON COLUMN bot.upload_cache.used IS 'Last used';
+
+CREATE INDEX ON bot.upload_cache (used);
+
+--------------------------------------------------------------------------------
+-- bot.import ------------------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE TABLE bot.import (
+  id            bigserial PRIMARY KEY,
+  bot_id        uuid NOT NULL REFERENCES bot.list ON DELETE CASCADE,
+  chat_id       bigint NOT NULL,
+  user_id       bigint NOT NULL,
+  file_id       text REFERENCES bot.file ON DELETE SET NULL,
+  path          text NOT NULL,
+  category      text NOT NULL,
+  value         text NOT NULL,
+  callback      text,
+  state         integer NOT NULL DEFAULT 0 CHECK (state BETWEEN 0 AND 3),
+  rows          integer,
+  rejected      integer,
+  error         text,
+  created       timestamptz NOT NULL DEFAULT Now(),
+  updated       timestamptz NOT NULL DEFAULT Now()
+);
+
+COMMENT ON TABLE bot.import IS 'CSV files of the file store imported into bot.data by the telegram bot process.';
+
+COMMENT ON COLUMN bot.import.id IS 'Identifier';
+COMMENT ON COLUMN bot.import.bot_id IS 'Bot ID';
+COMMENT ON COLUMN bot.import.chat_id IS 'Chat ID';
+COMMENT ON COLUMN bot.import.user_id IS 'User ID';
+COMMENT ON COLUMN bot.import.file_id IS 'File ID';
+COMMENT ON COLUMN bot.import.path IS 'File in the file store';
+COMMENT ON COLUMN bot.import.category IS 'Category of bot.data';
+COMMENT ON COLUMN bot.import.value IS 'Value of the new keys';
+COMMENT ON COLUMN bot.import.callback IS 'Done callback: function (id bigint)';
+COMMENT ON COLUMN bot.import.state IS 'State: 0 - queued, 1 - importing, 2 - done, 3 - failed';
+COMMENT ON COLUMN bot.import.rows IS 'Number of merged keys';
+COMMENT ON COLUMN bot.import.rejected IS 'Number of rejected lines';
+COMMENT ON COLUMN bot.import.error IS 'Error';
+COMMENT ON COLUMN bot.import.created IS 'Date and time of creation';
+COMMENT ON COLUMN bot.import.updated IS 'Last updated';
+
+CREATE INDEX ON bot.import (state, id) WHERE state < 2;
+
+--------------------------------------------------------------------------------
+-- bot.import_data -------------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE UNLOGGED TABLE bot.import_data (
+  import_id     bigint NOT NULL,
+  line          integer NOT NULL,
+  key           text NOT NULL,
+  data          jsonb
+);
+
+COMMENT ON TABLE bot.import_data IS 'Staging table of bot.import: filled with COPY, merged into bot.data and emptied.';
+
+COMMENT ON COLUMN bot.import_data.import_id IS 'Import ID';
+COMMENT ON COLUMN bot.import_data.line IS 'Line number in the file';
+COMMENT ON COLUMN bot.import_data.key IS 'Key';
+COMMENT ON COLUMN bot.import_data.data IS 'Data';
+
+CREATE INDEX ON bot.import_data (import_id);
@@ -0,0 +1,113 @@
+--------------------------------------------------------------------------------
+-- bot.file: size --------------------------------------------------------------
+--------------------------------------------------------------------------------
+
+DO $$
+BEGIN
+  IF (SELECT data_type FROM information_schema.columns WHERE table_schema = 'bot' AND table_name = 'file' AND column_name = 'file_size') = 'integer' THEN
+    ALTER TABLE bot.file ALTER COLUMN file_size TYPE bigint;
+  END IF;
+END;
+$$;
+
+--------------------------------------------------------------------------------
+-- bot.download ----------------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE TABLE IF NOT EXISTS bot.download (
+  id            bigserial PRIMARY KEY,
+  bot_id        uuid NOT NULL REFERENCES bot.list ON DELETE CASCADE,
+  file_id       text NOT NULL REFERENCES bot.file ON DELETE CASCADE,
+  url           text NOT NULL,
+  callback      text,
+  state         integer NOT NULL DEFAULT 0 CHECK (state BETWEEN 0 AND 3),
+  attempts      integer NOT NULL DEFAULT 0,
+  error         text,
+  created       timestamptz NOT NULL DEFAULT Now(),
+  updated       timestamptz NOT NULL DEFAULT Now()
+);
+
+CREATE INDEX IF NOT EXISTS download_state_id_idx ON bot.download (state, id) WHERE state < 2;
+CREATE INDEX IF NOT EXISTS download_file_id_idx ON bot.download (file_id);
+
+--------------------------------------------------------------------------------
+-- bot.upload ------------------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE TABLE IF NOT EXISTS bot.upload (
+  id            bigserial PRIMARY KEY,
+  bot_id        uuid NOT NULL REFERENCES bot.list ON DELETE CASCADE,
+  chat_id       bigint NOT NULL,
+  file_name     text NOT NULL,
+  content_type  text NOT NULL DEFAULT 'application/octet-stream',
+  caption       text,
+  path          text,
+  query         text,
+  hash          text,
+  file_id       text,
+  callback      text,
+  state         integer NOT NULL DEFAULT 0 CHECK (state BETWEEN 0 AND 3),
+  attempts      integer NOT NULL DEFAULT 0,
+  response      jsonb,
+  error         text,
+  created       timestamptz NOT NULL DEFAULT Now(),
+  updated       timestamptz NOT NULL DEFAULT Now(),
+  CHECK (path IS NOT NULL OR query IS NOT NULL)
+);
+
+ALTER TABLE bot.upload ADD COLUMN IF NOT EXISTS hash text;
+ALTER TABLE bot.upload ADD COLUMN IF NOT EXISTS file_id text;
+
+CREATE INDEX IF NOT EXISTS upload_state_id_idx ON bot.upload (state, id) WHERE state < 2;
+
+--------------------------------------------------------------------------------
+-- bot.upload_cache ------------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE TABLE IF NOT EXISTS bot.upload_cache (
+  bot_id        uuid NOT NULL REFERENCES bot.list ON DELETE CASCADE,
+  hash          text NOT NULL,
+  file_id       text NOT NULL,
+  created       timestamptz NOT NULL DEFAULT Now(),
+  used          timestamptz NOT NULL DEFAULT Now(),
+  PRIMARY KEY (bot_id, hash)
+);
+
+CREATE INDEX IF NOT EXISTS upload_cache_used_idx ON bot.upload_cache (used);
+
+--------------------------------------------------------------------------------
+-- bot.import ------------------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE TABLE IF NOT EXISTS bot.import (
+  id            bigserial PRIMARY KEY,
+  bot_id        uuid NOT NULL REFERENCES bot.list ON DELETE CASCADE,
+  chat_id       bigint NOT NULL,
+  user_id       bigint NOT NULL,
+  file_id       text REFERENCES bot.file ON DELETE SET NULL,
+  path          text NOT NULL,
+  category      text NOT NULL,
+  value         text NOT NULL,
+  callback      text,
+  state         integer NOT NULL DEFAULT 0 CHECK (state BETWEEN 0 AND 3),
+  rows          integer,
+  rejected      integer,
+  error         text,
+  created       timestamptz NOT NULL DEFAULT Now(),
+  updated       timestamptz NOT NULL DEFAULT Now()
+);
+
+CREATE INDEX IF NOT EXISTS import_state_id_idx ON bot.import (state, id) WHERE state < 2;
+
+--------------------------------------------------------------------------------
+-- bot.import_data -------------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE UNLOGGED TABLE IF NOT EXISTS bot.import_data (
+  import_id     bigint NOT NULL,
+  line          integer NOT NULL,
+  key           text NOT NULL,
+  data          jsonb
+);
+
+CREATE INDEX IF NOT EXISTS import_data_import_id_idx ON bot.import_data (import_id);
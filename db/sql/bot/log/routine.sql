@@ -36,10 +36,10 @@ CREATE OR REPLACE FUNCTION bot.NewEventLog (
   pCategory text DEFAULT null
 ) RETURNS	void
 AS $$
-DECLARE
-  nId		bigint;
 BEGIN
-  nId := AddEventLog(pType, pUsername, pCode, pEvent, pText, pCategory);
+  -- Buffered: bot.log is written by FlushEventLog out of the caller's transaction
+  INSERT INTO bot.log_buffer (type, username, code, event, text, category)
+  VALUES (pType, pUsername, pCode, pEvent, pText, pCategory);
 END;
 $$ LANGUAGE plpgsql
    SECURITY DEFINER
@@ -78,6 +78,117 @@ $$ LANGUAGE plpgsql
    SECURITY DEFINER
    SET search_path = bot, pg_temp;
 
+--------------------------------------------------------------------------------
+-- FlushEventLog ---------------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.FlushEventLog (
+  pLimit	integer DEFAULT 10000
+) RETURNS	integer
+AS $$
+DECLARE
+  nCount	integer;
+BEGIN
+  WITH moved AS (
+    DELETE FROM bot.log_buffer
+     WHERE ctid = ANY (ARRAY(SELECT ctid FROM bot.log_buffer LIMIT pLimit FOR UPDATE SKIP LOCKED))
+    RETURNING type, datetime, timestamp, username, code, event, text, category
+  )
+  INSERT INTO bot.log (type, datetime, timestamp, username, code, event, text, category)
+  SELECT type, datetime, timestamp, username, code, event, text, category
+    FROM moved
+   ORDER BY datetime;
+
+  GET DIAGNOSTICS nCount = ROW_COUNT;
+  RETURN nCount;
+END;
+$$ LANGUAGE plpgsql
+   SECURITY DEFINER
+   SET search_path = bot, pg_temp;
+
+--------------------------------------------------------------------------------
+-- bot.log_partition -----------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.log_partition (
+  pDate		date
+) RETURNS	text
+AS $$
+DECLARE
+  dFrom		date;
+  dTo		date;
+  vName		text;
+BEGIN
+  dFrom := date_trunc('month', pDate)::date;
+  dTo := (dFrom + interval '1 month')::date;
+  vName := format('log_%s', to_char(dFrom, 'YYYYMM'));
+
+  IF to_regclass(format('bot.%I', vName)) IS NOT NULL THEN
+    RETURN vName;
+  END IF;
+
+  -- A row of the month written to bot.log_default after the move would fail the attach: writers wait until
+  -- the partition is attached (the check is repeated, the partition may have been created meanwhile)
+  LOCK TABLE bot.log IN SHARE ROW EXCLUSIVE MODE;
+
+  IF to_regclass(format('bot.%I', vName)) IS NOT NULL THEN
+    RETURN vName;
+  END IF;
+
+  EXECUTE format('CREATE TABLE bot.%I (LIKE bot.log INCLUDING DEFAULTS INCLUDING CONSTRAINTS)', vName);
+
+  -- Rows of the month written while the partition was missing
+  EXECUTE format('WITH moved AS (DELETE FROM bot.log_default WHERE datetime >= %L AND datetime < %L RETURNING *) INSERT INTO bot.%I SELECT * FROM moved', dFrom, dTo, vName);
+
+  EXECUTE format('ALTER TABLE bot.log ATTACH PARTITION bot.%I FOR VALUES FROM (%L) TO (%L)', vName, dFrom, dTo);
+
+  RETURN vName;
+END;
+$$ LANGUAGE plpgsql
+   SECURITY DEFINER
+   SET search_path = bot, pg_temp;
+
+--------------------------------------------------------------------------------
+-- bot.log_maintenance ---------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.log_maintenance (
+  pRetention	interval DEFAULT '3 months',
+  pAhead	integer DEFAULT 1
+) RETURNS	integer
+AS $$
+DECLARE
+  r		record;
+  nCount	integer DEFAULT 0;
+BEGIN
+  FOR i IN 0..greatest(pAhead, 0)
+  LOOP
+    PERFORM bot.log_partition((Now() + make_interval(months => i))::date);
+  END LOOP;
+
+  IF pRetention IS NULL THEN
+    RETURN nCount;
+  END IF;
+
+  FOR r IN
+    SELECT c.relname
+      FROM pg_inherits i INNER JOIN pg_class c ON c.oid = i.inhrelid
+     WHERE i.inhparent = 'bot.log'::regclass
+       AND c.relname ~ '^log_[0-9]{6}$'
+       AND to_date(substr(c.relname, 5), 'YYYYMM') + interval '1 month' <= Now() - pRetention
+  LOOP
+    EXECUTE format('DROP TABLE bot.%I', r.relname);
+    nCount := nCount + 1;
+  END LOOP;
+
+  DELETE FROM bot.log_default WHERE datetime < Now() - pRetention;
+
+  RETURN nCount;
+END;
+$$ LANGUAGE plpgsql
+   SECURITY DEFINER
+   SET search_path = bot, pg_temp;
+
 --------------------------------------------------------------------------------
 -- DeleteEventLog --------------------------------------------------------------
 --------------------------------------------------------------------------------
@@ -131,10 +242,14 @@ BEGIN
 
   SELECT * INTO ErrorCode, ErrorMessage FROM ParseMessage(pMessage);
 
-  PERFORM WriteToEventLog('E', ErrorCode, ErrorMessage);
+  -- The error and its context in one statement
+  INSERT INTO bot.log_buffer (type, username, code, event, text)
+  SELECT t.type, session_user, ErrorCode, 'bot', t.text
+    FROM (VALUES ('E', ErrorMessage), ('D', pContext)) AS t(type, text)
+   WHERE t.text IS NOT NULL;
 
   IF pContext IS NOT NULL THEN
-    PERFORM WriteToEventLog('D', ErrorCode, pContext);
+    RAISE NOTICE '[%] [%] [%] [%] %', 'N', session_user, ErrorCode, 'bot', pContext;
   END IF;
 END;
 $$ LANGUAGE plpgsql
@@ -3,7 +3,7 @@
 --------------------------------------------------------------------------------
 
 CREATE TABLE bot.log (
-    id          bigserial PRIMARY KEY NOT NULL,
+    id          bigserial NOT NULL,
     type        char DEFAULT 'M' NOT NULL CHECK (type IN ('M', 'W', 'E', 'D')),
     datetime	timestamptz DEFAULT clock_timestamp() NOT NULL,
     timestamp	timestamptz DEFAULT Now() NOT NULL,
@@ -11,10 +11,11 @@ CREATE TABLE bot.log (
     code        integer NOT NULL,
     event		text NOT NULL,
     text        text NOT NULL,
-    category    text
-);
+    category    text,
+    PRIMARY KEY (id, datetime)
+) PARTITION BY RANGE (datetime);
 
-COMMENT ON TABLE bot.log IS 'Журнал событий.';
+COMMENT ON TABLE bot.log IS 'Журнал событий (секции по месяцам: bot.log_YYYYMM, см. log_maintenance).';
 
 COMMENT ON COLUMN bot.log.id IS 'Идентификатор';
 COMMENT ON COLUMN bot.log.type IS 'Тип события';
@@ -26,8 +27,35 @@ COMMENT ON COLUMN bot.log.event IS 'Событие';
 COMMENT ON COLUMN bot.log.text IS 'Текст';
 COMMENT ON COLUMN bot.log.category IS 'Категория';
 
-CREATE INDEX ON bot.log (type);
-CREATE INDEX ON bot.log (username);
-CREATE INDEX ON bot.log (code);
-CREATE INDEX ON bot.log (event);
-CREATE INDEX ON bot.log (category);
+CREATE INDEX ON bot.log USING brin (datetime);
+CREATE INDEX ON bot.log (type, datetime);
+
+CREATE TABLE bot.log_default PARTITION OF bot.log DEFAULT;
+
+COMMENT ON TABLE bot.log_default IS 'Журнал событий: записи вне месячных секций.';
+
+--------------------------------------------------------------------------------
+-- bot.log_buffer --------------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE UNLOGGED TABLE bot.log_buffer (
+    type        char DEFAULT 'M' NOT NULL,
+    datetime	timestamptz DEFAULT clock_timestamp() NOT NULL,
+    timestamp	timestamptz DEFAULT Now() NOT NULL,
+    username	text NOT NULL,
+    code        integer NOT NULL,
+    event		text NOT NULL,
+    text        text NOT NULL,
+    category    text
+);
+
+COMMENT ON TABLE bot.log_buffer IS 'Буфер журнала событий: переносится в bot.log пакетами (FlushEventLog).';
+
+COMMENT ON COLUMN bot.log_buffer.type IS 'Тип события';
+COMMENT ON COLUMN bot.log_buffer.datetime IS 'Дата и время события';
+COMMENT ON COLUMN bot.log_buffer.timestamp IS 'Дата и время транзакции';
+COMMENT ON COLUMN bot.log_buffer.username IS 'Имя пользователя';
+COMMENT ON COLUMN bot.log_buffer.code IS 'Код события';
+COMMENT ON COLUMN bot.log_buffer.event IS 'Событие';
+COMMENT ON COLUMN bot.log_buffer.text IS 'Текст';
+COMMENT ON COLUMN bot.log_buffer.category IS 'Категория';
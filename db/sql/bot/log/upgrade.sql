@@ -0,0 +1,63 @@
+--------------------------------------------------------------------------------
+-- bot.log: buffer and partitions ----------------------------------------------
+--------------------------------------------------------------------------------
+
+DO $$
+DECLARE
+  dFrom		date;
+BEGIN
+  CREATE UNLOGGED TABLE IF NOT EXISTS bot.log_buffer (
+    type        char DEFAULT 'M' NOT NULL,
+    datetime	timestamptz DEFAULT clock_timestamp() NOT NULL,
+    timestamp	timestamptz DEFAULT Now() NOT NULL,
+    username	text NOT NULL,
+    code        integer NOT NULL,
+    event		text NOT NULL,
+    text        text NOT NULL,
+    category    text
+  );
+
+  IF (SELECT relkind FROM pg_class WHERE oid = 'bot.log'::regclass) = 'p' THEN
+    RETURN;
+  END IF;
+
+  DROP VIEW IF EXISTS bot.EventLog;
+
+  ALTER TABLE bot.log RENAME TO log_old;
+  ALTER SEQUENCE bot.log_id_seq OWNED BY NONE;
+
+  CREATE TABLE bot.log (
+    id          bigint DEFAULT nextval('bot.log_id_seq') NOT NULL,
+    type        char DEFAULT 'M' NOT NULL CHECK (type IN ('M', 'W', 'E', 'D')),
+    datetime	timestamptz DEFAULT clock_timestamp() NOT NULL,
+    timestamp	timestamptz DEFAULT Now() NOT NULL,
+    username	text NOT NULL,
+    code        integer NOT NULL,
+    event		text NOT NULL,
+    text        text NOT NULL,
+    category    text,
+    PRIMARY KEY (id, datetime)
+  ) PARTITION BY RANGE (datetime);
+
+  ALTER SEQUENCE bot.log_id_seq OWNED BY bot.log.id;
+
+  CREATE INDEX ON bot.log USING brin (datetime);
+  CREATE INDEX ON bot.log (type, datetime);
+
+  CREATE TABLE bot.log_default PARTITION OF bot.log DEFAULT;
+
+  SELECT date_trunc('month', min(datetime))::date INTO dFrom FROM bot.log_old;
+
+  WHILE dFrom <= Now()::date
+  LOOP
+    PERFORM bot.log_partition(dFrom);
+    dFrom := (dFrom + interval '1 month')::date;
+  END LOOP;
+
+  PERFORM bot.log_maintenance(null);
+
+  INSERT INTO bot.log SELECT * FROM bot.log_old;
+
+  DROP TABLE bot.log_old;
+END;
+$$;
@@ -0,0 +1,19 @@
+--------------------------------------------------------------------------------
+-- pgtg_native -----------------------------------------------------------------
+--------------------------------------------------------------------------------
+-- Optional: the extension is built from db/extension/pgtg_native and installed
+-- on the server (make install). Creating it needs a superuser.
+
+DO $$
+BEGIN
+  IF EXISTS (SELECT FROM pg_available_extensions WHERE name = 'pgtg_native') THEN
+    IF EXISTS (SELECT FROM pg_extension WHERE extname = 'pgtg_native') THEN
+      ALTER EXTENSION pgtg_native UPDATE;
+    ELSIF (SELECT rolsuper FROM pg_roles WHERE rolname = current_user) THEN
+      CREATE EXTENSION pgtg_native SCHEMA bot;
+    ELSE
+      RAISE NOTICE 'pgtg_native: CREATE EXTENSION pgtg_native SCHEMA bot requires a superuser, the PL/pgSQL helpers are used.';
+    END IF;
+  END IF;
+END;
+$$;
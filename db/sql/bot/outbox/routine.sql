@@ -0,0 +1,342 @@
+--------------------------------------------------------------------------------
+-- FUNCTION bot.outbox_wakeup --------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.outbox_wakeup (
+) RETURNS       void
+AS $$
+BEGIN
+  -- One wakeup per transaction: the notification is delivered at commit and the process fetches the whole queue
+  IF current_setting('outbox.wakeup', true) IS DISTINCT FROM 'on' THEN
+    PERFORM set_config('outbox.wakeup', 'on', true);
+    PERFORM pg_notify('tg_outbox', json_build_object('event', 'queued')::text);
+  END IF;
+END;
+$$ LANGUAGE plpgsql
+  SECURITY DEFINER
+  SET search_path = bot, pg_temp;
+
+--------------------------------------------------------------------------------
+-- FUNCTION bot.outbox_add -----------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.outbox_add (
+  pBotId        uuid,
+  pChatId       bigint,
+  pMethod       text,
+  pParams       jsonb,
+  pCallback     text DEFAULT null
+) RETURNS       bigint
+AS $$
+DECLARE
+  nId           bigint;
+BEGIN
+  INSERT INTO bot.outbox (bot_id, chat_id, method, params, callback)
+  VALUES (pBotId, pChatId, pMethod, pParams, pCallback)
+  RETURNING id INTO nId;
+
+  PERFORM bot.outbox_wakeup();
+
+  RETURN nId;
+END;
+$$ LANGUAGE plpgsql
+  SECURITY DEFINER
+  SET search_path = bot, pg_temp;
+
+--------------------------------------------------------------------------------
+-- FUNCTION bot.outbox_add_batch -----------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.outbox_add_batch (
+  pBotId        uuid[],
+  pChatId       bigint[],
+  pMethod       text,
+  pParams       jsonb[],
+  pCallback     text DEFAULT null
+) RETURNS       SETOF bigint
+AS $$
+BEGIN
+  -- Fan-out: one insert and one wakeup for the whole batch (the arrays are of the same length)
+  RETURN QUERY
+    INSERT INTO bot.outbox (bot_id, chat_id, method, params, callback)
+    SELECT x.bot_id, x.chat_id, pMethod, x.params, pCallback
+      FROM unnest(pBotId, pChatId, pParams) AS x(bot_id, chat_id, params)
+    RETURNING id;
+
+  IF FOUND THEN
+    PERFORM bot.outbox_wakeup();
+  END IF;
+END;
+$$ LANGUAGE plpgsql
+  SECURITY DEFINER
+  SET search_path = bot, pg_temp;
+
+--------------------------------------------------------------------------------
+-- FUNCTION bot.send_message ---------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.send_message (
+  pBotId        uuid,
+  pChatId       bigint,
+  pText         text,
+  pParseMode    text DEFAULT null,
+  pReplyMarkup  jsonb DEFAULT null,
+  pCallback     text DEFAULT null
+) RETURNS       bigint
+AS $$
+BEGIN
+  RETURN bot.outbox_add(pBotId, pChatId, 'sendMessage', jsonb_strip_nulls(jsonb_build_object('text', pText, 'parse_mode', pParseMode, 'reply_markup', pReplyMarkup)), pCallback);
+END;
+$$ LANGUAGE plpgsql
+  SECURITY DEFINER
+  SET search_path = bot, pg_temp;
+
+--------------------------------------------------------------------------------
+-- FUNCTION bot.send_messages --------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.send_messages (
+  pBotId        uuid[],
+  pChatId       bigint[],
+  pText         text[],
+  pParseMode    text DEFAULT null,
+  pReplyMarkup  jsonb DEFAULT null,
+  pCallback     text DEFAULT null
+) RETURNS       SETOF bigint
+AS $$
+DECLARE
+  vParams       jsonb[];
+BEGIN
+  SELECT array_agg(jsonb_strip_nulls(jsonb_build_object('text', t.text, 'parse_mode', pParseMode, 'reply_markup', pReplyMarkup)) ORDER BY t.n)
+    INTO vParams
+    FROM unnest(pText) WITH ORDINALITY AS t(text, n);
+
+  RETURN QUERY SELECT * FROM bot.outbox_add_batch(pBotId, pChatId, 'sendMessage', vParams, pCallback);
+END;
+$$ LANGUAGE plpgsql
+  SECURITY DEFINER
+  SET search_path = bot, pg_temp;
+
+--------------------------------------------------------------------------------
+-- FUNCTION bot.outbox_fetch ---------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.outbox_fetch (
+  pLimit        integer DEFAULT 500
+) RETURNS       TABLE (
+  id            bigint,
+  bot_id        uuid,
+  chat_id       bigint
+)
+AS $$
+BEGIN
+  RETURN QUERY
+    UPDATE bot.outbox o
+       SET state = 1, updated = Now()
+     WHERE o.id IN (
+       SELECT t.id
+         FROM bot.outbox t
+        WHERE t.state = 0
+        ORDER BY t.id
+        LIMIT pLimit
+          FOR UPDATE SKIP LOCKED
+     )
+    RETURNING o.id, o.bot_id, o.chat_id;
+END;
+$$ LANGUAGE plpgsql
+  SECURITY DEFINER
+  SET search_path = bot, pg_temp;
+
+--------------------------------------------------------------------------------
+-- FUNCTION bot.outbox_reset ---------------------------------------------------
+--------------------------------------------------------------------------------
+
+-- At process start: the scheduled messages were held by the previous process
+CREATE OR REPLACE FUNCTION bot.outbox_reset (
+) RETURNS       integer
+AS $$
+DECLARE
+  nCount        integer;
+BEGIN
+  UPDATE bot.outbox SET state = 0, updated = Now() WHERE state = 1;
+  GET DIAGNOSTICS nCount = ROW_COUNT;
+  RETURN nCount + bot.outbox_recover();
+END;
+$$ LANGUAGE plpgsql
+  SECURITY DEFINER
+  SET search_path = bot, pg_temp;
+
+--------------------------------------------------------------------------------
+-- FUNCTION bot.outbox_recover -------------------------------------------------
+--------------------------------------------------------------------------------
+
+-- Messages sent without an answer (the callback of the request was lost) are queued again
+CREATE OR REPLACE FUNCTION bot.outbox_recover (
+  pTimeout      interval DEFAULT '5 min'
+) RETURNS       integer
+AS $$
+DECLARE
+  nCount        integer;
+BEGIN
+  UPDATE bot.outbox
+     SET state = 0,
+         request = null,
+         updated = Now()
+   WHERE state = 2
+     AND updated < Now() - pTimeout;
+
+  GET DIAGNOSTICS nCount = ROW_COUNT;
+
+  IF nCount > 0 THEN
+    PERFORM bot.outbox_wakeup();
+  END IF;
+
+  RETURN nCount;
+END;
+$$ LANGUAGE plpgsql
+  SECURITY DEFINER
+  SET search_path = bot, pg_temp;
+
+--------------------------------------------------------------------------------
+-- FUNCTION bot.outbox_send ----------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.outbox_send (
+  pId           bigint[]
+) RETURNS       integer
+AS $$
+DECLARE
+  r             record;
+
+  uRequest      uuid;
+  nCount        integer DEFAULT 0;
+BEGIN
+  FOR r IN
+    SELECT o.id, o.bot_id, o.chat_id, o.method, o.params, l.api_url, l.token
+      FROM bot.outbox o INNER JOIN bot.list l ON l.id = o.bot_id
+     WHERE o.id = ANY (pId)
+       AND o.state = 1
+     ORDER BY o.id
+       FOR UPDATE OF o
+  LOOP
+    -- Sent as bot.poll does: the fail callback requeues the message when the request gets no answer
+    uRequest := http.fetch(format('%s/bot%s/%s', rtrim(r.api_url, '/'), r.token, r.method), 'POST',
+                           jsonb_build_object('Content-Type', 'application/json'),
+                           (jsonb_build_object('chat_id', r.chat_id) || r.params)::text,
+                           'bot.outbox_done', 'bot.outbox_fail', 'telegram', r.bot_id::text, r.method);
+
+    UPDATE bot.outbox
+       SET state = 2,
+           request = uRequest,
+           attempts = attempts + 1,
+           updated = Now()
+     WHERE id = r.id;
+
+    nCount := nCount + 1;
+  END LOOP;
+
+  RETURN nCount;
+END;
+$$ LANGUAGE plpgsql
+  SECURITY DEFINER
+  SET search_path = bot, pg_temp;
+
+--------------------------------------------------------------------------------
+-- FUNCTION bot.outbox_fail ----------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.outbox_fail (
+  pRequest      uuid
+) RETURNS       void
+AS $$
+DECLARE
+  cAttempts     CONSTANT integer DEFAULT 3;
+
+  o             record;
+
+  vError        text;
+
+  vMessage      text;
+  vContext      text;
+BEGIN
+  SELECT id, attempts INTO o FROM bot.outbox WHERE request = pRequest AND state = 2 FOR UPDATE;
+
+  IF NOT FOUND THEN
+    RETURN;
+  END IF;
+
+  IF o.attempts < cAttempts THEN
+    UPDATE bot.outbox SET state = 0, request = null, updated = Now() WHERE id = o.id;
+    PERFORM bot.outbox_wakeup();
+  ELSE
+    SELECT message INTO vError FROM http.fetch WHERE id = pRequest;
+    UPDATE bot.outbox SET state = 4, updated = Now() WHERE id = o.id;
+    PERFORM WriteToEventLog('E', -1, coalesce(vError, 'Request failed.'), 'outbox');
+  END IF;
+EXCEPTION
+WHEN others THEN
+  GET STACKED DIAGNOSTICS vMessage = MESSAGE_TEXT, vContext = PG_EXCEPTION_CONTEXT;
+  PERFORM WriteDiagnostics(vMessage, vContext);
+END
+$$ LANGUAGE plpgsql
+  SECURITY DEFINER
+  SET search_path = bot, public, pg_temp;
+
+--------------------------------------------------------------------------------
+-- FUNCTION bot.outbox_done ----------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.outbox_done (
+  pRequest      uuid
+) RETURNS       void
+AS $$
+DECLARE
+  r             record;
+  o             record;
+
+  reply         jsonb;
+
+  nRetryAfter   integer;
+
+  vMessage      text;
+  vContext      text;
+BEGIN
+  SELECT agent, status, status_text, response INTO r FROM http.fetch WHERE id = pRequest;
+
+  SELECT id, bot_id, chat_id, callback, attempts INTO o FROM bot.outbox WHERE request = pRequest;
+
+  IF NOT FOUND THEN
+    RETURN;
+  END IF;
+
+  IF coalesce(r.status, 0) = 200 THEN
+
+    UPDATE bot.outbox SET state = 3, updated = Now() WHERE id = o.id;
+
+    IF o.callback IS NOT NULL THEN
+      EXECUTE format('SELECT %s($1);', o.callback) USING pRequest;
+    END IF;
+
+  ELSIF r.status = 429 THEN
+
+    reply := convert_from(r.response, 'utf8')::jsonb;
+    nRetryAfter := greatest(coalesce((reply->'parameters'->>'retry_after')::integer, 1), 1);
+
+    UPDATE bot.outbox SET state = 1, request = null, updated = Now() WHERE id = o.id;
+
+    PERFORM pg_notify('tg_outbox', json_build_object('event', 'retry', 'id', o.id, 'bot_id', o.bot_id, 'chat_id', o.chat_id, 'retry_after', nRetryAfter)::text);
+
+  ELSE
+
+    UPDATE bot.outbox SET state = 4, updated = Now() WHERE id = o.id;
+    PERFORM WriteToEventLog('E', coalesce(r.status, -1), coalesce(convert_from(r.response, 'utf8'), r.status_text), 'outbox');
+
+  END IF;
+EXCEPTION
+WHEN others THEN
+  GET STACKED DIAGNOSTICS vMessage = MESSAGE_TEXT, vContext = PG_EXCEPTION_CONTEXT;
+  PERFORM WriteDiagnostics(vMessage, vContext);
+END
+$$ LANGUAGE plpgsql
+  SECURITY DEFINER
+  SET search_path = bot, public, pg_temp;
@@ -0,0 +1,34 @@
+--------------------------------------------------------------------------------
+-- bot.outbox ------------------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE TABLE bot.outbox (
+  id            bigserial PRIMARY KEY,
+  bot_id        uuid NOT NULL REFERENCES bot.list ON DELETE CASCADE,
+  chat_id       bigint NOT NULL,
+  method        text NOT NULL DEFAULT 'sendMessage',
+  params        jsonb NOT NULL,
+  callback      text,
+  state         integer NOT NULL DEFAULT 0 CHECK (state BETWEEN 0 AND 4),
+  request       uuid,
+  attempts      integer NOT NULL DEFAULT 0,
+  created       timestamptz NOT NULL DEFAULT Now(),
+  updated       timestamptz NOT NULL DEFAULT Now()
+);
+
+COMMENT ON TABLE bot.outbox IS 'Outgoing messages paced by the telegram bot process.';
+
+COMMENT ON COLUMN bot.outbox.id IS 'Identifier';
+COMMENT ON COLUMN bot.outbox.bot_id IS 'Bot ID';
+COMMENT ON COLUMN bot.outbox.chat_id IS 'Chat ID';
+COMMENT ON COLUMN bot.outbox.method IS 'Telegram Bot API method';
+COMMENT ON COLUMN bot.outbox.params IS 'Method parameters (chat_id is added when sent)';
+COMMENT ON COLUMN bot.outbox.callback IS 'Done callback (if necessary)';
+COMMENT ON COLUMN bot.outbox.state IS 'State: 0 - queued, 1 - scheduled, 2 - sent, 3 - delivered, 4 - failed';
+COMMENT ON COLUMN bot.outbox.request IS 'HTTP request ID';
+COMMENT ON COLUMN bot.outbox.attempts IS 'Number of attempts';
+COMMENT ON COLUMN bot.outbox.created IS 'Date and time of creation';
+COMMENT ON COLUMN bot.outbox.updated IS 'Last updated';
+
+CREATE INDEX ON bot.outbox (state, id) WHERE state < 3;
+CREATE INDEX ON bot.outbox (request);
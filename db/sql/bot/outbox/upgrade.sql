@@ -0,0 +1,20 @@
+--------------------------------------------------------------------------------
+-- bot.outbox ------------------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE TABLE IF NOT EXISTS bot.outbox (
+  id            bigserial PRIMARY KEY,
+  bot_id        uuid NOT NULL REFERENCES bot.list ON DELETE CASCADE,
+  chat_id       bigint NOT NULL,
+  method        text NOT NULL DEFAULT 'sendMessage',
+  params        jsonb NOT NULL,
+  callback      text,
+  state         integer NOT NULL DEFAULT 0 CHECK (state BETWEEN 0 AND 4),
+  request       uuid,
+  attempts      integer NOT NULL DEFAULT 0,
+  created       timestamptz NOT NULL DEFAULT Now(),
+  updated       timestamptz NOT NULL DEFAULT Now()
+);
+
+CREATE INDEX IF NOT EXISTS outbox_state_id_idx ON bot.outbox (state, id) WHERE state < 3;
+CREATE INDEX IF NOT EXISTS outbox_request_idx ON bot.outbox (request);
@@ -100,10 +100,7 @@ CREATE OR REPLACE FUNCTION bot.GetVar (
 ) RETURNS   text
 AS $$
 BEGIN
-  RETURN NULLIF(current_setting(concat(pType, '.', pName)), '');
-EXCEPTION
-WHEN syntax_error_or_access_rule_violation THEN
-  RETURN null;
+  RETURN NULLIF(current_setting(concat(pType, '.', pName), true), '');
 END;
 $$ LANGUAGE plpgsql
    SECURITY DEFINER
@@ -112,16 +109,16 @@ $$ LANGUAGE plpgsql
 --------------------------------------------------------------------------------
 -- FUNCTION current_bot_id -----------------------------------------------------
 --------------------------------------------------------------------------------
+-- The context is kept as text in transaction-scoped settings, every call of an accessor reads the setting and
+-- casts it. The accessors are plain STABLE SQL (no SECURITY DEFINER, no SET), so the planner can inline them:
+-- in an index condition the value is computed once per scan, in a target list, a filter or a PL/pgSQL
+-- expression it is computed on every evaluation. Read it once into a variable where it is used in a loop.
 
 CREATE OR REPLACE FUNCTION bot.current_bot_id()
 RETURNS		uuid
 AS $$
-BEGIN
-  RETURN GetVar('context', 'bot_id')::uuid;
-END
-$$ LANGUAGE plpgsql
-   SECURITY DEFINER
-   SET search_path = bot, pg_temp;
+  SELECT NULLIF(current_setting('context.bot_id', true), '')::uuid;
+$$ LANGUAGE sql STABLE;
 
 --------------------------------------------------------------------------------
 -- FUNCTION current_chat_id ----------------------------------------------------
@@ -130,12 +127,8 @@ $$ LANGUAGE plpgsql
 CREATE OR REPLACE FUNCTION bot.current_chat_id()
 RETURNS		bigint
 AS $$
-BEGIN
-  RETURN GetVar('context', 'chat_id')::bigint;
-END
-$$ LANGUAGE plpgsql
-   SECURITY DEFINER
-   SET search_path = bot, pg_temp;
+  SELECT NULLIF(current_setting('context.chat_id', true), '')::bigint;
+$$ LANGUAGE sql STABLE;
 
 --------------------------------------------------------------------------------
 -- FUNCTION current_user_id ----------------------------------------------------
@@ -144,12 +137,8 @@ $$ LANGUAGE plpgsql
 CREATE OR REPLACE FUNCTION bot.current_user_id()
 RETURNS		bigint
 AS $$
-BEGIN
-  RETURN GetVar('context', 'user_id')::bigint;
-END
-$$ LANGUAGE plpgsql
-   SECURITY DEFINER
-   SET search_path = bot, pg_temp;
+  SELECT NULLIF(current_setting('context.user_id', true), '')::bigint;
+$$ LANGUAGE sql STABLE;
 
 --------------------------------------------------------------------------------
 -- FUNCTION current_command ----------------------------------------------------
@@ -158,13 +147,324 @@ $$ LANGUAGE plpgsql
 CREATE OR REPLACE FUNCTION bot.current_command()
 RETURNS		text
 AS $$
+  SELECT NULLIF(current_setting('context.command', true), '');
+$$ LANGUAGE sql STABLE;
+
+--------------------------------------------------------------------------------
+-- FUNCTION bot.dispatch_build -------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.dispatch_build (
+) RETURNS       void
+AS $$
+DECLARE
+  r             record;
+
+  vCases        text;
+  vBody         text;
 BEGIN
-  RETURN GetVar('context', 'command');
-END
+  -- Generates bot.webhook_dispatch(), bot.heartbeat_dispatch() and bot.<update type>_dispatch() with a static call of
+  -- every resolved handler: the handler is found by one lookup in bot.dispatch and the call plan is cached by PL/pgSQL.
+  -- Typed handlers get pBody only if they declare the jsonb argument.
+  FOR r IN
+    SELECT * FROM (VALUES ('webhook', 'pBotId uuid, pBody jsonb', 'pBotId, pBody', 2),
+                          ('heartbeat', 'pBotId uuid', 'pBotId', 1),
+                          ('message', 'pBotId uuid, pUpdate bot.tg_message, pBody jsonb', 'pBotId, pUpdate', 2),
+                          ('callback_query', 'pBotId uuid, pUpdate bot.tg_callback_query, pBody jsonb', 'pBotId, pUpdate', 2),
+                          ('inline_query', 'pBotId uuid, pUpdate bot.tg_inline_query, pBody jsonb', 'pBotId, pUpdate', 2),
+                          ('my_chat_member', 'pBotId uuid, pUpdate bot.tg_my_chat_member, pBody jsonb', 'pBotId, pUpdate', 2)) AS x(kind, params, args, nargs)
+  LOOP
+    EXECUTE format('SELECT string_agg(format(E''  WHEN %%s::oid THEN\n    PERFORM %%I.%%I(%%s);\n'', p.oid, n.nspname, p.proname, CASE WHEN p.pronargs > %s THEN %L ELSE %L END), '''' ORDER BY p.oid)
+                      FROM (SELECT DISTINCT %I AS handler FROM bot.dispatch WHERE %I IS NOT NULL) d
+                     INNER JOIN pg_proc p ON p.oid = d.handler
+                     INNER JOIN pg_namespace n ON n.oid = p.pronamespace', r.nargs, concat(r.args, ', pBody'), r.args, r.kind, r.kind) INTO vCases;
+
+    IF vCases IS NULL THEN
+      vBody := E'\nBEGIN\n  RETURN false;\nEND;\n';
+    ELSE
+      vBody := concat(E'\nDECLARE\n  vHandler oid;\nBEGIN\n',
+                      format(E'  SELECT %I INTO vHandler FROM bot.dispatch WHERE bot_id = pBotId;\n\n', r.kind),
+                      E'  CASE vHandler\n', vCases, E'  ELSE\n    RETURN false;\n  END CASE;\n\n  RETURN true;\nEND;\n');
+    END IF;
+
+    EXECUTE format('CREATE OR REPLACE FUNCTION bot.%I (%s) RETURNS bool AS %L LANGUAGE plpgsql SECURITY DEFINER SET search_path = bot, pg_temp',
+                   concat(r.kind, '_dispatch'), r.params, vBody);
+  END LOOP;
+END;
+$$ LANGUAGE plpgsql
+  SECURITY DEFINER
+  SET search_path = bot, pg_temp;
+
+--------------------------------------------------------------------------------
+-- FUNCTION bot.dispatch_refresh -----------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.dispatch_refresh (
+  pBotId        uuid DEFAULT null
+) RETURNS       integer
+AS $$
+DECLARE
+  r             record;
+  nCount        integer DEFAULT 0;
+BEGIN
+  -- Resolves the handlers of a bot (null - of all bots), the bots with changed handlers are announced on bot_list
+  FOR r IN
+    INSERT INTO bot.dispatch AS d (bot_id, webhook, heartbeat, message, callback_query, inline_query, my_chat_member)
+    SELECT l.id,
+           to_regprocedure(format('bot.%I(uuid, jsonb)', concat(lower(l.username), '_webhook'))),
+           to_regprocedure(format('bot.%I(uuid)', concat(lower(l.username), '_heartbeat'))),
+           coalesce(to_regprocedure(format('bot.%I(uuid, bot.tg_message, jsonb)', concat(lower(l.username), '_message'))),
+                    to_regprocedure(format('bot.%I(uuid, bot.tg_message)', concat(lower(l.username), '_message')))),
+           coalesce(to_regprocedure(format('bot.%I(uuid, bot.tg_callback_query, jsonb)', concat(lower(l.username), '_callback_query'))),
+                    to_regprocedure(format('bot.%I(uuid, bot.tg_callback_query)', concat(lower(l.username), '_callback_query')))),
+           coalesce(to_regprocedure(format('bot.%I(uuid, bot.tg_inline_query, jsonb)', concat(lower(l.username), '_inline_query'))),
+                    to_regprocedure(format('bot.%I(uuid, bot.tg_inline_query)', concat(lower(l.username), '_inline_query')))),
+           coalesce(to_regprocedure(format('bot.%I(uuid, bot.tg_my_chat_member, jsonb)', concat(lower(l.username), '_my_chat_member'))),
+                    to_regprocedure(format('bot.%I(uuid, bot.tg_my_chat_member)', concat(lower(l.username), '_my_chat_member'))))
+      FROM bot.list l
+     WHERE l.id = coalesce(pBotId, l.id)
+    ON CONFLICT (bot_id) DO UPDATE SET webhook = EXCLUDED.webhook, heartbeat = EXCLUDED.heartbeat, message = EXCLUDED.message,
+                                       callback_query = EXCLUDED.callback_query, inline_query = EXCLUDED.inline_query,
+                                       my_chat_member = EXCLUDED.my_chat_member, updated = Now()
+     WHERE (d.webhook, d.heartbeat, d.message, d.callback_query, d.inline_query, d.my_chat_member) IS DISTINCT FROM
+           (EXCLUDED.webhook, EXCLUDED.heartbeat, EXCLUDED.message, EXCLUDED.callback_query, EXCLUDED.inline_query, EXCLUDED.my_chat_member)
+    RETURNING d.bot_id
+  LOOP
+    PERFORM pg_notify('bot_list', json_build_object('id', r.bot_id, 'op', 'UPDATE')::text);
+    nCount := nCount + 1;
+  END LOOP;
+
+  IF nCount > 0 OR pBotId IS NULL THEN
+    PERFORM bot.dispatch_build();
+  END IF;
+
+  RETURN nCount;
+END;
+$$ LANGUAGE plpgsql
+  SECURITY DEFINER
+  SET search_path = bot, pg_temp;
+
+--------------------------------------------------------------------------------
+-- bot.ft_list_notify ----------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.ft_list_notify()
+RETURNS trigger AS $$
+BEGIN
+  IF TG_OP = 'DELETE' THEN
+    PERFORM pg_notify('bot_list', json_build_object('id', OLD.id, 'op', TG_OP)::text);
+  ELSE
+    PERFORM pg_notify('bot_list', json_build_object('id', NEW.id, 'op', TG_OP)::text);
+  END IF;
+
+  RETURN null;
+END;
+$$ LANGUAGE plpgsql
+   SECURITY DEFINER
+   SET search_path = bot, pg_temp;
+
+--------------------------------------------------------------------------------
+
+DROP TRIGGER IF EXISTS t_bot_list_insert_delete ON bot.list;
+
+CREATE TRIGGER t_bot_list_insert_delete
+  AFTER INSERT OR DELETE ON bot.list
+  FOR EACH ROW
+  EXECUTE PROCEDURE bot.ft_list_notify();
+
+--------------------------------------------------------------------------------
+
+DROP TRIGGER IF EXISTS t_bot_list_update ON bot.list;
+
+CREATE TRIGGER t_bot_list_update
+  AFTER UPDATE ON bot.list
+  FOR EACH ROW
+  WHEN (OLD.token IS DISTINCT FROM NEW.token OR OLD.username IS DISTINCT FROM NEW.username OR OLD.secret IS DISTINCT FROM NEW.secret OR OLD.language_code IS DISTINCT FROM NEW.language_code OR OLD.mode IS DISTINCT FROM NEW.mode OR OLD.poll_timeout IS DISTINCT FROM NEW.poll_timeout OR OLD.flood_rate IS DISTINCT FROM NEW.flood_rate OR OLD.flood_burst IS DISTINCT FROM NEW.flood_burst OR OLD.flood_policy IS DISTINCT FROM NEW.flood_policy)
+  EXECUTE PROCEDURE bot.ft_list_notify();
+
+--------------------------------------------------------------------------------
+-- bot.ft_list_dispatch --------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.ft_list_dispatch()
+RETURNS trigger AS $$
+BEGIN
+  PERFORM bot.dispatch_refresh(NEW.id);
+  RETURN null;
+END;
 $$ LANGUAGE plpgsql
    SECURITY DEFINER
    SET search_path = bot, pg_temp;
 
+--------------------------------------------------------------------------------
+
+DROP TRIGGER IF EXISTS t_bot_list_dispatch ON bot.list;
+
+CREATE TRIGGER t_bot_list_dispatch
+  AFTER INSERT OR UPDATE OF username ON bot.list
+  FOR EACH ROW
+  EXECUTE PROCEDURE bot.ft_list_dispatch();
+
+--------------------------------------------------------------------------------
+-- bot.ft_dispatch_ddl ---------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.ft_dispatch_ddl()
+RETURNS event_trigger AS $$
+BEGIN
+  -- Bot handlers only: the generated dispatch functions do not match
+  IF TG_EVENT = 'sql_drop' THEN
+    PERFORM FROM pg_event_trigger_dropped_objects()
+     WHERE object_type = 'function' AND schema_name = 'bot' AND object_identity ~ '_(webhook|heartbeat|message|callback_query|inline_query|my_chat_member)\(';
+  ELSE
+    PERFORM FROM pg_event_trigger_ddl_commands()
+     WHERE object_type = 'function' AND schema_name = 'bot' AND object_identity ~ '_(webhook|heartbeat|message|callback_query|inline_query|my_chat_member)\(';
+  END IF;
+
+  IF FOUND THEN
+    PERFORM bot.dispatch_refresh();
+  END IF;
+END;
+$$ LANGUAGE plpgsql
+   SET search_path = bot, pg_temp;
+
+--------------------------------------------------------------------------------
+
+DO $$
+BEGIN
+  IF (SELECT rolsuper FROM pg_roles WHERE rolname = current_user) THEN
+    DROP EVENT TRIGGER IF EXISTS bot_dispatch_ddl;
+    DROP EVENT TRIGGER IF EXISTS bot_dispatch_drop;
+
+    CREATE EVENT TRIGGER bot_dispatch_ddl ON ddl_command_end
+      WHEN TAG IN ('CREATE FUNCTION', 'ALTER FUNCTION')
+      EXECUTE PROCEDURE bot.ft_dispatch_ddl();
+
+    CREATE EVENT TRIGGER bot_dispatch_drop ON sql_drop
+      WHEN TAG IN ('DROP FUNCTION')
+      EXECUTE PROCEDURE bot.ft_dispatch_ddl();
+  ELSE
+    RAISE NOTICE 'bot.dispatch: event triggers require a superuser, call bot.dispatch_refresh() after changing bot handlers.';
+  END IF;
+END;
+$$;
+
+--------------------------------------------------------------------------------
+-- FUNCTION bot.registry -------------------------------------------------------
+--------------------------------------------------------------------------------
+
+DROP FUNCTION IF EXISTS bot.registry(uuid);
+
+CREATE OR REPLACE FUNCTION bot.registry (
+  pId               uuid DEFAULT null,
+  OUT id            uuid,
+  OUT username      text,
+  OUT language_code text,
+  OUT secret        text,
+  OUT mode          text,
+  OUT poll_timeout  integer,
+  OUT flood_rate    double precision,
+  OUT flood_burst   integer,
+  OUT flood_policy  text,
+  OUT webhook       oid,
+  OUT heartbeat     oid,
+  OUT webhook_name  text,
+  OUT heartbeat_name text,
+  OUT message_name  text,
+  OUT message_body  bool,
+  OUT callback_query_name text,
+  OUT callback_query_body bool,
+  OUT inline_query_name text,
+  OUT inline_query_body bool,
+  OUT my_chat_member_name text,
+  OUT my_chat_member_body bool
+) RETURNS           SETOF record
+AS $$
+  SELECT l.id, l.username, l.language_code, l.secret, l.mode, l.poll_timeout,
+         l.flood_rate, l.flood_burst, l.flood_policy,
+         w.oid, h.oid,
+         CASE WHEN w.oid IS NOT NULL THEN concat('bot.', quote_ident(w.proname)) END,
+         CASE WHEN h.oid IS NOT NULL THEN concat('bot.', quote_ident(h.proname)) END,
+         CASE WHEN m.oid IS NOT NULL THEN concat('bot.', quote_ident(m.proname)) END, m.pronargs > 2,
+         CASE WHEN c.oid IS NOT NULL THEN concat('bot.', quote_ident(c.proname)) END, c.pronargs > 2,
+         CASE WHEN i.oid IS NOT NULL THEN concat('bot.', quote_ident(i.proname)) END, i.pronargs > 2,
+         CASE WHEN s.oid IS NOT NULL THEN concat('bot.', quote_ident(s.proname)) END, s.pronargs > 2
+    FROM bot.list l
+    LEFT JOIN bot.dispatch d ON d.bot_id = l.id
+    LEFT JOIN pg_proc w ON w.oid = d.webhook
+    LEFT JOIN pg_proc h ON h.oid = d.heartbeat
+    LEFT JOIN pg_proc m ON m.oid = d.message
+    LEFT JOIN pg_proc c ON c.oid = d.callback_query
+    LEFT JOIN pg_proc i ON i.oid = d.inline_query
+    LEFT JOIN pg_proc s ON s.oid = d.my_chat_member
+   WHERE l.id = coalesce(pId, l.id);
+$$ LANGUAGE sql STABLE
+  SECURITY DEFINER
+  SET search_path = bot, pg_temp;
+
+--------------------------------------------------------------------------------
+-- TELEGRAM BOT WEBHOOK --------------------------------------------------------
+--------------------------------------------------------------------------------
+
+--------------------------------------------------------------------------------
+-- FUNCTION bot.decode_message -------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.decode_message (
+  pUpdate       jsonb
+) RETURNS       bot.tg_message
+AS $$
+  SELECT (pUpdate->>'update_id')::bigint, (m->>'message_id')::bigint, (m->>'date')::double precision,
+         (m#>>'{chat,id}')::bigint, m#>>'{chat,type}', m#>>'{chat,username}',
+         (m#>>'{from,id}')::bigint, m#>>'{from,username}', m#>>'{from,language_code}',
+         m->>'text', m->>'caption',
+         m#>>'{document,file_id}', m#>>'{document,file_unique_id}', m#>>'{document,file_name}',
+         (m#>>'{document,file_size}')::bigint, m#>>'{document,mime_type}'
+    FROM (SELECT pUpdate->'message' AS m) x;
+$$ LANGUAGE sql IMMUTABLE;
+
+--------------------------------------------------------------------------------
+-- FUNCTION bot.decode_callback_query ------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.decode_callback_query (
+  pUpdate       jsonb
+) RETURNS       bot.tg_callback_query
+AS $$
+  SELECT (pUpdate->>'update_id')::bigint, q->>'id', q->>'data',
+         (q#>>'{from,id}')::bigint, q#>>'{from,username}', q#>>'{from,language_code}',
+         (q#>>'{message,chat,id}')::bigint, (q#>>'{message,message_id}')::bigint, q#>>'{message,text}'
+    FROM (SELECT pUpdate->'callback_query' AS q) x;
+$$ LANGUAGE sql IMMUTABLE;
+
+--------------------------------------------------------------------------------
+-- FUNCTION bot.decode_inline_query --------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.decode_inline_query (
+  pUpdate       jsonb
+) RETURNS       bot.tg_inline_query
+AS $$
+  SELECT (pUpdate->>'update_id')::bigint, q->>'id', q->>'query', q->>'offset',
+         (q#>>'{from,id}')::bigint, q#>>'{from,username}', q#>>'{from,language_code}'
+    FROM (SELECT pUpdate->'inline_query' AS q) x;
+$$ LANGUAGE sql IMMUTABLE;
+
+--------------------------------------------------------------------------------
+-- FUNCTION bot.decode_my_chat_member ------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.decode_my_chat_member (
+  pUpdate       jsonb
+) RETURNS       bot.tg_my_chat_member
+AS $$
+  SELECT (pUpdate->>'update_id')::bigint, (m->>'date')::double precision,
+         (m#>>'{chat,id}')::bigint, m#>>'{chat,type}',
+         (m#>>'{from,id}')::bigint, m#>>'{from,username}', m#>>'{from,language_code}',
+         m#>>'{old_chat_member,status}', m#>>'{new_chat_member,status}'
+    FROM (SELECT pUpdate->'my_chat_member' AS m) x;
+$$ LANGUAGE sql IMMUTABLE;
+
 --------------------------------------------------------------------------------
 -- TELEGRAM BOT WEBHOOK --------------------------------------------------------
 --------------------------------------------------------------------------------
@@ -175,20 +475,28 @@ CREATE OR REPLACE FUNCTION bot.webhook (
 ) RETURNS       void
 AS $$
 DECLARE
-  r             record;
+  isDone        bool DEFAULT false;
 
-  vName         text;
   vMessage      text;
   vContext      text;
 BEGIN
-  FOR r IN SELECT id, username FROM bot.list WHERE id = bot_id
-  LOOP
-    vName := concat(lower(r.username), '_webhook');
-    PERFORM FROM pg_namespace n INNER JOIN pg_proc p ON n.oid = p.pronamespace WHERE n.nspname = 'bot' AND p.proname = vName;
-    IF FOUND THEN
-      EXECUTE format('SELECT bot.%s($1, $2);', vName) USING r.id, body;
-    END IF;
-  END LOOP;
+  -- Polling path: the webhook worker decodes the update itself and calls the typed handler directly
+  CASE
+  WHEN body ? 'message' THEN
+    isDone := bot.message_dispatch(bot_id, bot.decode_message(body), body->'message');
+  WHEN body ? 'callback_query' THEN
+    isDone := bot.callback_query_dispatch(bot_id, bot.decode_callback_query(body), body->'callback_query');
+  WHEN body ? 'inline_query' THEN
+    isDone := bot.inline_query_dispatch(bot_id, bot.decode_inline_query(body), body->'inline_query');
+  WHEN body ? 'my_chat_member' THEN
+    isDone := bot.my_chat_member_dispatch(bot_id, bot.decode_my_chat_member(body), body->'my_chat_member');
+  ELSE
+    NULL;
+  END CASE;
+
+  IF NOT isDone THEN
+    PERFORM bot.webhook_dispatch(bot_id, body);
+  END IF;
 EXCEPTION
 WHEN others THEN
   GET STACKED DIAGNOSTICS vMessage = MESSAGE_TEXT, vContext = PG_EXCEPTION_CONTEXT;
@@ -208,23 +516,156 @@ AS $$
 DECLARE
   r             record;
 
-  vName         text;
   vMessage      text;
   vContext      text;
 BEGIN
-  FOR r IN SELECT id, username FROM bot.list
+  -- Fallback of the bot process until the registry is loaded: an error of one bot does not roll back the others
+  FOR r IN SELECT d.bot_id FROM bot.dispatch d WHERE d.heartbeat IS NOT NULL
   LOOP
-    vName := concat(lower(r.username), '_heartbeat');
-    PERFORM FROM pg_namespace n INNER JOIN pg_proc p ON n.oid = p.pronamespace WHERE n.nspname = 'bot' AND p.proname = vName;
-    IF FOUND THEN
-      EXECUTE format('SELECT bot.%s($1);', vName) USING r.id;
-    END IF;
+    BEGIN
+      PERFORM bot.heartbeat_dispatch(r.bot_id);
+    EXCEPTION
+    WHEN others THEN
+      GET STACKED DIAGNOSTICS vMessage = MESSAGE_TEXT, vContext = PG_EXCEPTION_CONTEXT;
+      PERFORM WriteDiagnostics(vMessage, vContext);
+    END;
   END LOOP;
+END
+$$ LANGUAGE plpgsql
+  SECURITY DEFINER
+  SET search_path = bot, pg_temp;
+
+--------------------------------------------------------------------------------
+-- TELEGRAM BOT POLLING --------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.poll (
+  pBotId        uuid
+) RETURNS       uuid
+AS $$
+DECLARE
+  r             record;
+BEGIN
+  SELECT id, token, api_url, poll_offset, poll_limit, poll_timeout INTO r
+    FROM bot.list
+   WHERE id = pBotId
+     AND mode = 'polling';
+
+  IF NOT FOUND THEN
+    RETURN null;
+  END IF;
+
+  RETURN http.fetch(format('%s/bot%s/getUpdates?offset=%s&limit=%s&timeout=%s', rtrim(r.api_url, '/'), r.token, r.poll_offset, r.poll_limit, r.poll_timeout), 'GET', null, null, 'bot.poll_done', 'bot.poll_fail', 'telegram', r.id::text, 'getUpdates');
+END
+$$ LANGUAGE plpgsql
+  SECURITY DEFINER
+  SET search_path = bot, pg_temp;
+
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.poll_done (
+  pRequest      uuid
+) RETURNS       void
+AS $$
+DECLARE
+  r             record;
+  e             record;
+
+  reply         jsonb;
+
+  uBotId        uuid;
+  nOffset       bigint;
+  nCount        integer DEFAULT 0;
+
+  vMessage      text;
+  vContext      text;
+BEGIN
+  SELECT agent, profile, status, status_text, response INTO r FROM http.fetch WHERE id = pRequest;
+
+  uBotId := r.profile::uuid;
+
+  IF coalesce(r.status, 0) = 200 THEN
+
+    reply := convert_from(r.response, 'utf8')::jsonb;
+
+    FOR e IN SELECT (t.value->>'update_id')::bigint AS update_id, t.value FROM jsonb_array_elements(reply->'result') t ORDER BY 1
+    LOOP
+      -- Each update in its own subtransaction: a failing handler does not roll back the batch, the offset
+      -- moves past it (otherwise Telegram returns the same batch again and again)
+      BEGIN
+        PERFORM bot.webhook(uBotId, e.value);
+      EXCEPTION
+      WHEN others THEN
+        GET STACKED DIAGNOSTICS vMessage = MESSAGE_TEXT, vContext = PG_EXCEPTION_CONTEXT;
+        PERFORM WriteDiagnostics(vMessage, vContext);
+      END;
+
+      nOffset := e.update_id + 1;
+      nCount := nCount + 1;
+    END LOOP;
+
+    IF nOffset IS NOT NULL THEN
+      UPDATE bot.list SET poll_offset = nOffset WHERE id = uBotId;
+    END IF;
+
+    PERFORM pg_notify('tg_poll', json_build_object('event', 'done', 'bot_id', uBotId, 'count', nCount)::text);
+
+  ELSE
+
+    PERFORM WriteToEventLog('E', coalesce(r.status, -1), coalesce(convert_from(r.response, 'utf8'), r.status_text), 'getUpdates');
+    PERFORM pg_notify('tg_poll', json_build_object('event', 'error', 'bot_id', uBotId, 'status', r.status)::text);
+
+  END IF;
 EXCEPTION
 WHEN others THEN
   GET STACKED DIAGNOSTICS vMessage = MESSAGE_TEXT, vContext = PG_EXCEPTION_CONTEXT;
   PERFORM WriteDiagnostics(vMessage, vContext);
+  PERFORM pg_notify('tg_poll', json_build_object('event', 'error', 'bot_id', uBotId)::text);
 END
+$$ LANGUAGE plpgsql
+  SECURITY DEFINER
+  SET search_path = bot, public, pg_temp;
+
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.poll_fail (
+  pRequest      uuid
+) RETURNS       void
+AS $$
+DECLARE
+  r             record;
+BEGIN
+  SELECT agent, profile, error INTO r FROM http.request WHERE id = pRequest;
+
+  PERFORM WriteToEventLog('E', -1, r.error, 'getUpdates');
+  PERFORM pg_notify('tg_poll', json_build_object('event', 'error', 'bot_id', r.profile)::text);
+END
+$$ LANGUAGE plpgsql
+  SECURITY DEFINER
+  SET search_path = bot, public, pg_temp;
+
+--------------------------------------------------------------------------------
+-- FUNCTION bot.set_mode -------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.set_mode (
+  pId           uuid,
+  pMode         text,
+  pLimit        integer DEFAULT null,
+  pTimeout      integer DEFAULT null,
+  pApiUrl       text DEFAULT null
+) RETURNS       bool
+AS $$
+BEGIN
+  UPDATE bot.list
+     SET mode = pMode,
+         poll_limit = coalesce(pLimit, poll_limit),
+         poll_timeout = coalesce(pTimeout, poll_timeout),
+         api_url = coalesce(pApiUrl, api_url)
+   WHERE id = pId;
+
+  RETURN FOUND;
+END;
 $$ LANGUAGE plpgsql
   SECURITY DEFINER
   SET search_path = bot, pg_temp;
@@ -327,10 +768,12 @@ BEGIN
   ON CONFLICT (bot_id, chat_id, user_id)
   DO UPDATE SET command = pCommand, text = pText, data = pData, updated = coalesce(pUpdated, Now());
 
-  PERFORM SetVar('context', 'bot_id', pBotId);
-  PERFORM SetVar('context', 'chat_id', pChatId);
-  PERFORM SetVar('context', 'user_id', pUserId);
-  PERFORM SetVar('context', 'command', pCommand);
+  -- Transaction scope: a pooled connection does not carry the context over to the next update.
+  -- The values are stored in the canonical text form of their types (see current_bot_id and others).
+  PERFORM set_config('context.bot_id', coalesce(pBotId::text, ''), true),
+          set_config('context.chat_id', coalesce(pChatId::text, ''), true),
+          set_config('context.user_id', coalesce(pUserId::text, ''), true),
+          set_config('context.command', coalesce(pCommand, ''), true);
 END;
 $$ LANGUAGE plpgsql
   SECURITY DEFINER
@@ -467,10 +910,14 @@ $$ LANGUAGE plpgsql
 -- FUNCTION bot.get_messages ---------------------------------------------------
 --------------------------------------------------------------------------------
 
+DROP FUNCTION IF EXISTS bot.get_messages(text, bigint, uuid);
+
 CREATE OR REPLACE FUNCTION bot.get_messages (
   pRole             text,
   pChatId           bigint DEFAULT bot.current_chat_id(),
   pBotId            uuid DEFAULT bot.current_bot_id(),
+  pLimit            integer DEFAULT null,
+  pBeforeId         bigint DEFAULT null,
   OUT message_id    bigint,
   OUT user_id       bigint,
   OUT content       text,
@@ -479,13 +926,48 @@ CREATE OR REPLACE FUNCTION bot.get_messages (
 ) RETURNS           SETOF record
 AS $$
 BEGIN
+  -- Keyset pagination: the next page starts before the last message_id of the previous one
   RETURN QUERY
     SELECT t.message_id, t.user_id, t.content, t.cost, t.datetime
       FROM bot.chat t
      WHERE t.bot_id = pBotId
        AND t.chat_id = pChatId
        AND t.role = pRole
-     ORDER BY message_id DESC;
+       AND t.message_id < coalesce(pBeforeId, 9223372036854775807)
+     ORDER BY t.message_id DESC
+     LIMIT pLimit;
+END;
+$$ LANGUAGE plpgsql
+  SECURITY DEFINER
+  SET search_path = bot, pg_temp;
+
+--------------------------------------------------------------------------------
+-- FUNCTION bot.get_chat_window ------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.get_chat_window (
+  pLimit            integer DEFAULT 20,
+  pChatId           bigint DEFAULT bot.current_chat_id(),
+  pBotId            uuid DEFAULT bot.current_bot_id(),
+  OUT message_id    bigint,
+  OUT user_id       bigint,
+  OUT role          text,
+  OUT content       text,
+  OUT cost          numeric,
+  OUT datetime      timestamptz
+) RETURNS           SETOF record
+AS $$
+BEGIN
+  -- The last pLimit messages of all roles in chronological order (conversation context)
+  RETURN QUERY
+    SELECT w.message_id, w.user_id, w.role, w.content, w.cost, w.datetime
+      FROM (SELECT t.message_id, t.user_id, t.role, t.content, t.cost, t.datetime
+              FROM bot.chat t
+             WHERE t.bot_id = pBotId
+               AND t.chat_id = pChatId
+             ORDER BY t.message_id DESC
+             LIMIT pLimit) w
+     ORDER BY w.message_id;
 END;
 $$ LANGUAGE plpgsql
   SECURITY DEFINER
@@ -615,3 +1097,44 @@ BEGIN
   RETURN result;
 END
 $$ LANGUAGE plpgsql STRICT IMMUTABLE;
+
+--------------------------------------------------------------------------------
+-- FUNCTION bot.json_escape ----------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.json_escape(str text) RETURNS text
+AS $$
+  SELECT substr(s, 2, length(s) - 2) FROM to_json(str)::text AS s;
+$$ LANGUAGE sql STRICT IMMUTABLE;
+
+--------------------------------------------------------------------------------
+-- FUNCTION bot.html_escape ----------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION bot.html_escape(str text) RETURNS text
+AS $$
+  SELECT replace(replace(replace(replace(str, '&', '&amp;'), '<', '&lt;'), '>', '&gt;'), '"', '&quot;');
+$$ LANGUAGE sql STRICT IMMUTABLE;
+
+--------------------------------------------------------------------------------
+-- NATIVE FUNCTIONS ------------------------------------------------------------
+--------------------------------------------------------------------------------
+-- With the pgtg_native extension (db/extension/pgtg_native) the helpers call the C functions.
+
+DO $$
+BEGIN
+  IF to_regprocedure('bot.native_json_escape(text)') IS NOT NULL THEN
+    CREATE OR REPLACE FUNCTION bot.encode_json_string(str text) RETURNS text
+    AS 'SELECT bot.native_encode_json_string(str)'
+    LANGUAGE sql STRICT IMMUTABLE;
+
+    CREATE OR REPLACE FUNCTION bot.json_escape(str text) RETURNS text
+    AS 'SELECT bot.native_json_escape(str)'
+    LANGUAGE sql STRICT IMMUTABLE;
+
+    CREATE OR REPLACE FUNCTION bot.html_escape(str text) RETURNS text
+    AS 'SELECT bot.native_html_escape(str)'
+    LANGUAGE sql STRICT IMMUTABLE;
+  END IF;
+END;
+$$;
@@ -14,7 +14,15 @@ CREATE TABLE bot.list (
   secret        text,
   language_code text DEFAULT 'en',
   created       timestamptz NOT NULL DEFAULT Now(),
-  downtime      timestamptz NOT NULL DEFAULT Now()
+  downtime      timestamptz NOT NULL DEFAULT Now(),
+  mode          text NOT NULL DEFAULT 'webhook' CHECK (mode IN ('webhook', 'polling')),
+  api_url       text NOT NULL DEFAULT 'https://api.telegram.org',
+  poll_offset   bigint NOT NULL DEFAULT 0,
+  poll_limit    integer NOT NULL DEFAULT 100 CHECK (poll_limit BETWEEN 1 AND 100),
+  poll_timeout  integer NOT NULL DEFAULT 25 CHECK (poll_timeout BETWEEN 0 AND 50),
+  flood_rate    double precision NOT NULL DEFAULT 0 CHECK (flood_rate >= 0),
+  flood_burst   integer NOT NULL DEFAULT 10 CHECK (flood_burst > 0),
+  flood_policy  text NOT NULL DEFAULT 'drop' CHECK (flood_policy IN ('drop', 'collapse'))
 );
 
 COMMENT ON TABLE bot.list IS 'List of Telegram bots.';
@@ -27,9 +35,104 @@ COMMENT ON COLUMN bot.list.secret IS 'Secret code for authorization (if necessar
 COMMENT ON COLUMN bot.list.language_code IS 'Language code';
 COMMENT ON COLUMN bot.list.created IS 'Date and time of creation';
 COMMENT ON COLUMN bot.list.downtime IS 'Downtime';
+COMMENT ON COLUMN bot.list.mode IS 'Update delivery mode: webhook or polling (getUpdates)';
+COMMENT ON COLUMN bot.list.api_url IS 'Bot API server URL';
+COMMENT ON COLUMN bot.list.poll_offset IS 'getUpdates: identifier of the first update to be returned';
+COMMENT ON COLUMN bot.list.poll_limit IS 'getUpdates: number of updates to be retrieved (1-100)';
+COMMENT ON COLUMN bot.list.poll_timeout IS 'getUpdates: timeout in seconds for long polling';
+COMMENT ON COLUMN bot.list.flood_rate IS 'Anti-flood: updates per minute from one user (0 - unlimited)';
+COMMENT ON COLUMN bot.list.flood_burst IS 'Anti-flood: updates from one user accepted at once';
+COMMENT ON COLUMN bot.list.flood_policy IS 'Anti-flood: drop - excess updates are dropped, collapse - only the last excess update is processed';
 
 CREATE INDEX ON bot.list (downtime);
 
+--------------------------------------------------------------------------------
+-- bot.dispatch ----------------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE TABLE bot.dispatch (
+  bot_id        uuid PRIMARY KEY REFERENCES bot.list ON DELETE CASCADE,
+  webhook       regprocedure,
+  heartbeat     regprocedure,
+  message       regprocedure,
+  callback_query regprocedure,
+  inline_query  regprocedure,
+  my_chat_member regprocedure,
+  updated       timestamptz NOT NULL DEFAULT Now()
+);
+
+COMMENT ON TABLE bot.dispatch IS 'Resolved bot handlers (maintained by bot.dispatch_refresh).';
+
+COMMENT ON COLUMN bot.dispatch.bot_id IS 'Bot ID';
+COMMENT ON COLUMN bot.dispatch.webhook IS 'Webhook handler: bot.<username>_webhook(uuid, jsonb)';
+COMMENT ON COLUMN bot.dispatch.heartbeat IS 'Heartbeat handler: bot.<username>_heartbeat(uuid)';
+COMMENT ON COLUMN bot.dispatch.message IS 'Typed handler: bot.<username>_message(uuid, bot.tg_message [, jsonb])';
+COMMENT ON COLUMN bot.dispatch.callback_query IS 'Typed handler: bot.<username>_callback_query(uuid, bot.tg_callback_query [, jsonb])';
+COMMENT ON COLUMN bot.dispatch.inline_query IS 'Typed handler: bot.<username>_inline_query(uuid, bot.tg_inline_query [, jsonb])';
+COMMENT ON COLUMN bot.dispatch.my_chat_member IS 'Typed handler: bot.<username>_my_chat_member(uuid, bot.tg_my_chat_member [, jsonb])';
+COMMENT ON COLUMN bot.dispatch.updated IS 'Last updated';
+
+--------------------------------------------------------------------------------
+-- TYPED UPDATES ---------------------------------------------------------------
+--------------------------------------------------------------------------------
+
+-- Arguments of the typed handlers. The webhook worker fills them from the update
+-- without JSONB, bot.webhook() (polling) with bot.decode_message() and others.
+-- The column order is the field order of CTelegramUpdate (src/common).
+
+CREATE TYPE bot.tg_message AS (
+  update_id       bigint,
+  message_id      bigint,
+  date            double precision,
+  chat_id         bigint,
+  chat_type       text,
+  chat_username   text,
+  user_id         bigint,
+  username        text,
+  language_code   text,
+  text            text,
+  caption         text,
+  file_id         text,
+  file_unique_id  text,
+  file_name       text,
+  file_size       bigint,
+  mime_type       text
+);
+
+CREATE TYPE bot.tg_callback_query AS (
+  update_id       bigint,
+  id              text,
+  data            text,
+  user_id         bigint,
+  username        text,
+  language_code   text,
+  chat_id         bigint,
+  message_id      bigint,
+  message_text    text
+);
+
+CREATE TYPE bot.tg_inline_query AS (
+  update_id       bigint,
+  id              text,
+  query           text,
+  "offset"        text,
+  user_id         bigint,
+  username        text,
+  language_code   text
+);
+
+CREATE TYPE bot.tg_my_chat_member AS (
+  update_id       bigint,
+  date            double precision,
+  chat_id         bigint,
+  chat_type       text,
+  user_id         bigint,
+  username        text,
+  language_code   text,
+  old_status      text,
+  new_status      text
+);
+
 --------------------------------------------------------------------------------
 -- bot.context -----------------------------------------------------------------
 --------------------------------------------------------------------------------
@@ -74,7 +177,7 @@ CREATE TABLE bot.data (
   data          jsonb,
   updated       timestamptz NOT NULL,
   PRIMARY KEY (bot_id, chat_id, user_id, category, key)
-);
+) WITH (fillfactor = 90);
 
 COMMENT ON TABLE bot.data IS 'Bot data.';
 
@@ -87,18 +190,16 @@ COMMENT ON COLUMN bot.data.value IS 'Value';
 COMMENT ON COLUMN bot.data.data IS 'Data';
 COMMENT ON COLUMN bot.data.updated IS 'Last updated';
 
-CREATE INDEX ON bot.data (bot_id, chat_id, user_id, category);
-CREATE INDEX ON bot.data (bot_id);
-CREATE INDEX ON bot.data (user_id);
-CREATE INDEX ON bot.data (category);
-CREATE INDEX ON bot.data (key);
+-- Lookups by bot, chat, user and category are served by the primary key.
+-- Subscribers of an address (blockchain response) and settings by key.
+CREATE INDEX ON bot.data (key, category);
 
 --------------------------------------------------------------------------------
 -- bot.chat --------------------------------------------------------------------
 --------------------------------------------------------------------------------
 
 CREATE TABLE bot.chat (
-  bot_id        uuid REFERENCES bot.list ON DELETE CASCADE,
+  bot_id        uuid NOT NULL REFERENCES bot.list ON DELETE CASCADE,
   chat_id       bigint NOT NULL,
   user_id       bigint NOT NULL,
   message_id    bigint NOT NULL,
@@ -107,9 +208,9 @@ CREATE TABLE bot.chat (
   cost          numeric(12,0) DEFAULT 0 NOT NULL,
   datetime      timestamptz NOT NULL,
   PRIMARY KEY (bot_id, chat_id, message_id)
-);
+) PARTITION BY HASH (bot_id);
 
-COMMENT ON TABLE bot.chat IS 'Bot chat.';
+COMMENT ON TABLE bot.chat IS 'Bot chat (hash partitions by bot: bot.chat_0 .. bot.chat_7).';
 
 COMMENT ON COLUMN bot.chat.bot_id IS 'Bot ID';
 COMMENT ON COLUMN bot.chat.chat_id IS 'Char ID';
@@ -120,7 +221,15 @@ COMMENT ON COLUMN bot.chat.content IS 'Content';
 COMMENT ON COLUMN bot.chat.cost IS 'Cost in tokens';
 COMMENT ON COLUMN bot.chat.datetime IS 'Date and time';
 
-CREATE INDEX ON bot.chat (bot_id, chat_id, user_id, role);
-CREATE INDEX ON bot.chat (bot_id, chat_id, role);
-CREATE INDEX ON bot.chat (bot_id);
-CREATE INDEX ON bot.chat (datetime);
+-- History pages by role: content is read from the heap for the rows of the page only
+-- (long messages do not fit into a btree entry)
+CREATE INDEX ON bot.chat (bot_id, chat_id, role, message_id DESC) INCLUDE (user_id, cost, datetime);
+
+CREATE TABLE bot.chat_0 PARTITION OF bot.chat FOR VALUES WITH (MODULUS 8, REMAINDER 0);
+CREATE TABLE bot.chat_1 PARTITION OF bot.chat FOR VALUES WITH (MODULUS 8, REMAINDER 1);
+CREATE TABLE bot.chat_2 PARTITION OF bot.chat FOR VALUES WITH (MODULUS 8, REMAINDER 2);
+CREATE TABLE bot.chat_3 PARTITION OF bot.chat FOR VALUES WITH (MODULUS 8, REMAINDER 3);
+CREATE TABLE bot.chat_4 PARTITION OF bot.chat FOR VALUES WITH (MODULUS 8, REMAINDER 4);
+CREATE TABLE bot.chat_5 PARTITION OF bot.chat FOR VALUES WITH (MODULUS 8, REMAINDER 5);
+CREATE TABLE bot.chat_6 PARTITION OF bot.chat FOR VALUES WITH (MODULUS 8, REMAINDER 6);
+CREATE TABLE bot.chat_7 PARTITION OF bot.chat FOR VALUES WITH (MODULUS 8, REMAINDER 7);
@@ -0,0 +1,160 @@
+--------------------------------------------------------------------------------
+-- bot.list: update delivery mode ----------------------------------------------
+--------------------------------------------------------------------------------
+
+ALTER TABLE bot.list ADD COLUMN IF NOT EXISTS mode text NOT NULL DEFAULT 'webhook' CHECK (mode IN ('webhook', 'polling'));
+ALTER TABLE bot.list ADD COLUMN IF NOT EXISTS api_url text NOT NULL DEFAULT 'https://api.telegram.org';
+ALTER TABLE bot.list ADD COLUMN IF NOT EXISTS poll_offset bigint NOT NULL DEFAULT 0;
+ALTER TABLE bot.list ADD COLUMN IF NOT EXISTS poll_limit integer NOT NULL DEFAULT 100 CHECK (poll_limit BETWEEN 1 AND 100);
+ALTER TABLE bot.list ADD COLUMN IF NOT EXISTS poll_timeout integer NOT NULL DEFAULT 25 CHECK (poll_timeout BETWEEN 0 AND 50);
+
+--------------------------------------------------------------------------------
+-- bot.list: anti-flood --------------------------------------------------------
+--------------------------------------------------------------------------------
+
+ALTER TABLE bot.list ADD COLUMN IF NOT EXISTS flood_rate double precision NOT NULL DEFAULT 0 CHECK (flood_rate >= 0);
+ALTER TABLE bot.list ADD COLUMN IF NOT EXISTS flood_burst integer NOT NULL DEFAULT 10 CHECK (flood_burst > 0);
+ALTER TABLE bot.list ADD COLUMN IF NOT EXISTS flood_policy text NOT NULL DEFAULT 'drop' CHECK (flood_policy IN ('drop', 'collapse'));
+
+--------------------------------------------------------------------------------
+-- bot.chat: hash partitions ---------------------------------------------------
+--------------------------------------------------------------------------------
+
+DO $$
+BEGIN
+  IF (SELECT relkind FROM pg_class WHERE oid = 'bot.chat'::regclass) = 'p' THEN
+    RETURN;
+  END IF;
+
+  ALTER TABLE bot.chat RENAME TO chat_old;
+  ALTER TABLE bot.chat_old RENAME CONSTRAINT chat_pkey TO chat_old_pkey;
+
+  CREATE TABLE bot.chat (
+    bot_id        uuid NOT NULL REFERENCES bot.list ON DELETE CASCADE,
+    chat_id       bigint NOT NULL,
+    user_id       bigint NOT NULL,
+    message_id    bigint NOT NULL,
+    role          text NOT NULL,
+    content       text NOT NULL,
+    cost          numeric(12,0) DEFAULT 0 NOT NULL,
+    datetime      timestamptz NOT NULL,
+    PRIMARY KEY (bot_id, chat_id, message_id)
+  ) PARTITION BY HASH (bot_id);
+
+  CREATE INDEX ON bot.chat (bot_id, chat_id, role, message_id DESC) INCLUDE (user_id, cost, datetime);
+
+  FOR i IN 0..7
+  LOOP
+    EXECUTE format('CREATE TABLE bot.chat_%s PARTITION OF bot.chat FOR VALUES WITH (MODULUS 8, REMAINDER %s)', i, i);
+  END LOOP;
+
+  INSERT INTO bot.chat (bot_id, chat_id, user_id, message_id, role, content, cost, datetime)
+  SELECT bot_id, chat_id, user_id, message_id, role, content, cost, datetime
+    FROM bot.chat_old
+   WHERE bot_id IS NOT NULL;
+
+  DROP TABLE bot.chat_old;
+END;
+$$;
+
+--------------------------------------------------------------------------------
+-- bot.data: indexes for the polling workload ----------------------------------
+--------------------------------------------------------------------------------
+
+DROP INDEX IF EXISTS bot.data_bot_id_chat_id_user_id_category_idx;
+DROP INDEX IF EXISTS bot.data_bot_id_idx;
+DROP INDEX IF EXISTS bot.data_user_id_idx;
+DROP INDEX IF EXISTS bot.data_category_idx;
+DROP INDEX IF EXISTS bot.data_key_idx;
+
+-- Addresses are polled by the plan of bot.bbd_address
+DROP INDEX IF EXISTS bot.data_bot_id_chat_id_user_id_updated_idx;
+
+CREATE INDEX IF NOT EXISTS data_key_category_idx ON bot.data (key, category);
+
+ALTER TABLE bot.data SET (fillfactor = 90);
+
+--------------------------------------------------------------------------------
+-- bot.dispatch ----------------------------------------------------------------
+--------------------------------------------------------------------------------
+
+CREATE TABLE IF NOT EXISTS bot.dispatch (
+  bot_id        uuid PRIMARY KEY REFERENCES bot.list ON DELETE CASCADE,
+  webhook       regprocedure,
+  heartbeat     regprocedure,
+  updated       timestamptz NOT NULL DEFAULT Now()
+);
+
+ALTER TABLE bot.dispatch ADD COLUMN IF NOT EXISTS message regprocedure;
+ALTER TABLE bot.dispatch ADD COLUMN IF NOT EXISTS callback_query regprocedure;
+ALTER TABLE bot.dispatch ADD COLUMN IF NOT EXISTS inline_query regprocedure;
+ALTER TABLE bot.dispatch ADD COLUMN IF NOT EXISTS my_chat_member regprocedure;
+
+--------------------------------------------------------------------------------
+-- TYPED UPDATES ---------------------------------------------------------------
+--------------------------------------------------------------------------------
+
+DO $$
+BEGIN
+  IF to_regtype('bot.tg_message') IS NULL THEN
+    CREATE TYPE bot.tg_message AS (
+      update_id       bigint,
+      message_id      bigint,
+      date            double precision,
+      chat_id         bigint,
+      chat_type       text,
+      chat_username   text,
+      user_id         bigint,
+      username        text,
+      language_code   text,
+      text            text,
+      caption         text,
+      file_id         text,
+      file_unique_id  text,
+      file_name       text,
+      file_size       bigint,
+      mime_type       text
+    );
+  END IF;
+
+  IF to_regtype('bot.tg_callback_query') IS NULL THEN
+    CREATE TYPE bot.tg_callback_query AS (
+      update_id       bigint,
+      id              text,
+      data            text,
+      user_id         bigint,
+      username        text,
+      language_code   text,
+      chat_id         bigint,
+      message_id      bigint,
+      message_text    text
+    );
+  END IF;
+
+  IF to_regtype('bot.tg_inline_query') IS NULL THEN
+    CREATE TYPE bot.tg_inline_query AS (
+      update_id       bigint,
+      id              text,
+      query           text,
+      "offset"        text,
+      user_id         bigint,
+      username        text,
+      language_code   text
+    );
+  END IF;
+
+  IF to_regtype('bot.tg_my_chat_member') IS NULL THEN
+    CREATE TYPE bot.tg_my_chat_member AS (
+      update_id       bigint,
+      date            double precision,
+      chat_id         bigint,
+      chat_type       text,
+      user_id         bigint,
+      username        text,
+      language_code   text,
+      old_status      text,
+      new_status      text
+    );
+  END IF;
+END;
+$$;
@@ -0,0 +1,124 @@
+/*++
+
+Program name:
+
+  tgpg
+
+Module Name:
+
+  BotRegistry.cpp
+
+Notices:
+
+  Telegram bot registry (in-memory copy of bot.list)
+
+Author:
+
+  Copyright (c) Prepodobny Alen
+
+  mailto: alienufo@inbox.ru
+  mailto: ufocomp@gmail.com
+
+--*/
+
+#include "Core.hpp"
+#include "BotRegistry.hpp"
+//----------------------------------------------------------------------------------------------------------------------
+
+extern "C++" {
+
+namespace Apostol {
+
+    namespace Telegram {
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        //-- CBotRegistry ----------------------------------------------------------------------------------------------
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        CString CBotRegistry::SQL(const CString &Id) {
+            if (Id.IsEmpty())
+                return "SELECT id, username, language_code, secret, mode, poll_timeout, flood_rate, flood_burst, flood_policy, webhook, heartbeat, webhook_name, heartbeat_name, message_name, message_body, callback_query_name, callback_query_body, inline_query_name, inline_query_body, my_chat_member_name, my_chat_member_body FROM bot.registry();";
+
+            return CString().Format("SELECT id, username, language_code, secret, mode, poll_timeout, flood_rate, flood_burst, flood_policy, webhook, heartbeat, webhook_name, heartbeat_name, message_name, message_body, callback_query_name, callback_query_body, inline_query_name, inline_query_body, my_chat_member_name, my_chat_member_body FROM bot.registry(%s::uuid);",
+                                    PQQuoteLiteral(Id).c_str());
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CBotRegistry::Fetch(CPQResult *AResult, int Row, CBotInfo &Info) {
+            Info.Id = AResult->GetValue(Row, 0);
+            Info.Username = AResult->GetValue(Row, 1);
+            Info.LanguageCode = AResult->GetValue(Row, 2);
+            Info.Secret = AResult->GetIsNull(Row, 3) ? CString() : CString(AResult->GetValue(Row, 3));
+            Info.Mode = AResult->GetValue(Row, 4);
+            Info.PollTimeout = StrToIntDef(AResult->GetValue(Row, 5), 25);
+            Info.FloodRate = strtod(AResult->GetValue(Row, 6), nullptr);
+            Info.FloodBurst = StrToIntDef(AResult->GetValue(Row, 7), 10);
+            Info.FloodPolicy = AResult->GetValue(Row, 8);
+            Info.WebhookOid = AResult->GetIsNull(Row, 9) ? 0 : strtoul(AResult->GetValue(Row, 9), nullptr, 10);
+            Info.HeartbeatOid = AResult->GetIsNull(Row, 10) ? 0 : strtoul(AResult->GetValue(Row, 10), nullptr, 10);
+            Info.Webhook = AResult->GetIsNull(Row, 11) ? CString() : CString(AResult->GetValue(Row, 11));
+            Info.Heartbeat = AResult->GetIsNull(Row, 12) ? CString() : CString(AResult->GetValue(Row, 12));
+
+            for (int i = 0; i < UPDATE_TYPE_COUNT; ++i) {
+                const auto column = 13 + i * 2;
+                Info.Updates[i].Name = AResult->GetIsNull(Row, column) ? CString() : CString(AResult->GetValue(Row, column));
+                Info.Updates[i].Body = CompareString(AResult->GetValue(Row, column + 1), "t") == 0;
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        bool CBotRegistry::Load(CPQResult *AResult, size_t Generation) {
+            // The rows changed by Update() or Delete() after the query was sent are newer than the result
+            if (Generation != m_Generation)
+                return false;
+
+            std::map<std::string, CBotInfo> Bots;
+
+            for (int row = 0; row < AResult->nTuples(); ++row) {
+                CBotInfo Info;
+                Fetch(AResult, row, Info);
+                Bots[Info.Id.c_str()] = Info;
+            }
+
+            m_Bots.swap(Bots);
+            m_Loaded = true;
+
+            return true;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CBotRegistry::Update(const CString &Id, CPQResult *AResult) {
+            if (AResult->nTuples() == 0) {
+                Delete(Id);
+                return;
+            }
+
+            CBotInfo Info;
+            Fetch(AResult, 0, Info);
+            m_Bots[Info.Id.c_str()] = Info;
+            m_Generation++;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CBotRegistry::Delete(const CString &Id) {
+            m_Bots.erase(Id.c_str());
+            m_Generation++;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CBotRegistry::Clear() {
+            m_Bots.clear();
+            m_Loaded = false;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        const CBotInfo *CBotRegistry::Find(const CString &Id) const {
+            const auto it = m_Bots.find(Id.c_str());
+            return it == m_Bots.end() ? nullptr : &it->second;
+        }
+    }
+}
+
+}
@@ -0,0 +1,127 @@
+/*++
+
+Program name:
+
+  tgpg
+
+Module Name:
+
+  BotRegistry.hpp
+
+Notices:
+
+  Telegram bot registry (in-memory copy of bot.list)
+
+Author:
+
+  Copyright (c) Prepodobny Alen
+
+  mailto: alienufo@inbox.ru
+  mailto: ufocomp@gmail.com
+
+--*/
+
+#ifndef APOSTOL_TELEGRAM_BOT_REGISTRY_HPP
+#define APOSTOL_TELEGRAM_BOT_REGISTRY_HPP
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "TelegramUpdate.hpp"
+//----------------------------------------------------------------------------------------------------------------------
+
+#define PG_LISTEN_BOT_LIST "bot_list"
+//----------------------------------------------------------------------------------------------------------------------
+
+extern "C++" {
+
+namespace Apostol {
+
+    namespace Telegram {
+
+        struct CBotUpdateHandler {
+            CString Name;
+            bool Body = false;
+        };
+        //--------------------------------------------------------------------------------------------------------------
+
+        struct CBotInfo {
+            CString Id;
+            CString Username;
+            CString LanguageCode;
+            CString Secret;
+            CString Mode;
+
+            int PollTimeout = 25;
+
+            double FloodRate = 0;
+            int FloodBurst = 10;
+            CString FloodPolicy;
+
+            unsigned int WebhookOid = 0;
+            unsigned int HeartbeatOid = 0;
+
+            CString Webhook;
+            CString Heartbeat;
+
+            // Typed handlers by CUpdateType: bot.<username>_message(uuid, bot.tg_message [, jsonb]) and so on
+            CBotUpdateHandler Updates[UPDATE_TYPE_COUNT];
+
+            bool Polling() const { return Mode == "polling"; };
+            bool Collapse() const { return FloodPolicy == "collapse"; };
+        };
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        //-- CBotRegistry ----------------------------------------------------------------------------------------------
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        class CBotRegistry {
+        private:
+
+            std::map<std::string, CBotInfo> m_Bots;
+
+            bool m_Loaded;
+
+            size_t m_Generation;
+
+            static void Fetch(CPQResult *AResult, int Row, CBotInfo &Info);
+
+        public:
+
+            CBotRegistry(): m_Loaded(false), m_Generation(0) {
+
+            };
+
+            ~CBotRegistry() = default;
+
+            static CString SQL(const CString &Id = CString());
+
+            bool Load(CPQResult *AResult, size_t Generation);
+            void Update(const CString &Id, CPQResult *AResult);
+
+            void Delete(const CString &Id);
+
+            void Clear();
+
+            const CBotInfo *Find(const CString &Id) const;
+
+            bool Loaded() const { return m_Loaded; };
+
+            size_t Generation() const { return m_Generation; };
+
+            size_t Count() const { return m_Bots.size(); };
+
+            const std::map<std::string, CBotInfo> &Bots() const { return m_Bots; };
+
+        };
+
+    }
+}
+
+using namespace Apostol::Telegram;
+}
+#endif //APOSTOL_TELEGRAM_BOT_REGISTRY_HPP
@@ -0,0 +1,160 @@
+/*++
+
+Program name:
+
+  tgpg
+
+Module Name:
+
+  FloodLimiter.cpp
+
+Notices:
+
+  Inbound anti-flood limiter
+
+Author:
+
+  Copyright (c) Prepodobny Alen
+
+  mailto: alienufo@inbox.ru
+  mailto: ufocomp@gmail.com
+
+--*/
+
+#include "Core.hpp"
+#include "FloodLimiter.hpp"
+//----------------------------------------------------------------------------------------------------------------------
+
+#define FLOOD_LIMITER_MIN_CAPACITY 1024
+//----------------------------------------------------------------------------------------------------------------------
+
+extern "C++" {
+
+namespace Apostol {
+
+    namespace Telegram {
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        //-- CFloodLimiter ---------------------------------------------------------------------------------------------
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        CFloodLimiter::CFloodLimiter() {
+            m_Count = 0;
+            m_Dropped = 0;
+            m_Table.resize(FLOOD_LIMITER_MIN_CAPACITY);
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        size_t CFloodLimiter::Hash(uint64_t Bot, int64_t User) {
+            uint64_t x = Bot ^ ((uint64_t) User * 0x9e3779b97f4a7c15ULL);
+            x ^= x >> 33;
+            x *= 0xff51afd7ed558ccdULL;
+            x ^= x >> 33;
+            return (size_t) x;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        size_t CFloodLimiter::Lookup(uint64_t Bot, int64_t User) const {
+            const auto mask = m_Table.size() - 1;
+            auto i = Hash(Bot, User) & mask;
+
+            while (m_Table[i].Used && (m_Table[i].Bot != Bot || m_Table[i].User != User))
+                i = (i + 1) & mask;
+
+            return i;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CFloodLimiter::Rehash(size_t Capacity) {
+            std::vector<CEntry> Table(Capacity);
+            Table.swap(m_Table);
+
+            for (const auto &Entry : Table) {
+                if (Entry.Used)
+                    m_Table[Lookup(Entry.Bot, Entry.User)] = Entry;
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CFloodLimiter::Refill(CEntry &Entry, CDateTime Now) {
+            if (Now > Entry.Stamp) {
+                Entry.Tokens += (Now - Entry.Stamp) * SecsPerDay * Entry.Rate;
+                if (Entry.Tokens > Entry.Burst)
+                    Entry.Tokens = Entry.Burst;
+                Entry.Stamp = Now;
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        bool CFloodLimiter::Consume(uint64_t Bot, int64_t User, double Rate, double Burst, CDateTime Now) {
+            // Rate is set in updates per minute, zero disables the limit
+            if (Rate <= 0 || Burst < 1)
+                return true;
+
+            auto i = Lookup(Bot, User);
+            auto &Entry = m_Table[i];
+
+            if (!Entry.Used) {
+                Entry.Used = true;
+                Entry.Bot = Bot;
+                Entry.User = User;
+                Entry.Tokens = Burst;
+                Entry.Stamp = Now;
+                m_Count++;
+            }
+
+            // The policy of the bot could be changed
+            Entry.Rate = Rate / 60;
+            Entry.Burst = Burst;
+
+            Refill(Entry, Now);
+
+            bool Result = Entry.Tokens >= 1;
+
+            if (Result)
+                Entry.Tokens -= 1;
+
+            if (m_Count * 10 > m_Table.size() * 7)
+                Rehash(m_Table.size() * 2);
+
+            return Result;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CFloodLimiter::Evict(CDateTime Now) {
+            size_t count = 0;
+
+            for (auto &Entry : m_Table) {
+                if (!Entry.Used)
+                    continue;
+
+                Refill(Entry, Now);
+
+                if (Entry.Tokens >= Entry.Burst) {
+                    Entry.Used = false;
+                } else {
+                    count++;
+                }
+            }
+
+            m_Count = count;
+
+            // Reinserting restores probe chains broken by the removed entries
+            size_t capacity = FLOOD_LIMITER_MIN_CAPACITY;
+            while (m_Count * 10 > capacity * 4)
+                capacity *= 2;
+
+            Rehash(capacity);
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CFloodLimiter::Clear() {
+            m_Table.assign(FLOOD_LIMITER_MIN_CAPACITY, CEntry());
+            m_Count = 0;
+        }
+    }
+}
+
+}
@@ -0,0 +1,101 @@
+/*++
+
+Program name:
+
+  tgpg
+
+Module Name:
+
+  FloodLimiter.hpp
+
+Notices:
+
+  Inbound anti-flood limiter
+
+Author:
+
+  Copyright (c) Prepodobny Alen
+
+  mailto: alienufo@inbox.ru
+  mailto: ufocomp@gmail.com
+
+--*/
+
+#ifndef APOSTOL_TELEGRAM_FLOOD_LIMITER_HPP
+#define APOSTOL_TELEGRAM_FLOOD_LIMITER_HPP
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+//----------------------------------------------------------------------------------------------------------------------
+
+extern "C++" {
+
+namespace Apostol {
+
+    namespace Telegram {
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        //-- CFloodLimiter ---------------------------------------------------------------------------------------------
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        /**
+         * Token buckets keyed by (bot, user) in an open-addressing hash table with linear probing.
+         * Buckets that have been refilled completely carry no state and are evicted by Evict().
+         * The buckets belong to one worker process: with N workers a user gets up to N times the rate.
+         */
+        class CFloodLimiter {
+        private:
+
+            struct CEntry {
+                uint64_t Bot = 0;
+                int64_t User = 0;
+                double Tokens = 0;
+                double Rate = 0;
+                double Burst = 0;
+                CDateTime Stamp = 0;
+                bool Used = false;
+            };
+
+            std::vector<CEntry> m_Table;
+
+            size_t m_Count;
+            size_t m_Dropped;
+
+            static size_t Hash(uint64_t Bot, int64_t User);
+
+            size_t Lookup(uint64_t Bot, int64_t User) const;
+
+            void Rehash(size_t Capacity);
+
+            static void Refill(CEntry &Entry, CDateTime Now);
+
+        public:
+
+            CFloodLimiter();
+
+            ~CFloodLimiter() = default;
+
+            bool Consume(uint64_t Bot, int64_t User, double Rate, double Burst, CDateTime Now);
+
+            void Evict(CDateTime Now);
+
+            void Clear();
+
+            void Drop() { m_Dropped++; };
+
+            size_t Count() const { return m_Count; };
+            size_t Capacity() const { return m_Table.size(); };
+            size_t Dropped() const { return m_Dropped; };
+
+        };
+
+    }
+}
+
+using namespace Apostol::Telegram;
+}
+#endif //APOSTOL_TELEGRAM_FLOOD_LIMITER_HPP
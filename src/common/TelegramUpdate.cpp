@@ -0,0 +1,512 @@
+/*++
+
+Program name:
+
+  tgpg
+
+Module Name:
+
+  TelegramUpdate.cpp
+
+Notices:
+
+  Telegram update decoding (typed handlers)
+
+Author:
+
+  Copyright (c) Prepodobny Alen
+
+  mailto: alienufo@inbox.ru
+  mailto: ufocomp@gmail.com
+
+--*/
+
+#include "Core.hpp"
+#include "TelegramUpdate.hpp"
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <cstdlib>
+#include <cstring>
+//----------------------------------------------------------------------------------------------------------------------
+
+#define UPDATE_MAX_DEPTH 8
+//----------------------------------------------------------------------------------------------------------------------
+
+extern "C++" {
+
+namespace Apostol {
+
+    namespace Telegram {
+
+        // Columns of the composite types after update_id (see db/sql/bot/table.sql)
+
+        static const char *const MessageFields[] = {
+            "message_id", "date", "chat.id", "chat.type", "chat.username", "from.id", "from.username", "from.language_code",
+            "text", "caption", "document.file_id", "document.file_unique_id", "document.file_name", "document.file_size",
+            "document.mime_type", nullptr
+        };
+
+        static const char *const CallbackQueryFields[] = {
+            "id", "data", "from.id", "from.username", "from.language_code", "message.chat.id", "message.message_id",
+            "message.text", nullptr
+        };
+
+        static const char *const InlineQueryFields[] = {
+            "id", "query", "offset", "from.id", "from.username", "from.language_code", nullptr
+        };
+
+        static const char *const MyChatMemberFields[] = {
+            "date", "chat.id", "chat.type", "from.id", "from.username", "from.language_code", "old_chat_member.status",
+            "new_chat_member.status", nullptr
+        };
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        //-- CTelegramUpdate -------------------------------------------------------------------------------------------
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        CTelegramUpdate::CTelegramUpdate() {
+            m_Data = nullptr;
+            m_End = nullptr;
+            m_Pos = nullptr;
+            m_Fields = nullptr;
+
+            Clear();
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTelegramUpdate::Clear() {
+            m_Type = utUnknown;
+            m_UpdateId = -1;
+            m_ChatId = 0;
+            m_UserId = 0;
+            m_ObjectOffset = 0;
+            m_ObjectLength = 0;
+            m_Fields = nullptr;
+            m_Values.clear();
+            m_Path.clear();
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        const char *CTelegramUpdate::TypeName(CUpdateType Type) {
+            switch (Type) {
+                case utMessage:
+                    return "message";
+                case utCallbackQuery:
+                    return "callback_query";
+                case utInlineQuery:
+                    return "inline_query";
+                case utMyChatMember:
+                    return "my_chat_member";
+                default:
+                    return nullptr;
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        const char *const *CTelegramUpdate::TypeFields(CUpdateType Type) {
+            switch (Type) {
+                case utMessage:
+                    return MessageFields;
+                case utCallbackQuery:
+                    return CallbackQueryFields;
+                case utInlineQuery:
+                    return InlineQueryFields;
+                case utMyChatMember:
+                    return MyChatMemberFields;
+                default:
+                    return nullptr;
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTelegramUpdate::SkipSpace() {
+            while (m_Pos < m_End && (*m_Pos == ' ' || *m_Pos == '\t' || *m_Pos == '\r' || *m_Pos == '\n'))
+                m_Pos++;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        bool CTelegramUpdate::SkipString() {
+            m_Pos++;
+
+            while (m_Pos < m_End) {
+                const char *p = (const char *) memchr(m_Pos, '"', m_End - m_Pos);
+                if (p == nullptr)
+                    return false;
+
+                // The quote is escaped if it follows an odd number of backslashes
+                size_t count = 0;
+                while (p - count > m_Pos && p[-(ptrdiff_t) count - 1] == '\\')
+                    count++;
+
+                m_Pos = p + 1;
+                if (count % 2 == 0)
+                    return true;
+            }
+
+            return false;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        bool CTelegramUpdate::Skip() {
+            if (m_Pos >= m_End)
+                return false;
+
+            if (*m_Pos == '"')
+                return SkipString();
+
+            if (*m_Pos == '{' || *m_Pos == '[') {
+                size_t depth = 0;
+
+                while (m_Pos < m_End) {
+                    switch (*m_Pos) {
+                        case '"':
+                            if (!SkipString())
+                                return false;
+                            continue;
+                        case '{':
+                        case '[':
+                            depth++;
+                            break;
+                        case '}':
+                        case ']':
+                            if (--depth == 0) {
+                                m_Pos++;
+                                return true;
+                            }
+                            break;
+                        default:
+                            break;
+                    }
+                    m_Pos++;
+                }
+
+                return false;
+            }
+
+            const char *start = m_Pos;
+            while (m_Pos < m_End && strchr(",}] \t\r\n", *m_Pos) == nullptr)
+                m_Pos++;
+
+            return m_Pos > start;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        bool CTelegramUpdate::ReadString(std::string &Value) {
+            if (m_Pos >= m_End || *m_Pos != '"')
+                return false;
+
+            m_Pos++;
+            Value.clear();
+
+            while (m_Pos < m_End) {
+                const char *start = m_Pos;
+                while (m_Pos < m_End && *m_Pos != '"' && *m_Pos != '\\')
+                    m_Pos++;
+
+                Value.append(start, m_Pos - start);
+
+                if (m_Pos >= m_End)
+                    return false;
+
+                if (*m_Pos == '"') {
+                    m_Pos++;
+                    return true;
+                }
+
+                if (++m_Pos >= m_End)
+                    return false;
+
+                switch (*m_Pos++) {
+                    case '"': Value += '"'; break;
+                    case '\\': Value += '\\'; break;
+                    case '/': Value += '/'; break;
+                    case 'b': Value += '\b'; break;
+                    case 'f': Value += '\f'; break;
+                    case 'n': Value += '\n'; break;
+                    case 'r': Value += '\r'; break;
+                    case 't': Value += '\t'; break;
+                    case 'u': {
+                        auto hex = [this](uint32_t &Code) {
+                            if (m_End - m_Pos < 4)
+                                return false;
+                            char buffer[5] = {m_Pos[0], m_Pos[1], m_Pos[2], m_Pos[3], 0};
+                            char *end = nullptr;
+                            Code = (uint32_t) strtoul(buffer, &end, 16);
+                            m_Pos += 4;
+                            return end == buffer + 4;
+                        };
+
+                        uint32_t code;
+                        if (!hex(code))
+                            return false;
+
+                        // Surrogate pair: Telegram escapes emoji this way. The escape after a high surrogate is
+                        // consumed only if it is the low one; an unpaired surrogate is not valid UTF-8 (PostgreSQL
+                        // rejects it), it is replaced with U+FFFD
+                        if (code >= 0xD800 && code <= 0xDBFF) {
+                            const char *next = m_Pos;
+                            uint32_t low = 0;
+
+                            if (m_End - m_Pos >= 6 && m_Pos[0] == '\\' && m_Pos[1] == 'u') {
+                                m_Pos += 2;
+                                if (!hex(low))
+                                    return false;
+                            }
+
+                            if (low >= 0xDC00 && low <= 0xDFFF) {
+                                code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                            } else {
+                                m_Pos = next;
+                                code = 0xFFFD;
+                            }
+                        } else if (code >= 0xDC00 && code <= 0xDFFF) {
+                            code = 0xFFFD;
+                        }
+
+                        // PostgreSQL text cannot hold NUL
+                        if (code == 0) {
+                            break;
+                        } else if (code < 0x80) {
+                            Value += (char) code;
+                        } else if (code < 0x800) {
+                            Value += (char) (0xC0 | (code >> 6));
+                            Value += (char) (0x80 | (code & 0x3F));
+                        } else if (code < 0x10000) {
+                            Value += (char) (0xE0 | (code >> 12));
+                            Value += (char) (0x80 | ((code >> 6) & 0x3F));
+                            Value += (char) (0x80 | (code & 0x3F));
+                        } else {
+                            Value += (char) (0xF0 | (code >> 18));
+                            Value += (char) (0x80 | ((code >> 12) & 0x3F));
+                            Value += (char) (0x80 | ((code >> 6) & 0x3F));
+                            Value += (char) (0x80 | (code & 0x3F));
+                        }
+                        break;
+                    }
+                    default:
+                        return false;
+                }
+            }
+
+            return false;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        bool CTelegramUpdate::ReadScalar(CUpdateValue &Value) {
+            if (m_Pos >= m_End)
+                return false;
+
+            if (*m_Pos == '"') {
+                Value.Null = false;
+                return ReadString(Value.Value);
+            }
+
+            if (m_End - m_Pos >= 4 && memcmp(m_Pos, "null", 4) == 0) {
+                m_Pos += 4;
+                Value.Null = true;
+                Value.Value.clear();
+                return true;
+            }
+
+            const char *start = m_Pos;
+            while (m_Pos < m_End && strchr("-+.0123456789eEtrufals", *m_Pos) != nullptr)
+                m_Pos++;
+
+            if (m_Pos == start)
+                return false;
+
+            Value.Null = false;
+            Value.Value.assign(start, m_Pos - start);
+
+            return true;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        int CTelegramUpdate::FindField(const std::string &Path) const {
+            for (int i = 0; m_Fields[i] != nullptr; ++i) {
+                if (Path == m_Fields[i])
+                    return i;
+            }
+            return -1;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        bool CTelegramUpdate::IsPrefix(const std::string &Path) const {
+            for (int i = 0; m_Fields[i] != nullptr; ++i) {
+                if (strncmp(m_Fields[i], Path.c_str(), Path.size()) == 0 && m_Fields[i][Path.size()] == '.')
+                    return true;
+            }
+            return false;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        bool CTelegramUpdate::ParseObject(size_t Depth) {
+            std::string key;
+
+            m_Pos++;
+
+            SkipSpace();
+            if (m_Pos < m_End && *m_Pos == '}') {
+                m_Pos++;
+                return true;
+            }
+
+            while (m_Pos < m_End) {
+                SkipSpace();
+                if (!ReadString(key))
+                    return false;
+
+                SkipSpace();
+                if (m_Pos >= m_End || *m_Pos != ':')
+                    return false;
+                m_Pos++;
+                SkipSpace();
+
+                if (m_Pos >= m_End)
+                    return false;
+
+                const auto length = m_Path.size();
+
+                if (length != 0)
+                    m_Path += '.';
+                m_Path += key;
+
+                bool result;
+
+                if (*m_Pos == '{') {
+                    result = Depth < UPDATE_MAX_DEPTH && IsPrefix(m_Path) ? ParseObject(Depth + 1) : Skip();
+                } else if (*m_Pos == '[') {
+                    result = Skip();
+                } else {
+                    const auto index = FindField(m_Path);
+                    result = index >= 0 ? ReadScalar(m_Values[index]) : Skip();
+                }
+
+                m_Path.resize(length);
+
+                if (!result)
+                    return false;
+
+                SkipSpace();
+                if (m_Pos >= m_End)
+                    return false;
+
+                if (*m_Pos == '}') {
+                    m_Pos++;
+                    return true;
+                }
+
+                if (*m_Pos != ',')
+                    return false;
+
+                m_Pos++;
+            }
+
+            return false;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        int64_t CTelegramUpdate::ToInteger(const CUpdateValue &Value) {
+            return Value.Null ? 0 : strtoll(Value.Value.c_str(), nullptr, 10);
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        bool CTelegramUpdate::Parse(const char *Data, size_t Size) {
+            Clear();
+
+            if (Data == nullptr)
+                return false;
+
+            m_Data = Data;
+            m_End = Data + Size;
+            m_Pos = Data;
+
+            SkipSpace();
+            if (m_Pos >= m_End || *m_Pos != '{')
+                return false;
+            m_Pos++;
+
+            std::string key;
+
+            while (m_Pos < m_End) {
+                SkipSpace();
+                if (!ReadString(key))
+                    break;
+
+                SkipSpace();
+                if (m_Pos >= m_End || *m_Pos != ':')
+                    break;
+                m_Pos++;
+                SkipSpace();
+
+                bool result;
+
+                if (key == "update_id") {
+                    CUpdateValue value;
+                    result = ReadScalar(value);
+                    m_UpdateId = value.Null ? -1 : ToInteger(value);
+                } else if (m_Type == utUnknown && m_Pos < m_End && *m_Pos == '{') {
+                    auto type = utUnknown;
+                    for (int i = 0; i < UPDATE_TYPE_COUNT; ++i) {
+                        if (key == TypeName((CUpdateType) i)) {
+                            type = (CUpdateType) i;
+                            break;
+                        }
+                    }
+
+                    if (type == utUnknown) {
+                        result = Skip();
+                    } else {
+                        m_Type = type;
+                        m_Fields = TypeFields(type);
+
+                        size_t count = 0;
+                        while (m_Fields[count] != nullptr)
+                            count++;
+                        m_Values.resize(count);
+
+                        m_ObjectOffset = m_Pos - m_Data;
+                        result = ParseObject(1);
+                        m_ObjectLength = (m_Pos - m_Data) - m_ObjectOffset;
+                    }
+                } else {
+                    result = Skip();
+                }
+
+                if (!result)
+                    break;
+
+                SkipSpace();
+                if (m_Pos < m_End && *m_Pos == '}') {
+                    m_Pos++;
+
+                    if (m_Type != utUnknown) {
+                        const auto chat = FindField(m_Type == utCallbackQuery ? "message.chat.id" : "chat.id");
+                        const auto from = FindField("from.id");
+
+                        m_UserId = from < 0 ? 0 : ToInteger(m_Values[from]);
+                        // Updates without a chat (inline queries) are ordered by the user
+                        m_ChatId = chat < 0 || m_Values[chat].Null ? m_UserId : ToInteger(m_Values[chat]);
+                    }
+
+                    return true;
+                }
+
+                if (m_Pos >= m_End || *m_Pos != ',')
+                    break;
+                m_Pos++;
+            }
+
+            // Malformed update: it is left to the generic handler
+            const auto updateId = m_UpdateId;
+            Clear();
+            m_UpdateId = updateId;
+
+            return false;
+        }
+    }
+}
+
+}
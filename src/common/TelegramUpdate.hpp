@@ -0,0 +1,129 @@
+/*++
+
+Program name:
+
+  tgpg
+
+Module Name:
+
+  TelegramUpdate.hpp
+
+Notices:
+
+  Telegram update decoding (typed handlers)
+
+Author:
+
+  Copyright (c) Prepodobny Alen
+
+  mailto: alienufo@inbox.ru
+  mailto: ufocomp@gmail.com
+
+--*/
+
+#ifndef APOSTOL_TELEGRAM_UPDATE_HPP
+#define APOSTOL_TELEGRAM_UPDATE_HPP
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+//----------------------------------------------------------------------------------------------------------------------
+
+#define UPDATE_TYPE_COUNT 4
+//----------------------------------------------------------------------------------------------------------------------
+
+extern "C++" {
+
+namespace Apostol {
+
+    namespace Telegram {
+
+        // The order matches the typed handlers of bot.registry()
+        enum CUpdateType { utMessage = 0, utCallbackQuery, utInlineQuery, utMyChatMember, utUnknown };
+        //--------------------------------------------------------------------------------------------------------------
+
+        struct CUpdateValue {
+            bool Null = true;
+            std::string Value;
+        };
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        //-- CTelegramUpdate -------------------------------------------------------------------------------------------
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        /**
+         * Decodes a Telegram update in one pass: the update type is found by its top-level key and the fields of the
+         * typed handler are collected in the column order of the composite type (bot.tg_message and so on).
+         * The rest of the document is skipped without being materialized.
+         */
+        class CTelegramUpdate {
+        private:
+
+            CUpdateType m_Type;
+
+            int64_t m_UpdateId;
+            int64_t m_ChatId;
+            int64_t m_UserId;
+
+            size_t m_ObjectOffset;
+            size_t m_ObjectLength;
+
+            std::vector<CUpdateValue> m_Values;
+
+            const char *m_Data;
+            const char *m_End;
+            const char *m_Pos;
+
+            std::string m_Path;
+
+            const char *const *m_Fields;
+
+            void Clear();
+
+            void SkipSpace();
+
+            bool Skip();
+            bool SkipString();
+
+            bool ReadString(std::string &Value);
+            bool ReadScalar(CUpdateValue &Value);
+
+            bool ParseObject(size_t Depth);
+
+            int FindField(const std::string &Path) const;
+            bool IsPrefix(const std::string &Path) const;
+
+            static int64_t ToInteger(const CUpdateValue &Value);
+
+        public:
+
+            CTelegramUpdate();
+
+            bool Parse(const char *Data, size_t Size);
+
+            CUpdateType Type() const { return m_Type; };
+
+            int64_t UpdateId() const { return m_UpdateId; };
+            int64_t ChatId() const { return m_ChatId; };
+            int64_t UserId() const { return m_UserId; };
+
+            size_t ObjectOffset() const { return m_ObjectOffset; };
+            size_t ObjectLength() const { return m_ObjectLength; };
+
+            const std::vector<CUpdateValue> &Values() const { return m_Values; };
+
+            static const char *TypeName(CUpdateType Type);
+            static const char *const *TypeFields(CUpdateType Type);
+
+        };
+
+    }
+}
+
+using namespace Apostol::Telegram;
+}
+#endif //APOSTOL_TELEGRAM_UPDATE_HPP
@@ -0,0 +1,250 @@
+/*++
+
+Program name:
+
+  tgpg
+
+Module Name:
+
+  UpdateFilter.cpp
+
+Notices:
+
+  Telegram update_id de-duplication
+
+Author:
+
+  Copyright (c) Prepodobny Alen
+
+  mailto: alienufo@inbox.ru
+  mailto: ufocomp@gmail.com
+
+--*/
+
+#include "Core.hpp"
+#include "UpdateFilter.hpp"
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <cstring>
+//----------------------------------------------------------------------------------------------------------------------
+
+extern "C++" {
+
+namespace Apostol {
+
+    namespace Telegram {
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        //-- CUpdateWindow ---------------------------------------------------------------------------------------------
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        CUpdateWindow::CUpdateWindow() {
+            m_High = -1;
+            memset(m_Bits, 0, sizeof(m_Bits));
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CUpdateWindow::Reset(int64_t UpdateId) {
+            memset(m_Bits, 0, sizeof(m_Bits));
+            m_High = UpdateId;
+            Set(0);
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CUpdateWindow::Shift(int64_t Count) {
+            const auto words = (size_t) (Count / 64);
+            const auto bits = (unsigned) (Count % 64);
+
+            for (size_t i = UPDATE_WINDOW_WORDS; i-- > 0;) {
+                uint64_t value = 0;
+
+                if (i >= words) {
+                    const auto from = i - words;
+                    value = m_Bits[from] << bits;
+                    if (bits != 0 && from > 0)
+                        value |= m_Bits[from - 1] >> (64 - bits);
+                }
+
+                m_Bits[i] = value;
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        bool CUpdateWindow::Test(int64_t Offset) const {
+            return (m_Bits[Offset / 64] & ((uint64_t) 1 << (Offset % 64))) != 0;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CUpdateWindow::Set(int64_t Offset) {
+            m_Bits[Offset / 64] |= (uint64_t) 1 << (Offset % 64);
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        bool CUpdateWindow::Add(int64_t UpdateId) {
+            if (m_High < 0) {
+                Reset(UpdateId);
+                return true;
+            }
+
+            if (UpdateId > m_High) {
+                const auto count = UpdateId - m_High;
+
+                if (count >= UPDATE_WINDOW_SIZE) {
+                    Reset(UpdateId);
+                } else {
+                    Shift(count);
+                    m_High = UpdateId;
+                    Set(0);
+                }
+
+                return true;
+            }
+
+            const auto offset = m_High - UpdateId;
+
+            // Far behind the window: update_id sequence was restarted by Telegram
+            if (offset >= UPDATE_WINDOW_SIZE) {
+                Reset(UpdateId);
+                return true;
+            }
+
+            if (Test(offset))
+                return false;
+
+            Set(offset);
+            return true;
+        }
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        //-- CUpdateFilter ---------------------------------------------------------------------------------------------
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        bool CUpdateFilter::Check(const std::string &BotId, int64_t UpdateId) {
+            if (UpdateId < 0)
+                return true;
+
+            if (m_Windows[BotId].Add(UpdateId))
+                return true;
+
+            m_Dropped++;
+            return false;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        const char *CUpdateFilter::FindKey(const char *Body, const char *End, const char *Key, size_t Length) {
+            const char *p = Body;
+
+            while (p + Length <= End) {
+                p = (const char *) memchr(p, '"', End - p);
+                if (p == nullptr || p + Length > End)
+                    return nullptr;
+
+                // Skip escaped quotes inside string values
+                if (memcmp(p, Key, Length) == 0 && (p == Body || p[-1] != '\\'))
+                    return p + Length;
+
+                p++;
+            }
+
+            return nullptr;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        bool CUpdateFilter::ParseNumber(const char *Body, const char *End, int64_t &Value) {
+            const char *p = Body;
+
+            while (p < End && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n' || *p == ':'))
+                p++;
+
+            const bool negative = p < End && *p == '-';
+            if (negative)
+                p++;
+
+            const char *digits = p;
+            int64_t value = 0;
+
+            while (p < End && *p >= '0' && *p <= '9') {
+                value = value * 10 + (*p - '0');
+                p++;
+            }
+
+            if (p == digits)
+                return false;
+
+            Value = negative ? -value : value;
+            return true;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        int64_t CUpdateFilter::UpdateId(const char *Body, size_t Size) {
+            static const char key[] = "\"update_id\"";
+
+            if (Body == nullptr)
+                return -1;
+
+            const char *end = Body + Size;
+            const char *p = FindKey(Body, end, key, sizeof(key) - 1);
+
+            int64_t value;
+            if (p == nullptr || !ParseNumber(p, end, value))
+                return -1;
+
+            return value;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        int64_t CUpdateFilter::ChatId(const char *Body, size_t Size) {
+            static const char chat[] = "\"chat\"";
+            static const char from[] = "\"from\"";
+            static const char id[] = "\"id\"";
+
+            if (Body == nullptr)
+                return 0;
+
+            const char *end = Body + Size;
+
+            // Updates without a chat (inline queries and so on) are ordered by the user
+            const char *p = FindKey(Body, end, chat, sizeof(chat) - 1);
+            if (p == nullptr)
+                p = FindKey(Body, end, from, sizeof(from) - 1);
+            if (p == nullptr)
+                return 0;
+
+            p = FindKey(p, end, id, sizeof(id) - 1);
+
+            int64_t value;
+            if (p == nullptr || !ParseNumber(p, end, value))
+                return 0;
+
+            return value;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        int64_t CUpdateFilter::UserId(const char *Body, size_t Size) {
+            static const char from[] = "\"from\"";
+            static const char id[] = "\"id\"";
+
+            if (Body == nullptr)
+                return 0;
+
+            const char *end = Body + Size;
+            const char *p = FindKey(Body, end, from, sizeof(from) - 1);
+            if (p == nullptr)
+                return 0;
+
+            p = FindKey(p, end, id, sizeof(id) - 1);
+
+            int64_t value;
+            if (p == nullptr || !ParseNumber(p, end, value))
+                return 0;
+
+            return value;
+        }
+    }
+}
+
+}
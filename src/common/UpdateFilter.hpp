@@ -0,0 +1,116 @@
+/*++
+
+Program name:
+
+  tgpg
+
+Module Name:
+
+  UpdateFilter.hpp
+
+Notices:
+
+  Telegram update_id de-duplication
+
+Author:
+
+  Copyright (c) Prepodobny Alen
+
+  mailto: alienufo@inbox.ru
+  mailto: ufocomp@gmail.com
+
+--*/
+
+#ifndef APOSTOL_TELEGRAM_UPDATE_FILTER_HPP
+#define APOSTOL_TELEGRAM_UPDATE_FILTER_HPP
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <string>
+//----------------------------------------------------------------------------------------------------------------------
+
+#define UPDATE_WINDOW_WORDS 16
+#define UPDATE_WINDOW_SIZE (UPDATE_WINDOW_WORDS * 64)
+//----------------------------------------------------------------------------------------------------------------------
+
+extern "C++" {
+
+namespace Apostol {
+
+    namespace Telegram {
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        //-- CUpdateWindow ---------------------------------------------------------------------------------------------
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        /**
+         * Sliding window of the last UPDATE_WINDOW_SIZE update identifiers relative to the high-water mark.
+         * Bit N is set if the update (High - N) has been seen.
+         */
+        class CUpdateWindow {
+        private:
+
+            int64_t m_High;
+
+            uint64_t m_Bits[UPDATE_WINDOW_WORDS];
+
+            void Reset(int64_t UpdateId);
+            void Shift(int64_t Count);
+
+            bool Test(int64_t Offset) const;
+            void Set(int64_t Offset);
+
+        public:
+
+            CUpdateWindow();
+
+            bool Add(int64_t UpdateId);
+
+            int64_t High() const { return m_High; };
+
+        };
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        //-- CUpdateFilter ---------------------------------------------------------------------------------------------
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        class CUpdateFilter {
+        private:
+
+            static const char *FindKey(const char *Body, const char *End, const char *Key, size_t Length);
+            static bool ParseNumber(const char *Body, const char *End, int64_t &Value);
+
+            std::map<std::string, CUpdateWindow> m_Windows;
+
+            size_t m_Dropped;
+
+        public:
+
+            CUpdateFilter(): m_Dropped(0) {
+
+            };
+
+            bool Check(const std::string &BotId, int64_t UpdateId);
+
+            void Delete(const std::string &BotId) { m_Windows.erase(BotId); };
+
+            size_t Dropped() const { return m_Dropped; };
+
+            static int64_t UpdateId(const char *Body, size_t Size);
+            static int64_t ChatId(const char *Body, size_t Size);
+            static int64_t UserId(const char *Body, size_t Size);
+
+        };
+
+    }
+}
+
+using namespace Apostol::Telegram;
+}
+#endif //APOSTOL_TELEGRAM_UPDATE_FILTER_HPP
@@ -0,0 +1,544 @@
+/*++
+
+Program name:
+
+  tgpg
+
+Module Name:
+
+  TGWebhook.cpp
+
+Notices:
+
+  Module: Telegram webhook
+
+Author:
+
+  Copyright (c) Prepodobny Alen
+
+  mailto: alienufo@inbox.ru
+  mailto: ufocomp@gmail.com
+
+--*/
+
+#include "Core.hpp"
+#include "TGWebhook.hpp"
+//----------------------------------------------------------------------------------------------------------------------
+
+#define WEBHOOK_LOCATION "/api/v1/webhook/"
+#define WEBHOOK_SECRET_HEADER "X-Telegram-Bot-Api-Secret-Token"
+//----------------------------------------------------------------------------------------------------------------------
+
+extern "C++" {
+
+namespace Apostol {
+
+    namespace Module {
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        //-- CTGWebhook ------------------------------------------------------------------------------------------------
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        CTGWebhook::CTGWebhook(CModuleProcess *AProcess): CApostolModule(AProcess, "telegram webhook", "module/TGWebhook") {
+            m_CheckDate = 0;
+
+            m_Loading = false;
+
+            m_Progress = 0;
+            m_Queued = 0;
+            m_Lanes.resize(Config()->IniFile().ReadInteger(SectionName().c_str(), "lanes", Config()->PostgresPollMin()));
+            if (m_Lanes.empty())
+                m_Lanes.resize(1);
+            m_QueueLimit = Config()->IniFile().ReadInteger(SectionName().c_str(), "queue_limit", 10000);
+
+            CTGWebhook::InitMethods();
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTGWebhook::InitMethods() {
+#if defined(_GLIBCXX_RELEASE) && (_GLIBCXX_RELEASE >= 9)
+            m_Methods.AddObject(_T("POST")   , (CObject *) new CMethodHandler(true , [this](auto && Connection) { DoPost(Connection); }));
+            m_Methods.AddObject(_T("OPTIONS"), (CObject *) new CMethodHandler(true , [this](auto && Connection) { DoOptions(Connection); }));
+            m_Methods.AddObject(_T("GET")    , (CObject *) new CMethodHandler(false, [this](auto && Connection) { MethodNotAllowed(Connection); }));
+            m_Methods.AddObject(_T("HEAD")   , (CObject *) new CMethodHandler(false, [this](auto && Connection) { MethodNotAllowed(Connection); }));
+            m_Methods.AddObject(_T("PUT")    , (CObject *) new CMethodHandler(false, [this](auto && Connection) { MethodNotAllowed(Connection); }));
+            m_Methods.AddObject(_T("DELETE") , (CObject *) new CMethodHandler(false, [this](auto && Connection) { MethodNotAllowed(Connection); }));
+            m_Methods.AddObject(_T("TRACE")  , (CObject *) new CMethodHandler(false, [this](auto && Connection) { MethodNotAllowed(Connection); }));
+            m_Methods.AddObject(_T("PATCH")  , (CObject *) new CMethodHandler(false, [this](auto && Connection) { MethodNotAllowed(Connection); }));
+            m_Methods.AddObject(_T("CONNECT"), (CObject *) new CMethodHandler(false, [this](auto && Connection) { MethodNotAllowed(Connection); }));
+#else
+            m_Methods.AddObject(_T("POST")   , (CObject *) new CMethodHandler(true , std::bind(&CTGWebhook::DoPost, this, _1)));
+            m_Methods.AddObject(_T("OPTIONS"), (CObject *) new CMethodHandler(true , std::bind(&CTGWebhook::DoOptions, this, _1)));
+            m_Methods.AddObject(_T("GET")    , (CObject *) new CMethodHandler(false, std::bind(&CTGWebhook::MethodNotAllowed, this, _1)));
+            m_Methods.AddObject(_T("HEAD")   , (CObject *) new CMethodHandler(false, std::bind(&CTGWebhook::MethodNotAllowed, this, _1)));
+            m_Methods.AddObject(_T("PUT")    , (CObject *) new CMethodHandler(false, std::bind(&CTGWebhook::MethodNotAllowed, this, _1)));
+            m_Methods.AddObject(_T("DELETE") , (CObject *) new CMethodHandler(false, std::bind(&CTGWebhook::MethodNotAllowed, this, _1)));
+            m_Methods.AddObject(_T("TRACE")  , (CObject *) new CMethodHandler(false, std::bind(&CTGWebhook::MethodNotAllowed, this, _1)));
+            m_Methods.AddObject(_T("PATCH")  , (CObject *) new CMethodHandler(false, std::bind(&CTGWebhook::MethodNotAllowed, this, _1)));
+            m_Methods.AddObject(_T("CONNECT"), (CObject *) new CMethodHandler(false, std::bind(&CTGWebhook::MethodNotAllowed, this, _1)));
+#endif
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTGWebhook::DoError(const Delphi::Exception::Exception &E) {
+            Log()->Error(APP_LOG_ERR, 0, "%s", E.what());
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTGWebhook::InitListen() {
+
+            auto OnExecuted = [this](CPQPollQuery *APollQuery) {
+                try {
+                    auto pResult = APollQuery->Results(0);
+
+                    if (pResult->ExecStatus() != PGRES_COMMAND_OK) {
+                        throw Delphi::Exception::EDBError(pResult->GetErrorMessage());
+                    }
+
+                    APollQuery->Connection()->Listeners().Add(PG_LISTEN_BOT_LIST);
+#if defined(_GLIBCXX_RELEASE) && (_GLIBCXX_RELEASE >= 9)
+                    APollQuery->Connection()->OnNotify([this](auto && APollQuery, auto && ANotify) { DoPostgresNotify(APollQuery, ANotify); });
+#else
+                    APollQuery->Connection()->OnNotify(std::bind(&CTGWebhook::DoPostgresNotify, this, _1, _2));
+#endif
+                    // Notifications could be missed while not listening
+                    LoadRegistry();
+                } catch (Delphi::Exception::Exception &E) {
+                    DoError(E);
+                }
+            };
+
+            auto OnException = [](CPQPollQuery *APollQuery, const Delphi::Exception::Exception &E) {
+                DoError(E);
+            };
+
+            CStringList SQL;
+
+            SQL.Add("LISTEN " PG_LISTEN_BOT_LIST ";");
+
+            try {
+                ExecSQL(SQL, nullptr, OnExecuted, OnException);
+            } catch (Delphi::Exception::Exception &E) {
+                DoError(E);
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTGWebhook::CheckListen() {
+            if (!m_pModuleProcess->GetPQClient().CheckListen(PG_LISTEN_BOT_LIST)) {
+                InitListen();
+            } else {
+                // Handlers could be created or dropped without changes in bot.list
+                LoadRegistry();
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTGWebhook::LoadRegistry() {
+
+            if (m_Loading)
+                return;
+
+            const auto generation = m_Registry.Generation();
+
+            auto OnExecuted = [this, generation](CPQPollQuery *APollQuery) {
+                m_Loading = false;
+
+                try {
+                    auto pResult = APollQuery->Results(0);
+
+                    if (pResult->ExecStatus() != PGRES_TUPLES_OK) {
+                        throw Delphi::Exception::EDBError(pResult->GetErrorMessage());
+                    }
+
+                    // A bot was updated while loading: the result is stale
+                    if (!m_Registry.Load(pResult, generation))
+                        LoadRegistry();
+                } catch (Delphi::Exception::Exception &E) {
+                    DoError(E);
+                }
+            };
+
+            auto OnException = [this](CPQPollQuery *APollQuery, const Delphi::Exception::Exception &E) {
+                m_Loading = false;
+                DoError(E);
+            };
+
+            CStringList SQL;
+
+            SQL.Add(CBotRegistry::SQL());
+
+            try {
+                ExecSQL(SQL, nullptr, OnExecuted, OnException);
+                m_Loading = true;
+            } catch (Delphi::Exception::Exception &E) {
+                DoError(E);
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTGWebhook::UpdateRegistry(const CString &Id) {
+
+            auto OnExecuted = [this, Id](CPQPollQuery *APollQuery) {
+                try {
+                    auto pResult = APollQuery->Results(0);
+
+                    if (pResult->ExecStatus() != PGRES_TUPLES_OK) {
+                        throw Delphi::Exception::EDBError(pResult->GetErrorMessage());
+                    }
+
+                    m_Registry.Update(Id, pResult);
+                } catch (Delphi::Exception::Exception &E) {
+                    DoError(E);
+                }
+            };
+
+            auto OnException = [](CPQPollQuery *APollQuery, const Delphi::Exception::Exception &E) {
+                DoError(E);
+            };
+
+            CStringList SQL;
+
+            SQL.Add(CBotRegistry::SQL(Id));
+
+            try {
+                ExecSQL(SQL, nullptr, OnExecuted, OnException);
+            } catch (Delphi::Exception::Exception &E) {
+                DoError(E);
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTGWebhook::DoPostgresNotify(CPQConnection *AConnection, PGnotify *ANotify) {
+            DebugNotify(AConnection, ANotify);
+
+            if (CompareString(ANotify->relname, PG_LISTEN_BOT_LIST) == 0) {
+                CJSON Payload;
+
+                try {
+                    Payload << ANotify->extra;
+
+                    const auto &caId = Payload["id"].AsString();
+
+                    if (Payload["op"].AsString() == "DELETE") {
+                        m_Registry.Delete(caId);
+                        m_Filter.Delete(caId.c_str());
+                    } else {
+                        UpdateRegistry(caId);
+                    }
+                } catch (Delphi::Exception::Exception &E) {
+                    DoError(E);
+                }
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        bool CTGWebhook::DoWebhook(size_t Index, const CWebhookUpdate &Update) {
+
+            auto OnExecuted = [this, Index](CPQPollQuery *APollQuery) {
+                if (m_Progress > 0)
+                    m_Progress--;
+
+                m_Lanes[Index].Busy = false;
+
+                try {
+                    auto pResult = APollQuery->Results(0);
+
+                    if (pResult->ExecStatus() != PGRES_TUPLES_OK) {
+                        throw Delphi::Exception::EDBError(pResult->GetErrorMessage());
+                    }
+                } catch (Delphi::Exception::Exception &E) {
+                    DoError(E);
+                    WriteDiagnostics(E.what());
+                }
+
+                UnloadLane(Index);
+            };
+
+            auto OnException = [this, Index](CPQPollQuery *APollQuery, const Delphi::Exception::Exception &E) {
+                if (m_Progress > 0)
+                    m_Progress--;
+
+                m_Lanes[Index].Busy = false;
+
+                DoError(E);
+                WriteDiagnostics(E.what());
+                UnloadLane(Index);
+            };
+
+            CStringList SQL;
+
+            // The resolved handler is called directly, without the catalog lookup in bot.webhook
+            if (Update.Args.IsEmpty()) {
+                SQL.Add(CString().Format("SELECT %s(%s::uuid, %s::jsonb);", Update.Handler.c_str(), PQQuoteLiteral(Update.BotId).c_str(), PQQuoteLiteral(Update.Body).c_str()));
+            } else if (Update.Body.IsEmpty()) {
+                SQL.Add(CString().Format("SELECT %s(%s::uuid, %s);", Update.Handler.c_str(), PQQuoteLiteral(Update.BotId).c_str(), Update.Args.c_str()));
+            } else {
+                SQL.Add(CString().Format("SELECT %s(%s::uuid, %s, %s::jsonb);", Update.Handler.c_str(), PQQuoteLiteral(Update.BotId).c_str(), Update.Args.c_str(), PQQuoteLiteral(Update.Body).c_str()));
+            }
+
+            try {
+                ExecSQL(SQL, nullptr, OnExecuted, OnException);
+                m_Lanes[Index].Busy = true;
+                m_Progress++;
+            } catch (Delphi::Exception::Exception &E) {
+                // Not sent (no free connection): the update goes back to the head of its lane, UnloadQueue retries it
+                m_Lanes[Index].Queue.push_front(Update);
+                m_Queued++;
+                DoError(E);
+                return false;
+            }
+
+            return true;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTGWebhook::WriteDiagnostics(const CString &Message) {
+            CStringList SQL;
+
+            SQL.Add(CString().Format("SELECT bot.WriteDiagnostics(%s);", PQQuoteLiteral(Message).c_str()));
+
+            try {
+                ExecSQL(SQL);
+            } catch (Delphi::Exception::Exception &E) {
+                DoError(E);
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        size_t CTGWebhook::LaneIndex(const CString &BotId, int64_t ChatId) const {
+            size_t hash = std::hash<std::string>()(BotId.c_str());
+            hash ^= std::hash<int64_t>()(ChatId) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+            return hash % m_Lanes.size();
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        CString CTGWebhook::UpdateArgs(const CTelegramUpdate &Update) {
+            CString Result;
+
+            Result.Format("ROW(%lld", (long long) Update.UpdateId());
+
+            for (const auto &Value : Update.Values()) {
+                Result << ", ";
+                if (Value.Null) {
+                    Result << "null";
+                } else {
+                    Result << PQQuoteLiteral(CString(Value.Value.c_str()));
+                }
+            }
+
+            Result << ")::bot.tg_";
+            Result << CTelegramUpdate::TypeName(Update.Type());
+
+            return Result;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        bool CTGWebhook::UnloadLane(size_t Index) {
+            auto &Lane = m_Lanes[Index];
+
+            if (Lane.Busy || Lane.Queue.empty())
+                return true;
+
+            const auto Update = Lane.Queue.front();
+            Lane.Queue.pop_front();
+            m_Queued--;
+
+            return DoWebhook(Index, Update);
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTGWebhook::Enqueue(const CWebhookUpdate &Update) {
+            const auto index = LaneIndex(Update.BotId, Update.ChatId);
+
+            m_Lanes[index].Queue.push_back(Update);
+            m_Queued++;
+
+            UnloadLane(index);
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTGWebhook::ReleaseCollapsed(CDateTime Now) {
+            for (auto it = m_Collapsed.begin(); it != m_Collapsed.end();) {
+                const auto &Update = it->second;
+                const auto pBot = m_Registry.Find(Update.BotId);
+
+                if (pBot == nullptr) {
+                    it = m_Collapsed.erase(it);
+                    continue;
+                }
+
+                const auto botKey = std::hash<std::string>()(it->first.first);
+
+                if (m_Limiter.Consume(botKey, Update.UserId, pBot->FloodRate, pBot->FloodBurst, Now)) {
+                    Enqueue(Update);
+                    it = m_Collapsed.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTGWebhook::UnloadQueue() {
+            // The other lanes would fail the same way, they are retried with the next heartbeat
+            for (size_t i = 0; i < m_Lanes.size() && m_Queued > 0; ++i) {
+                if (!UnloadLane(i))
+                    break;
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        bool CTGWebhook::SecretEquals(const CString &Value, const CString &Secret) {
+            // Constant time: the position of the first mismatch is not revealed by the response time
+            const auto size = Secret.Size();
+            unsigned char diff = Value.Size() == size ? 0 : 1;
+
+            for (size_t i = 0; i < size; i++) {
+                const auto ch = i < Value.Size() ? Value.c_str()[i] : 0;
+                diff |= (unsigned char) (ch ^ Secret.c_str()[i]);
+            }
+
+            return diff == 0;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTGWebhook::DoPost(CHTTPServerConnection *AConnection) {
+            const auto &caRequest = AConnection->Request();
+            auto &Reply = AConnection->Reply();
+
+            Reply.ContentType = CHTTPReply::json;
+
+            CStringList Routs;
+            SplitColumns(caRequest.Location.pathname, Routs, '/');
+
+            if (Routs.Count() != 4) {
+                AConnection->SendStockReply(CHTTPReply::not_found);
+                return;
+            }
+
+            const auto &caBotId = Routs[3];
+
+            if (!m_Registry.Loaded()) {
+                // Telegram will repeat the request
+                ReplyError(AConnection, CHTTPReply::service_unavailable, "Service temporarily unavailable.");
+                return;
+            }
+
+            const auto pBot = m_Registry.Find(caBotId);
+
+            if (pBot == nullptr) {
+                AConnection->SendStockReply(CHTTPReply::not_found);
+                return;
+            }
+
+            if (!pBot->Secret.IsEmpty() && !SecretEquals(caRequest.Headers[_T(WEBHOOK_SECRET_HEADER)], pBot->Secret)) {
+                ReplyError(AConnection, CHTTPReply::unauthorized, "Invalid secret token.");
+                return;
+            }
+
+            // Parked (collapsed) updates are held in memory as well
+            if (m_Queued + m_Collapsed.size() >= m_QueueLimit) {
+                ReplyError(AConnection, CHTTPReply::service_unavailable, "Too many updates in the queue.");
+                return;
+            }
+
+            Reply.Content = "{\"ok\":true}";
+            AConnection->SendReply(CHTTPReply::ok, nullptr, true);
+
+            // The update is decoded once: the type selects the typed handler, its fields become the arguments
+            CTelegramUpdate Decoded;
+            const auto decoded = Decoded.Parse(caRequest.Content.c_str(), caRequest.Content.Size()) && Decoded.Type() != utUnknown;
+
+            // Telegram redelivers updates that were not acknowledged in time
+            const auto updateId = decoded ? Decoded.UpdateId() : CUpdateFilter::UpdateId(caRequest.Content.c_str(), caRequest.Content.Size());
+            if (!m_Filter.Check(pBot->Id.c_str(), updateId)) {
+                Log()->Debug(APP_LOG_DEBUG_CORE, "[%s] Duplicate update %lld dropped.", pBot->Username.c_str(), (long long) updateId);
+                return;
+            }
+
+            const auto pTyped = decoded && !pBot->Updates[Decoded.Type()].Name.IsEmpty() ? &pBot->Updates[Decoded.Type()] : nullptr;
+
+            // No handler for the update - nothing to do in the database
+            if (pTyped == nullptr && pBot->Webhook.IsEmpty())
+                return;
+
+            CWebhookUpdate Update;
+
+            Update.BotId = pBot->Id;
+
+            if (pTyped != nullptr) {
+                Update.Handler = pTyped->Name;
+                Update.Args = UpdateArgs(Decoded);
+                // Generic JSON only if the handler asks for it
+                if (pTyped->Body)
+                    Update.Body = caRequest.Content.SubString(Decoded.ObjectOffset(), Decoded.ObjectLength());
+            } else {
+                Update.Handler = pBot->Webhook;
+                Update.Body = caRequest.Content;
+            }
+
+            if (decoded) {
+                Update.ChatId = Decoded.ChatId();
+                Update.UserId = Decoded.UserId();
+            } else {
+                Update.ChatId = CUpdateFilter::ChatId(caRequest.Content.c_str(), caRequest.Content.Size());
+                Update.UserId = CUpdateFilter::UserId(caRequest.Content.c_str(), caRequest.Content.Size());
+            }
+
+            const auto botKey = std::hash<std::string>()(pBot->Id.c_str());
+            const auto collapseKey = std::make_pair(std::string(pBot->Id.c_str()), Update.UserId);
+
+            if (!m_Limiter.Consume(botKey, Update.UserId, pBot->FloodRate, pBot->FloodBurst, Now())) {
+                if (pBot->Collapse()) {
+                    // Only the last update of the user is kept until the bucket is refilled
+                    auto &Collapsed = m_Collapsed[collapseKey];
+                    if (!Collapsed.BotId.IsEmpty())
+                        m_Limiter.Drop();
+                    Collapsed = Update;
+                } else {
+                    m_Limiter.Drop();
+                    Log()->Debug(APP_LOG_DEBUG_CORE, "[%s] Flood from user %lld, update %lld dropped.", pBot->Username.c_str(), (long long) Update.UserId, (long long) updateId);
+                }
+                return;
+            }
+
+            // A parked update of the user is older than this one: it is superseded, not released after it
+            const auto parked = m_Collapsed.find(collapseKey);
+            if (parked != m_Collapsed.end()) {
+                m_Collapsed.erase(parked);
+                m_Limiter.Drop();
+            }
+
+            Enqueue(Update);
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTGWebhook::Heartbeat(CDateTime DateTime) {
+            if ((DateTime >= m_CheckDate)) {
+                m_CheckDate = DateTime + (CDateTime) 1 / MinsPerDay; // 1 min
+                CheckListen();
+                m_Limiter.Evict(DateTime);
+            }
+
+            ReleaseCollapsed(DateTime);
+            UnloadQueue();
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        bool CTGWebhook::CheckLocation(const CLocation &Location) {
+            return Location.pathname.SubString(0, 16) == _T(WEBHOOK_LOCATION);
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        bool CTGWebhook::Enabled() {
+            if (m_ModuleStatus == msUnknown)
+                m_ModuleStatus = Config()->IniFile().ReadBool(SectionName().c_str(), "enable", true) ? msEnabled : msDisabled;
+            return m_ModuleStatus == msEnabled;
+        }
+    }
+}
+
+}
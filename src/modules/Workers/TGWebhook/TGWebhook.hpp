@@ -0,0 +1,144 @@
+/*++
+
+Program name:
+
+  tgpg
+
+Module Name:
+
+  TGWebhook.hpp
+
+Notices:
+
+  Module: Telegram webhook
+
+Author:
+
+  Copyright (c) Prepodobny Alen
+
+  mailto: alienufo@inbox.ru
+  mailto: ufocomp@gmail.com
+
+--*/
+
+#ifndef APOSTOL_TELEGRAM_WEBHOOK_HPP
+#define APOSTOL_TELEGRAM_WEBHOOK_HPP
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <vector>
+
+#include "BotRegistry.hpp"
+#include "UpdateFilter.hpp"
+#include "TelegramUpdate.hpp"
+#include "FloodLimiter.hpp"
+//----------------------------------------------------------------------------------------------------------------------
+
+extern "C++" {
+
+namespace Apostol {
+
+    namespace Module {
+
+        /**
+         * Args is the composite row of a typed handler (empty - the generic webhook); Body is the update, or the typed
+         * object if the typed handler takes jsonb.
+         */
+        struct CWebhookUpdate {
+            CString BotId;
+            CString Handler;
+            CString Args;
+            CString Body;
+            int64_t ChatId = 0;
+            int64_t UserId = 0;
+        };
+
+        /**
+         * Updates of one chat are processed strictly one after another; different lanes run concurrently.
+         */
+        struct CWebhookLane {
+            std::deque<CWebhookUpdate> Queue;
+            bool Busy = false;
+        };
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        //-- CTGWebhook ------------------------------------------------------------------------------------------------
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        class CTGWebhook: public CApostolModule {
+        private:
+
+            CBotRegistry m_Registry;
+            CUpdateFilter m_Filter;
+            CFloodLimiter m_Limiter;
+
+            std::map<std::pair<std::string, int64_t>, CWebhookUpdate> m_Collapsed;
+
+            std::vector<CWebhookLane> m_Lanes;
+
+            CDateTime m_CheckDate;
+
+            bool m_Loading;
+
+            size_t m_Progress;
+            size_t m_Queued;
+            size_t m_QueueLimit;
+
+            void InitMethods() override;
+
+            void InitListen();
+            void CheckListen();
+
+            void LoadRegistry();
+            void UpdateRegistry(const CString &Id);
+
+            size_t LaneIndex(const CString &BotId, int64_t ChatId) const;
+
+            bool UnloadLane(size_t Index);
+            void UnloadQueue();
+
+            void Enqueue(const CWebhookUpdate &Update);
+            void ReleaseCollapsed(CDateTime Now);
+
+            static CString UpdateArgs(const CTelegramUpdate &Update);
+            static bool SecretEquals(const CString &Value, const CString &Secret);
+
+        protected:
+
+            void DoPost(CHTTPServerConnection *AConnection);
+
+            bool DoWebhook(size_t Index, const CWebhookUpdate &Update);
+
+            void WriteDiagnostics(const CString &Message);
+
+            void DoPostgresNotify(CPQConnection *AConnection, PGnotify *ANotify);
+
+            static void DoError(const Delphi::Exception::Exception &E);
+
+        public:
+
+            explicit CTGWebhook(CModuleProcess *AProcess);
+
+            ~CTGWebhook() override = default;
+
+            static class CTGWebhook *CreateModule(CModuleProcess *AProcess) {
+                return new CTGWebhook(AProcess);
+            }
+
+            bool Enabled() override;
+
+            bool CheckLocation(const CLocation &Location) override;
+
+            void Heartbeat(CDateTime DateTime) override;
+
+        };
+    }
+}
+
+using namespace Apostol::Module;
+}
+#endif //APOSTOL_TELEGRAM_WEBHOOK_HPP
@@ -25,11 +25,13 @@ Author:
 #define APOSTOL_WORKERS_HPP
 //----------------------------------------------------------------------------------------------------------------------
 
+#include "TGWebhook/TGWebhook.hpp"
 #include "PGFetch/PGFetch.hpp"
 #include "WebServer/WebServer.hpp"
 //----------------------------------------------------------------------------------------------------------------------
 
 static inline void CreateWorkers(CModuleProcess *AProcess) {
+    CTGWebhook::CreateModule(AProcess);
     CPGFetch::CreateModule(AProcess);
     CWebServer::CreateModule(AProcess);
 }
@@ -0,0 +1,764 @@
+/*++
+
+Program name:
+
+  tgpg
+
+Module Name:
+
+  Import.cpp
+
+Notices:
+
+  Process: Telegram bot (CSV import)
+
+Author:
+
+  Copyright (c) Prepodobny Alen
+
+  mailto: alienufo@inbox.ru
+  mailto: ufocomp@gmail.com
+
+--*/
+
+#include "Core.hpp"
+#include "Import.hpp"
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+//----------------------------------------------------------------------------------------------------------------------
+
+#define IMPORT_COPY_BUFFER_SIZE 65536
+//----------------------------------------------------------------------------------------------------------------------
+
+extern "C++" {
+
+namespace Apostol {
+
+    namespace Processes {
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        //-- CCsvReader ------------------------------------------------------------------------------------------------
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        CCsvReader::CCsvReader(const char *Data, size_t Size, char Delimiter): m_Data(Data), m_Size(Size) {
+            m_Position = 0;
+            m_Delimiter = Delimiter;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        size_t CCsvReader::Scan(const char *Data, size_t Size, char Delimiter) {
+            size_t i = 0;
+#ifdef __AVX2__
+            const __m256i d32 = _mm256_set1_epi8(Delimiter);
+            const __m256i n32 = _mm256_set1_epi8('\n');
+            const __m256i r32 = _mm256_set1_epi8('\r');
+            const __m256i q32 = _mm256_set1_epi8('"');
+
+            for (; i + 32 <= Size; i += 32) {
+                const __m256i v = _mm256_loadu_si256((const __m256i *) (Data + i));
+                const __m256i m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, d32), _mm256_cmpeq_epi8(v, n32)),
+                                                  _mm256_or_si256(_mm256_cmpeq_epi8(v, r32), _mm256_cmpeq_epi8(v, q32)));
+                const auto mask = (unsigned) _mm256_movemask_epi8(m);
+                if (mask != 0)
+                    return i + __builtin_ctz(mask);
+            }
+#endif
+#ifdef __SSE2__
+            const __m128i d16 = _mm_set1_epi8(Delimiter);
+            const __m128i n16 = _mm_set1_epi8('\n');
+            const __m128i r16 = _mm_set1_epi8('\r');
+            const __m128i q16 = _mm_set1_epi8('"');
+
+            for (; i + 16 <= Size; i += 16) {
+                const __m128i v = _mm_loadu_si128((const __m128i *) (Data + i));
+                const __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, d16), _mm_cmpeq_epi8(v, n16)),
+                                               _mm_or_si128(_mm_cmpeq_epi8(v, r16), _mm_cmpeq_epi8(v, q16)));
+                const auto mask = (unsigned) _mm_movemask_epi8(m);
+                if (mask != 0)
+                    return i + __builtin_ctz(mask);
+            }
+#endif
+            for (; i < Size; ++i) {
+                const char ch = Data[i];
+                if (ch == Delimiter || ch == '\n' || ch == '\r' || ch == '"')
+                    return i;
+            }
+
+            return Size;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        size_t CCsvReader::ReadQuoted(std::string &Field) {
+            size_t i = m_Position + 1;
+
+            for (;;) {
+                const auto quote = (const char *) memchr(m_Data + i, '"', m_Size - i);
+                if (quote == nullptr) {
+                    Field.append(m_Data + i, m_Size - i);
+                    return m_Size;
+                }
+
+                const size_t q = quote - m_Data;
+                Field.append(m_Data + i, q - i);
+
+                if (q + 1 < m_Size && m_Data[q + 1] == '"') {
+                    Field.push_back('"');
+                    i = q + 2;
+                    continue;
+                }
+
+                // Anything between the closing quote and the delimiter is kept as is
+                i = q + 1;
+                size_t stop = i;
+                while (stop < m_Size) {
+                    stop += Scan(m_Data + stop, m_Size - stop, m_Delimiter);
+                    if (stop < m_Size && m_Data[stop] == '"') {
+                        stop++;
+                        continue;
+                    }
+                    break;
+                }
+
+                Field.append(m_Data + i, stop - i);
+
+                return stop;
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        bool CCsvReader::Next(std::vector<std::string> &Fields) {
+            Fields.clear();
+
+            if (m_Position >= m_Size)
+                return false;
+
+            for (;;) {
+                Fields.emplace_back();
+                auto &Field = Fields.back();
+
+                if (m_Position >= m_Size)
+                    return true;
+
+                size_t stop;
+
+                if (m_Data[m_Position] == '"') {
+                    stop = ReadQuoted(Field);
+                } else {
+                    stop = m_Position;
+                    while (stop < m_Size) {
+                        stop += Scan(m_Data + stop, m_Size - stop, m_Delimiter);
+                        // A quote inside of an unquoted field is a data
+                        if (stop < m_Size && m_Data[stop] == '"') {
+                            stop++;
+                            continue;
+                        }
+                        break;
+                    }
+                    Field.assign(m_Data + m_Position, stop - m_Position);
+                }
+
+                if (stop >= m_Size) {
+                    m_Position = m_Size;
+                    return true;
+                }
+
+                const char ch = m_Data[stop];
+                m_Position = stop + 1;
+
+                if (ch == m_Delimiter)
+                    continue;
+
+                if (ch == '\r' && m_Position < m_Size && m_Data[m_Position] == '\n')
+                    m_Position++;
+
+                return true;
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        char CCsvReader::Detect(const char *Data, size_t Size) {
+            const auto eol = (const char *) memchr(Data, '\n', Size);
+            const size_t length = eol == nullptr ? Size : eol - Data;
+
+            if (memchr(Data, ';', length) != nullptr)
+                return ';';
+            if (memchr(Data, '\t', length) != nullptr)
+                return '\t';
+            if (memchr(Data, ',', length) != nullptr)
+                return ',';
+
+            return ';';
+        }
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        //-- CImportManager --------------------------------------------------------------------------------------------
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        namespace {
+
+            enum CImportColumn { icIgnore = 0, icAddress, icNumber, icText };
+            //----------------------------------------------------------------------------------------------------------
+
+            const char *ImportColumns[] = {"#", "address", "count", "received", "sent", "balance", "description"};
+            //----------------------------------------------------------------------------------------------------------
+
+            std::string Trim(const std::string &Value) {
+                size_t begin = 0, end = Value.size();
+
+                while (begin < end && (Value[begin] == ' ' || Value[begin] == '\t'))
+                    begin++;
+                while (end > begin && (Value[end - 1] == ' ' || Value[end - 1] == '\t'))
+                    end--;
+
+                return Value.substr(begin, end - begin);
+            }
+            //----------------------------------------------------------------------------------------------------------
+
+            void AppendJsonString(std::string &Json, const std::string &Value) {
+                Json.push_back('"');
+                for (const char ch : Value) {
+                    switch (ch) {
+                        case '"':
+                            Json.append("\\\"");
+                            break;
+                        case '\\':
+                            Json.append("\\\\");
+                            break;
+                        case '\n':
+                            Json.append("\\n");
+                            break;
+                        case '\r':
+                            Json.append("\\r");
+                            break;
+                        case '\t':
+                            Json.append("\\t");
+                            break;
+                        default:
+                            if ((unsigned char) ch < 0x20) {
+                                char buffer[8];
+                                snprintf(buffer, sizeof(buffer), "\\u%04x", (unsigned) ch);
+                                Json.append(buffer);
+                            } else {
+                                Json.push_back(ch);
+                            }
+                            break;
+                    }
+                }
+                Json.push_back('"');
+            }
+            //----------------------------------------------------------------------------------------------------------
+
+            void AppendJsonNumber(std::string &Json, const std::string &Value) {
+                size_t i = 0;
+
+                if (Value[i] == '-')
+                    Json.push_back(Value[i++]);
+
+                // JSON does not allow leading zeros
+                while (i + 1 < Value.size() && Value[i] == '0' && Value[i + 1] != '.')
+                    i++;
+
+                Json.append(Value, i, std::string::npos);
+            }
+            //----------------------------------------------------------------------------------------------------------
+
+            // COPY text format
+            void AppendCopyValue(std::string &Buffer, const std::string &Value) {
+                for (const char ch : Value) {
+                    switch (ch) {
+                        case '\\':
+                            Buffer.append("\\\\");
+                            break;
+                        case '\t':
+                            Buffer.append("\\t");
+                            break;
+                        case '\n':
+                            Buffer.append("\\n");
+                            break;
+                        case '\r':
+                            Buffer.append("\\r");
+                            break;
+                        default:
+                            Buffer.push_back(ch);
+                            break;
+                    }
+                }
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        CImportManager::CImportManager() {
+            m_Running = false;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        CImportManager::~CImportManager() {
+            Stop();
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CImportManager::Start() {
+            if (m_Running)
+                return;
+
+            m_Running = true;
+            m_Thread = std::thread(&CImportManager::Execute, this);
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CImportManager::Stop() {
+            if (!m_Running)
+                return;
+
+            {
+                std::lock_guard<std::mutex> lock(m_Lock);
+                m_Running = false;
+            }
+
+            m_Wakeup.notify_one();
+
+            if (m_Thread.joinable())
+                m_Thread.join();
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CImportManager::Add(CImportJob &&Job) {
+            {
+                std::lock_guard<std::mutex> lock(m_Lock);
+                m_Pending.push_back(std::move(Job));
+            }
+
+            m_Wakeup.notify_one();
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        size_t CImportManager::Completed(std::vector<CImportResult> &Results) {
+            std::lock_guard<std::mutex> lock(m_Lock);
+            Results.swap(m_Completed);
+            m_Completed.clear();
+            return Results.size();
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CImportManager::Export(CTransferJob &&Job, const std::string &Query) {
+            {
+                std::lock_guard<std::mutex> lock(m_Lock);
+                m_Exports.push_back({std::move(Job), Query});
+            }
+
+            m_Wakeup.notify_one();
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        size_t CImportManager::Exported(std::vector<CExportResult> &Results) {
+            std::lock_guard<std::mutex> lock(m_Lock);
+            Results.swap(m_Exported);
+            m_Exported.clear();
+            return Results.size();
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CImportManager::Execute() {
+            for (;;) {
+                CImportJob Job;
+                CExportJob Unloading;
+
+                bool exporting;
+
+                {
+                    std::unique_lock<std::mutex> lock(m_Lock);
+                    m_Wakeup.wait(lock, [this] { return !m_Running || !m_Pending.empty() || !m_Exports.empty(); });
+
+                    if (!m_Running)
+                        break;
+
+                    // Exports are short and an upload is waiting for them: they go first
+                    exporting = !m_Exports.empty();
+
+                    if (exporting) {
+                        Unloading = std::move(m_Exports.front());
+                        m_Exports.pop_front();
+                    } else {
+                        Job = std::move(m_Pending.front());
+                        m_Pending.pop_front();
+                    }
+                }
+
+                if (exporting) {
+                    CExportResult Result;
+
+                    Result.Job = std::move(Unloading.Job);
+
+                    Export(Unloading.Query, Result);
+
+                    std::lock_guard<std::mutex> lock(m_Lock);
+                    m_Exported.push_back(std::move(Result));
+                    continue;
+                }
+
+                CImportResult Result;
+
+                Result.Id = Job.Id;
+
+                Import(Job, Result);
+
+                std::lock_guard<std::mutex> lock(m_Lock);
+                m_Completed.push_back(std::move(Result));
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CImportManager::Import(const CImportJob &Job, CImportResult &Result) {
+            const int file = open(Job.Path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (file == -1) {
+                Result.Error = std::string("Could not open file: ") + strerror(errno);
+                return;
+            }
+
+            struct stat st = {};
+            if (fstat(file, &st) == -1 || st.st_size == 0) {
+                Result.Error = "The file is empty.";
+                close(file);
+                return;
+            }
+
+            const auto size = (size_t) st.st_size;
+            auto data = (const char *) mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+            close(file);
+
+            if (data == MAP_FAILED) {
+                Result.Error = std::string("Could not read file: ") + strerror(errno);
+                return;
+            }
+
+            madvise((void *) data, size, MADV_SEQUENTIAL);
+
+            PGconn *pConnection = PQconnectdb(m_ConnInfo.c_str());
+
+            if (PQstatus(pConnection) != CONNECTION_OK) {
+                Result.Error = PQerrorMessage(pConnection);
+            } else {
+                // UTF-8 BOM
+                const size_t skip = size >= 3 && memcmp(data, "\xEF\xBB\xBF", 3) == 0 ? 3 : 0;
+                Load(pConnection, Job, data + skip, size - skip, Result);
+            }
+
+            PQfinish(pConnection);
+            munmap((void *) data, size);
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CImportManager::Load(PGconn *Connection, const CImportJob &Job, const char *Data, size_t Size, CImportResult &Result) {
+            CCsvReader Reader(Data, Size, CCsvReader::Detect(Data, Size));
+
+            std::vector<std::string> Fields;
+            std::vector<std::string> Names;
+            std::vector<CImportColumn> Columns;
+
+            size_t address = 0;
+            bool found = false;
+
+            Reader.Next(Fields);
+
+            for (const auto &Field : Fields) {
+                const auto &name = Trim(Field);
+
+                CImportColumn column = icIgnore;
+                bool valid = false;
+
+                for (const auto caName : ImportColumns) {
+                    if (name == caName) {
+                        valid = true;
+                        break;
+                    }
+                }
+
+                if (!valid) {
+                    Result.Error = "Invalid value \"" + name + "\" in header. Valid values: [";
+                    for (size_t i = 0; i < sizeof(ImportColumns) / sizeof(ImportColumns[0]); ++i) {
+                        if (i > 0)
+                            Result.Error.append(", ");
+                        Result.Error.append(ImportColumns[i]);
+                    }
+                    Result.Error.append("]");
+                    return;
+                }
+
+                if (name == "address") {
+                    address = Columns.size();
+                    column = icAddress;
+                    found = true;
+                } else if (name == "description") {
+                    column = icText;
+                } else if (name != "#") {
+                    column = icNumber;
+                }
+
+                Names.push_back(name);
+                Columns.push_back(column);
+            }
+
+            if (!found) {
+                Result.Error = "Column \"address\" not found in header.";
+                return;
+            }
+
+            if (!Exec(Connection, "BEGIN", Result.Error))
+                return;
+
+            std::string SQL("COPY bot.import_data (import_id, line, key, data) FROM STDIN");
+
+            if (!Job.Encoding.empty()) {
+                auto encoding = PQescapeLiteral(Connection, Job.Encoding.c_str(), Job.Encoding.size());
+                if (encoding != nullptr) {
+                    SQL.append(" WITH (ENCODING ").append(encoding).append(")");
+                    PQfreemem(encoding);
+                }
+            }
+
+            auto pResult = PQexec(Connection, SQL.c_str());
+            const auto status = PQresultStatus(pResult);
+            if (status != PGRES_COPY_IN)
+                Result.Error = PQresultErrorMessage(pResult);
+            PQclear(pResult);
+
+            std::string Ignored;
+
+            if (status != PGRES_COPY_IN) {
+                Exec(Connection, "ROLLBACK", Ignored);
+                return;
+            }
+
+            const auto &id = std::to_string(Job.Id);
+
+            std::string Buffer;
+            std::string Json;
+
+            Buffer.reserve(IMPORT_COPY_BUFFER_SIZE + 4096);
+
+            int line = 1;
+            bool failed = false;
+
+            while (!failed && Reader.Next(Fields)) {
+                line++;
+
+                if (Fields.size() == 1 && Trim(Fields[0]).empty())
+                    continue;
+
+                Result.Lines++;
+
+                const auto &key = address < Fields.size() ? Trim(Fields[address]) : std::string();
+
+                bool valid = IsAddress(key);
+
+                Json.clear();
+
+                for (size_t i = 0; valid && i < Columns.size() && i < Fields.size(); ++i) {
+                    if (Columns[i] != icNumber && Columns[i] != icText)
+                        continue;
+
+                    const auto &value = Trim(Fields[i]);
+                    if (value.empty())
+                        continue;
+
+                    if (Columns[i] == icNumber && !IsNumber(value)) {
+                        valid = false;
+                        break;
+                    }
+
+                    Json.push_back(Json.empty() ? '{' : ',');
+                    AppendJsonString(Json, Names[i]);
+                    Json.push_back(':');
+
+                    if (Columns[i] == icNumber) {
+                        AppendJsonNumber(Json, value);
+                    } else {
+                        AppendJsonString(Json, value);
+                    }
+                }
+
+                if (!valid) {
+                    Result.Rejected++;
+                    continue;
+                }
+
+                Buffer.append(id).push_back('\t');
+                Buffer.append(std::to_string(line)).push_back('\t');
+                AppendCopyValue(Buffer, key);
+                Buffer.push_back('\t');
+
+                if (Json.empty()) {
+                    Buffer.append("\\N");
+                } else {
+                    Json.push_back('}');
+                    AppendCopyValue(Buffer, Json);
+                }
+
+                Buffer.push_back('\n');
+
+                if (Buffer.size() >= IMPORT_COPY_BUFFER_SIZE) {
+                    failed = PQputCopyData(Connection, Buffer.data(), (int) Buffer.size()) != 1;
+                    Buffer.clear();
+                }
+            }
+
+            if (!failed && !Buffer.empty())
+                failed = PQputCopyData(Connection, Buffer.data(), (int) Buffer.size()) != 1;
+
+            if (failed || PQputCopyEnd(Connection, nullptr) != 1) {
+                Result.Error = PQerrorMessage(Connection);
+            }
+
+            while ((pResult = PQgetResult(Connection)) != nullptr) {
+                if (PQresultStatus(pResult) != PGRES_COMMAND_OK && Result.Error.empty())
+                    Result.Error = PQresultErrorMessage(pResult);
+                PQclear(pResult);
+            }
+
+            std::string Value;
+
+            if (!Result.Error.empty() || !Exec(Connection, "SELECT bot.import_merge(" + id + ")", Result.Error, &Value)) {
+                Exec(Connection, "ROLLBACK", Ignored);
+                return;
+            }
+
+            if (!Exec(Connection, "COMMIT", Result.Error))
+                return;
+
+            Result.Rows = (int) strtol(Value.c_str(), nullptr, 10);
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CImportManager::Export(const std::string &Query, CExportResult &Result) {
+            PGconn *pConnection = PQconnectdb(m_ConnInfo.c_str());
+
+            if (PQstatus(pConnection) != CONNECTION_OK) {
+                Result.Error = PQerrorMessage(pConnection);
+            } else {
+                Unload(pConnection, Query, Result);
+            }
+
+            PQfinish(pConnection);
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CImportManager::Unload(PGconn *Connection, const std::string &Query, CExportResult &Result) {
+            CStoreFile File(m_Store);
+
+            if (!File.Open("u" + std::to_string(Result.Job.Id))) {
+                Result.Error = File.Error();
+                return;
+            }
+
+            if (PQsendQuery(Connection, Query.c_str()) != 1 || PQsetSingleRowMode(Connection) != 1) {
+                Result.Error = PQerrorMessage(Connection);
+                return;
+            }
+
+            // Single-row mode: only the current row is held in memory, it is written to the file as it is
+            bool written = true;
+
+            PGresult *pResult;
+            while ((pResult = PQgetResult(Connection)) != nullptr) {
+                const auto status = PQresultStatus(pResult);
+
+                if (status == PGRES_SINGLE_TUPLE) {
+                    if (written && Result.Error.empty())
+                        written = File.Write(PQgetvalue(pResult, 0, 0), (size_t) PQgetlength(pResult, 0, 0)) && File.Write("\n", 1);
+                } else if (status != PGRES_TUPLES_OK && Result.Error.empty()) {
+                    Result.Error = PQresultErrorMessage(pResult);
+                }
+
+                PQclear(pResult);
+            }
+
+            if (Result.Error.empty() && (!written || !File.Commit(Result.Job.Path, Result.Job.Hash)))
+                Result.Error = File.Error();
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        bool CImportManager::Exec(PGconn *Connection, const std::string &SQL, std::string &Error, std::string *Value) {
+            auto pResult = PQexec(Connection, SQL.c_str());
+
+            const auto status = PQresultStatus(pResult);
+            const auto succeeded = status == PGRES_COMMAND_OK || status == PGRES_TUPLES_OK;
+
+            if (!succeeded) {
+                Error = PQresultErrorMessage(pResult);
+            } else if (Value != nullptr && PQntuples(pResult) > 0) {
+                *Value = PQgetvalue(pResult, 0, 0);
+            }
+
+            PQclear(pResult);
+
+            return succeeded;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        bool CImportManager::IsAddress(const std::string &Value) {
+            // Prefix and length only: the checksums are verified by bot.import_merge() with bot.IsBitcoinAddress()
+            const auto length = Value.size();
+
+            if (length == 0)
+                return false;
+
+            for (const char ch : Value) {
+                if (!((ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z')))
+                    return false;
+            }
+
+            const char ch = Value.front();
+            if ((ch == '1' || ch == '2' || ch == '3' || ch == 'm' || ch == 'n') && length >= 26 && length <= 35)
+                return true;
+
+            const auto &hrp = Value.substr(0, 3);
+            return (hrp == "bc1" || hrp == "tb1") && (length == 42 || length == 62);
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        bool CImportManager::IsNumber(const std::string &Value) {
+            size_t i = 0;
+
+            if (i < Value.size() && Value[i] == '-')
+                i++;
+
+            size_t digits = 0;
+            while (i < Value.size() && Value[i] >= '0' && Value[i] <= '9') {
+                i++;
+                digits++;
+            }
+
+            if (digits == 0)
+                return false;
+
+            if (i < Value.size() && Value[i] == '.') {
+                i++;
+                digits = 0;
+                while (i < Value.size() && Value[i] >= '0' && Value[i] <= '9') {
+                    i++;
+                    digits++;
+                }
+                if (digits == 0)
+                    return false;
+            }
+
+            return i == Value.size();
+        }
+
+    }
+}
+}
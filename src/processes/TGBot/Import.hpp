@@ -0,0 +1,195 @@
+/*++
+
+Program name:
+
+  tgpg
+
+Module Name:
+
+  Import.hpp
+
+Notices:
+
+  Process: Telegram bot (CSV import)
+
+Author:
+
+  Copyright (c) Prepodobny Alen
+
+  mailto: alienufo@inbox.ru
+  mailto: ufocomp@gmail.com
+
+--*/
+
+#ifndef APOSTOL_PROCESS_TELEGRAM_BOT_IMPORT_HPP
+#define APOSTOL_PROCESS_TELEGRAM_BOT_IMPORT_HPP
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <postgresql/libpq-fe.h>
+
+#include "Transfer.hpp"
+//----------------------------------------------------------------------------------------------------------------------
+
+extern "C++" {
+
+namespace Apostol {
+
+    namespace Processes {
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        //-- CCsvReader ------------------------------------------------------------------------------------------------
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        /**
+         * Splits CSV data into rows. The delimiters are found with SSE2/AVX2 (16/32 bytes per step) when the target
+         * supports it; quoted fields ("a;b", "a""b") are supported.
+         */
+        class CCsvReader {
+        private:
+
+            const char *m_Data;
+
+            size_t m_Size;
+            size_t m_Position;
+
+            char m_Delimiter;
+
+            static size_t Scan(const char *Data, size_t Size, char Delimiter);
+
+            size_t ReadQuoted(std::string &Field);
+
+        public:
+
+            CCsvReader(const char *Data, size_t Size, char Delimiter = ';');
+
+            bool Next(std::vector<std::string> &Fields);
+
+            bool Eof() const { return m_Position >= m_Size; };
+
+            char Delimiter() const { return m_Delimiter; };
+
+            static char Detect(const char *Data, size_t Size);
+
+        };
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        //-- CImportManager --------------------------------------------------------------------------------------------
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        struct CImportJob {
+            int64_t Id = 0;
+
+            std::string Path;
+            std::string Encoding;
+        };
+        //--------------------------------------------------------------------------------------------------------------
+
+        struct CImportResult {
+            int64_t Id = 0;
+
+            int Lines = 0;
+            int Rows = 0;
+            int Rejected = 0;
+
+            std::string Error;
+        };
+        //--------------------------------------------------------------------------------------------------------------
+
+        struct CExportJob {
+            CTransferJob Job;
+
+            std::string Query;
+        };
+        //--------------------------------------------------------------------------------------------------------------
+
+        struct CExportResult {
+            CTransferJob Job;
+
+            std::string Error;
+        };
+        //--------------------------------------------------------------------------------------------------------------
+
+        /**
+         * Imports address files (the format of /list export) on a worker thread: the file is parsed and validated,
+         * valid rows are loaded with COPY into bot.import_data and merged into bot.data by bot.import_merge() in one
+         * transaction. Upload documents built by a query (bot.upload.query) are exported on the same thread: the rows
+         * are fetched one by one (single-row mode) and written to the file store. Results are collected by the
+         * process timer.
+         */
+        class CImportManager {
+        private:
+
+            std::thread m_Thread;
+
+            std::mutex m_Lock;
+            std::condition_variable m_Wakeup;
+
+            std::deque<CImportJob> m_Pending;
+            std::vector<CImportResult> m_Completed;
+
+            std::deque<CExportJob> m_Exports;
+            std::vector<CExportResult> m_Exported;
+
+            std::atomic<bool> m_Running;
+
+            std::string m_ConnInfo;
+            std::string m_Store;
+
+            void Execute();
+
+            void Import(const CImportJob &Job, CImportResult &Result);
+            void Load(PGconn *Connection, const CImportJob &Job, const char *Data, size_t Size, CImportResult &Result);
+
+            void Export(const std::string &Query, CExportResult &Result);
+            void Unload(PGconn *Connection, const std::string &Query, CExportResult &Result);
+
+            static bool Exec(PGconn *Connection, const std::string &SQL, std::string &Error, std::string *Value = nullptr);
+
+        public:
+
+            CImportManager();
+
+            ~CImportManager();
+
+            void Start();
+            void Stop();
+
+            void Add(CImportJob &&Job);
+
+            size_t Completed(std::vector<CImportResult> &Results);
+
+            void Export(CTransferJob &&Job, const std::string &Query);
+
+            size_t Exported(std::vector<CExportResult> &Results);
+
+            bool Running() const { return m_Running; };
+
+            const std::string &ConnInfo() const { return m_ConnInfo; };
+            void ConnInfo(const std::string &Value) { m_ConnInfo = Value; };
+
+            const std::string &Store() const { return m_Store; };
+            void Store(const std::string &Value) { m_Store = Value; };
+
+            static bool IsAddress(const std::string &Value);
+            static bool IsNumber(const std::string &Value);
+
+        };
+
+    }
+}
+
+using namespace Apostol::Processes;
+}
+#endif //APOSTOL_PROCESS_TELEGRAM_BOT_IMPORT_HPP
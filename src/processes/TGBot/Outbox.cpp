@@ -0,0 +1,220 @@
+/*++
+
+Program name:
+
+  tgpg
+
+Module Name:
+
+  Outbox.cpp
+
+Notices:
+
+  Process: Telegram bot (outbound scheduler)
+
+Author:
+
+  Copyright (c) Prepodobny Alen
+
+  mailto: alienufo@inbox.ru
+  mailto: ufocomp@gmail.com
+
+--*/
+
+#include "Core.hpp"
+#include "Outbox.hpp"
+//----------------------------------------------------------------------------------------------------------------------
+
+extern "C++" {
+
+namespace Apostol {
+
+    namespace Processes {
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        //-- CTokenBucket ----------------------------------------------------------------------------------------------
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        CTokenBucket::CTokenBucket(double Rate, double Burst): m_Rate(Rate), m_Burst(Burst) {
+            m_Tokens = Burst;
+            m_Stamp = 0;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTokenBucket::Refill(CDateTime Now) {
+            if (m_Stamp == 0) {
+                m_Stamp = Now;
+                return;
+            }
+
+            if (Now > m_Stamp) {
+                m_Tokens += (Now - m_Stamp) * SecsPerDay * m_Rate;
+                if (m_Tokens > m_Burst)
+                    m_Tokens = m_Burst;
+                m_Stamp = Now;
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        bool CTokenBucket::Consume(CDateTime Now) {
+            Refill(Now);
+            if (m_Tokens < 1)
+                return false;
+            m_Tokens -= 1;
+            return true;
+        }
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        //-- COutboxScheduler ------------------------------------------------------------------------------------------
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        COutboxScheduler::COutboxScheduler() {
+            m_Count = 0;
+
+            m_BotRate = 30;
+            m_ChatRate = 1;
+            m_GroupRate = (double) 20 / 60;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void COutboxScheduler::Clear() {
+            m_Bots.clear();
+            m_Count = 0;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        COutboxScheduler::CBotQueue &COutboxScheduler::GetBot(const std::string &BotId) {
+            auto it = m_Bots.find(BotId);
+            if (it == m_Bots.end()) {
+                it = m_Bots.emplace(BotId, CBotQueue()).first;
+                it->second.Bucket = CTokenBucket(m_BotRate, m_BotRate);
+            }
+            return it->second;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        COutboxScheduler::CChatQueue &COutboxScheduler::GetChat(CBotQueue &Bot, int64_t ChatId) {
+            auto it = Bot.Chats.find(ChatId);
+            if (it == Bot.Chats.end()) {
+                it = Bot.Chats.emplace(ChatId, CChatQueue()).first;
+                // Negative identifiers belong to groups, supergroups and channels
+                it->second.Bucket = ChatId < 0 ? CTokenBucket(m_GroupRate, 1) : CTokenBucket(m_ChatRate, 1);
+            }
+            return it->second;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void COutboxScheduler::MakeReady(CBotQueue &Bot, CChatQueue &Chat, int64_t ChatId) {
+            if (!Chat.Ready) {
+                Chat.Ready = true;
+                Bot.Ready.push_back(ChatId);
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void COutboxScheduler::Push(const std::string &BotId, int64_t ChatId, int64_t Id) {
+            auto &Bot = GetBot(BotId);
+            auto &Chat = GetChat(Bot, ChatId);
+
+            Chat.Items.push_back(Id);
+            MakeReady(Bot, Chat, ChatId);
+
+            m_Count++;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void COutboxScheduler::Retry(const std::string &BotId, int64_t ChatId, int64_t Id, int RetryAfter,
+                CDateTime Now) {
+
+            auto &Bot = GetBot(BotId);
+            auto &Chat = GetChat(Bot, ChatId);
+
+            Chat.Items.push_front(Id);
+            Chat.Parked = Now + (CDateTime) RetryAfter / SecsPerDay;
+            MakeReady(Bot, Chat, ChatId);
+
+            m_Count++;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        size_t COutboxScheduler::ReleaseBot(const std::string &BotId, CBotQueue &Bot, CDateTime Now, size_t Limit,
+                std::vector<COutboxItem> &Items) {
+
+            size_t released = 0;
+            size_t pass = Bot.Ready.size();
+
+            Bot.Bucket.Refill(Now);
+
+            while (pass > 0 && released < Limit && !Bot.Bucket.Empty()) {
+                const auto chatId = Bot.Ready.front();
+                Bot.Ready.pop_front();
+                pass--;
+
+                auto it = Bot.Chats.find(chatId);
+                if (it == Bot.Chats.end())
+                    continue;
+
+                auto &Chat = it->second;
+
+                if (Chat.Items.empty()) {
+                    Chat.Ready = false;
+                    continue;
+                }
+
+                if (Now >= Chat.Parked && Chat.Bucket.Consume(Now)) {
+                    Bot.Bucket.Consume(Now);
+
+                    Items.push_back({BotId, chatId, Chat.Items.front()});
+                    Chat.Items.pop_front();
+
+                    released++;
+                    m_Count--;
+                }
+
+                if (Chat.Items.empty()) {
+                    Chat.Ready = false;
+                } else {
+                    Bot.Ready.push_back(chatId);
+                }
+            }
+
+            // Idle chats are kept until their bucket is refilled, otherwise the next message could exceed the limit
+            for (auto it = Bot.Chats.begin(); it != Bot.Chats.end();) {
+                auto &Chat = it->second;
+                if (!Chat.Ready && Chat.Items.empty()) {
+                    Chat.Bucket.Refill(Now);
+                    if (Chat.Bucket.Full() && Now >= Chat.Parked) {
+                        it = Bot.Chats.erase(it);
+                        continue;
+                    }
+                }
+                ++it;
+            }
+
+            return released;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        size_t COutboxScheduler::Release(CDateTime Now, size_t Limit, std::vector<COutboxItem> &Items) {
+            size_t released = 0;
+
+            for (auto it = m_Bots.begin(); it != m_Bots.end() && released < Limit;) {
+                released += ReleaseBot(it->first, it->second, Now, Limit - released, Items);
+
+                if (it->second.Chats.empty()) {
+                    it = m_Bots.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+
+            return released;
+        }
+    }
+}
+
+}
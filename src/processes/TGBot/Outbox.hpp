@@ -0,0 +1,154 @@
+/*++
+
+Program name:
+
+  tgpg
+
+Module Name:
+
+  Outbox.hpp
+
+Notices:
+
+  Process: Telegram bot (outbound scheduler)
+
+Author:
+
+  Copyright (c) Prepodobny Alen
+
+  mailto: alienufo@inbox.ru
+  mailto: ufocomp@gmail.com
+
+--*/
+
+#ifndef APOSTOL_PROCESS_TELEGRAM_BOT_OUTBOX_HPP
+#define APOSTOL_PROCESS_TELEGRAM_BOT_OUTBOX_HPP
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+//----------------------------------------------------------------------------------------------------------------------
+
+extern "C++" {
+
+namespace Apostol {
+
+    namespace Processes {
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        //-- CTokenBucket ----------------------------------------------------------------------------------------------
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        class CTokenBucket {
+        private:
+
+            double m_Rate;
+            double m_Burst;
+            double m_Tokens;
+
+            CDateTime m_Stamp;
+
+        public:
+
+            CTokenBucket(): CTokenBucket(1, 1) {
+
+            };
+
+            CTokenBucket(double Rate, double Burst);
+
+            void Refill(CDateTime Now);
+
+            bool Consume(CDateTime Now);
+
+            bool Full() const { return m_Tokens >= m_Burst; };
+            bool Empty() const { return m_Tokens < 1; };
+
+            double Rate() const { return m_Rate; };
+            double Burst() const { return m_Burst; };
+
+        };
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        //-- COutboxScheduler ------------------------------------------------------------------------------------------
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        struct COutboxItem {
+            std::string BotId;
+            int64_t ChatId = 0;
+            int64_t Id = 0;
+        };
+        //--------------------------------------------------------------------------------------------------------------
+
+        /**
+         * Paces outgoing messages by token buckets keyed by (bot_id, chat_id) and by a global bucket per bot.
+         * A chat answered with 429 is parked until retry_after expires; other chats of the bot are not affected.
+         */
+        class COutboxScheduler {
+        private:
+
+            struct CChatQueue {
+                std::deque<int64_t> Items;
+                CTokenBucket Bucket;
+                CDateTime Parked = 0;
+                bool Ready = false;
+            };
+
+            struct CBotQueue {
+                CTokenBucket Bucket;
+                std::map<int64_t, CChatQueue> Chats;
+                std::deque<int64_t> Ready;
+            };
+
+            std::map<std::string, CBotQueue> m_Bots;
+
+            size_t m_Count;
+
+            double m_BotRate;
+            double m_ChatRate;
+            double m_GroupRate;
+
+            CBotQueue &GetBot(const std::string &BotId);
+            CChatQueue &GetChat(CBotQueue &Bot, int64_t ChatId);
+
+            static void MakeReady(CBotQueue &Bot, CChatQueue &Chat, int64_t ChatId);
+
+            size_t ReleaseBot(const std::string &BotId, CBotQueue &Bot, CDateTime Now, size_t Limit, std::vector<COutboxItem> &Items);
+
+        public:
+
+            COutboxScheduler();
+
+            ~COutboxScheduler() = default;
+
+            void Clear();
+
+            void Push(const std::string &BotId, int64_t ChatId, int64_t Id);
+            void Retry(const std::string &BotId, int64_t ChatId, int64_t Id, int RetryAfter, CDateTime Now);
+
+            size_t Release(CDateTime Now, size_t Limit, std::vector<COutboxItem> &Items);
+
+            size_t Count() const { return m_Count; };
+
+            double BotRate() const { return m_BotRate; };
+            void BotRate(double Value) { m_BotRate = Value; };
+
+            double ChatRate() const { return m_ChatRate; };
+            void ChatRate(double Value) { m_ChatRate = Value; };
+
+            double GroupRate() const { return m_GroupRate; };
+            void GroupRate(double Value) { m_GroupRate = Value; };
+
+        };
+
+    }
+}
+
+using namespace Apostol::Processes;
+}
+#endif //APOSTOL_PROCESS_TELEGRAM_BOT_OUTBOX_HPP
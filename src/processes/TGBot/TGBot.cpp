@@ -28,6 +28,21 @@ Author:
 #define CONFIG_SECTION_NAME "process/TGBot"
 #define SLEEP_SECOND_AFTER_ERROR 10
 #define PG_LISTEN_NAME "tg_bot"
+#define PG_LISTEN_OUTBOX "tg_outbox"
+#define PG_LISTEN_POLL "tg_poll"
+#define PG_LISTEN_DOWNLOAD "tg_download"
+#define PG_LISTEN_UPLOAD "tg_upload"
+#define PG_LISTEN_IMPORT "tg_import"
+
+#define OUTBOX_FETCH_LIMIT 500
+#define OUTBOX_RELEASE_LIMIT 100
+
+#define POLL_RETRY_INTERVAL 5
+
+#define DOWNLOAD_FETCH_LIMIT 100
+#define UPLOAD_FETCH_LIMIT 100
+#define IMPORT_FETCH_LIMIT 10
+#define LOG_FLUSH_LIMIT 10000
 //----------------------------------------------------------------------------------------------------------------------
 
 extern "C++" {
@@ -90,11 +105,33 @@ namespace Apostol {
 
             m_CheckDate = 0;
             m_CallDate = 0;
+            m_FlushDate = 0;
+            m_MaintenanceDate = 0;
+            m_TransferDate = 0;
+            m_OutboxDate = 0;
 
             m_Progress = 0;
             m_MaxQueue = Config()->PostgresPollMin();
 
             m_HeartbeatInterval = 5000;
+            m_HeartbeatTimeout = 30000;
+
+            m_OutboxFetching = false;
+            m_OutboxPending = false;
+
+            m_RegistryLoading = false;
+
+            m_DownloadFetching = false;
+            m_DownloadPending = false;
+
+            m_UploadFetching = false;
+            m_UploadPending = false;
+
+            m_ImportFetching = false;
+            m_ImportPending = false;
+
+            m_LogFlushInterval = 1000;
+            m_LogFlushing = false;
 
             m_Status = psStopped;
         }
@@ -113,6 +150,14 @@ namespace Apostol {
 
             InitializePQClients(Application()->Title(), 1, Config()->PostgresPollMin());
 
+            try {
+                m_Transfer.Start();
+            } catch (Delphi::Exception::Exception &E) {
+                DoError(E);
+            }
+
+            m_Import.Start();
+
             SigProcMask(SIG_UNBLOCK);
 
             SetTimerInterval(1000);
@@ -121,6 +166,8 @@ namespace Apostol {
 
         void CTGBot::AfterRun() {
             CApplicationProcess::AfterRun();
+            m_Transfer.Stop();
+            m_Import.Stop();
             PQClientsStop();
         }
         //--------------------------------------------------------------------------------------------------------------
@@ -175,6 +222,51 @@ namespace Apostol {
 
             m_Status = psStopped;
 
+            m_Outbox.BotRate(Config()->IniFile().ReadInteger(CONFIG_SECTION_NAME, "rate_limit", 30));
+            m_Outbox.ChatRate(Config()->IniFile().ReadInteger(CONFIG_SECTION_NAME, "chat_rate_limit", 1));
+            m_Outbox.GroupRate((double) Config()->IniFile().ReadInteger(CONFIG_SECTION_NAME, "group_rate_limit", 20) / 60);
+
+            // The worker thread uses these settings, they are applied at start only
+            if (!m_Transfer.Running()) {
+                m_Transfer.Store(Config()->IniFile().ReadString(CONFIG_SECTION_NAME, "file_store", Config()->Prefix() + "files").c_str());
+                m_Transfer.Limit(Config()->IniFile().ReadInteger(CONFIG_SECTION_NAME, "download_limit", 8));
+                m_Transfer.HostLimit(Config()->IniFile().ReadInteger(CONFIG_SECTION_NAME, "transfer_host_limit", 4));
+            }
+
+            // The importer loads files with COPY and exports upload queries over its own connection (as the worker)
+            if (!m_Import.Running()) {
+                m_Import.Store(Config()->IniFile().ReadString(CONFIG_SECTION_NAME, "file_store", Config()->Prefix() + "files").c_str());
+
+                const CString Section("postgres/worker");
+                const char *Keys[] = {"host", "hostaddr", "port", "dbname", "user", "password"};
+
+                std::string ConnInfo;
+
+                for (const auto Key : Keys) {
+                    const auto &Value = Config()->IniFile().ReadString(Section, Key, "");
+                    if (Value.IsEmpty())
+                        continue;
+
+                    ConnInfo.append(ConnInfo.empty() ? "" : " ").append(Key).append("='");
+                    for (auto p = Value.c_str(); *p != 0; ++p) {
+                        if (*p == '\\' || *p == '\'')
+                            ConnInfo.push_back('\\');
+                        ConnInfo.push_back(*p);
+                    }
+                    ConnInfo.append("'");
+                }
+
+                m_Import.ConnInfo(ConnInfo.append(" application_name='").append(APP_NAME).append(" import'"));
+            }
+
+            m_HeartbeatInterval = Config()->IniFile().ReadInteger(CONFIG_SECTION_NAME, "heartbeat_interval", 5000);
+            m_HeartbeatTimeout = Config()->IniFile().ReadInteger(CONFIG_SECTION_NAME, "heartbeat_timeout", 30000);
+
+            m_LogFlushInterval = Config()->IniFile().ReadInteger(CONFIG_SECTION_NAME, "log_flush_interval", 1000);
+            m_LogRetention = Config()->IniFile().ReadString(CONFIG_SECTION_NAME, "log_retention", "3 months");
+
+            m_UploadCache.Capacity(Config()->IniFile().ReadInteger(CONFIG_SECTION_NAME, "upload_cache", 10000));
+
             Log()->Notice("[%s] Successful reloading", CONFIG_SECTION_NAME);
         }
         //--------------------------------------------------------------------------------------------------------------
@@ -206,12 +298,24 @@ namespace Apostol {
                     }
 
                     APollQuery->Connection()->Listeners().Add(PG_LISTEN_NAME);
+                    APollQuery->Connection()->Listeners().Add(PG_LISTEN_OUTBOX);
+                    APollQuery->Connection()->Listeners().Add(PG_LISTEN_POLL);
+                    APollQuery->Connection()->Listeners().Add(PG_LISTEN_BOT_LIST);
+                    APollQuery->Connection()->Listeners().Add(PG_LISTEN_DOWNLOAD);
+                    APollQuery->Connection()->Listeners().Add(PG_LISTEN_UPLOAD);
+                    APollQuery->Connection()->Listeners().Add(PG_LISTEN_IMPORT);
 #if defined(_GLIBCXX_RELEASE) && (_GLIBCXX_RELEASE >= 9)
                     APollQuery->Connection()->OnNotify([this](auto && APollQuery, auto && ANotify) { DoPostgresNotify(APollQuery, ANotify); });
 #else
                     APollQuery->Connection()->OnNotify(std::bind(&CPGFetch::DoPostgresNotify, this, _1, _2));
 #endif
                     m_Status = Process::psRunning;
+
+                    InitOutbox();
+                    InitDownloads();
+                    InitUploads();
+                    InitImports();
+                    LoadRegistry();
                 } catch (Delphi::Exception::Exception &E) {
                     DoError(E);
                 }
@@ -224,6 +328,12 @@ namespace Apostol {
             CStringList SQL;
 
             SQL.Add("LISTEN " PG_LISTEN_NAME ";");
+            SQL.Add("LISTEN " PG_LISTEN_OUTBOX ";");
+            SQL.Add("LISTEN " PG_LISTEN_POLL ";");
+            SQL.Add("LISTEN " PG_LISTEN_BOT_LIST ";");
+            SQL.Add("LISTEN " PG_LISTEN_DOWNLOAD ";");
+            SQL.Add("LISTEN " PG_LISTEN_UPLOAD ";");
+            SQL.Add("LISTEN " PG_LISTEN_IMPORT ";");
 
             try {
                 ExecSQL(SQL, nullptr, OnExecuted, OnException);
@@ -234,8 +344,13 @@ namespace Apostol {
         //--------------------------------------------------------------------------------------------------------------
 
         void CTGBot::CheckListen() {
-            if (!GetPQClient().CheckListen(PG_LISTEN_NAME))
+            auto &PQClient = GetPQClient();
+            if (!PQClient.CheckListen(PG_LISTEN_NAME) || !PQClient.CheckListen(PG_LISTEN_OUTBOX) || !PQClient.CheckListen(PG_LISTEN_POLL) || !PQClient.CheckListen(PG_LISTEN_BOT_LIST) || !PQClient.CheckListen(PG_LISTEN_DOWNLOAD) || !PQClient.CheckListen(PG_LISTEN_UPLOAD) || !PQClient.CheckListen(PG_LISTEN_IMPORT)) {
                 InitListen();
+            } else {
+                // Handlers could be created or dropped without changes in bot.list
+                LoadRegistry();
+            }
         }
         //--------------------------------------------------------------------------------------------------------------
 
@@ -304,67 +419,1139 @@ namespace Apostol {
         }
         //--------------------------------------------------------------------------------------------------------------
 
-        void CTGBot::CallHeartbeat() {
+        void CTGBot::CallHeartbeat(CDateTime Now) {
+
+            if (!m_Registry.Loaded()) {
+                CStringList SQL;
+
+                SQL.Add("SELECT bot.heartbeat();");
+
+                try {
+                    ExecSQL(SQL);
+                } catch (Delphi::Exception::Exception &E) {
+                    DoFatal(E);
+                }
+
+                return;
+            }
+
+            for (auto it = m_Heartbeats.begin(); it != m_Heartbeats.end();) {
+                if (!it->second.Active && m_Registry.Bots().count(it->first) == 0) {
+                    it = m_Heartbeats.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+
+            // Every bot is called on its own pool connection and in its own transaction:
+            // a slow or failing handler does not hold or roll back the others
+            for (const auto &it : m_Registry.Bots()) {
+                const auto &Bot = it.second;
+
+                if (Bot.Heartbeat.IsEmpty())
+                    continue;
+
+                auto &State = m_Heartbeats[it.first];
+
+                if (State.Active) {
+                    if (Now >= State.Deadline && !State.Overrun) {
+                        State.Overrun = true;
+                        Log()->Error(APP_LOG_WARN, 0, "[%s] [%s] Heartbeat overrun: no response in %d ms", CONFIG_SECTION_NAME,
+                                     Bot.Username.c_str(), m_HeartbeatTimeout);
+                    }
+                    continue;
+                }
+
+                const auto &BotId = Bot.Id;
+
+                auto OnExecuted = [this, BotId](CPQPollQuery *APollQuery) {
+                    CString Error;
+
+                    for (int i = 0; i < APollQuery->Count(); i++) {
+                        auto pResult = APollQuery->Results(i);
+                        if (pResult->ExecStatus() != PGRES_COMMAND_OK && pResult->ExecStatus() != PGRES_TUPLES_OK) {
+                            Error = pResult->GetErrorMessage();
+                            break;
+                        }
+                    }
+
+                    HeartbeatDone(BotId, Error);
+                };
+
+                auto OnException = [this, BotId](CPQPollQuery *APollQuery, const Delphi::Exception::Exception &E) {
+                    HeartbeatDone(BotId, E.what());
+                };
+
+                CStringList SQL;
+
+                // Deadline: the statement is cancelled by the server, the transaction is rolled back
+                SQL.Add(CString().Format("SET LOCAL statement_timeout = %d;", m_HeartbeatTimeout));
+                SQL.Add(CString().Format("SELECT %s(%s::uuid);", Bot.Heartbeat.c_str(), PQQuoteLiteral(Bot.Id).c_str()));
+
+                try {
+                    ExecSQL(SQL, nullptr, OnExecuted, OnException);
+
+                    State.Active = true;
+                    State.Overrun = false;
+                    State.Started = Now;
+                    State.Deadline = Now + (CDateTime) m_HeartbeatTimeout / MSecsPerDay;
+                } catch (Delphi::Exception::Exception &E) {
+                    DoError(E);
+                    break;
+                }
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTGBot::HeartbeatDone(const CString &BotId, const CString &Error) {
+            auto it = m_Heartbeats.find(BotId.c_str());
+            if (it == m_Heartbeats.end())
+                return;
+
+            auto &State = it->second;
+
+            const auto *pBot = m_Registry.Find(BotId);
+            const auto &Name = pBot == nullptr ? BotId : pBot->Username;
+
+            const auto Elapsed = (int) ((Now() - State.Started) * MSecsPerDay);
+
+            State.Active = false;
+
+            if (!Error.IsEmpty()) {
+                Log()->Error(APP_LOG_ERR, 0, "[%s] [%s] Heartbeat: %s", CONFIG_SECTION_NAME, Name.c_str(), Error.c_str());
+            } else if (State.Overrun || Elapsed > m_HeartbeatInterval) {
+                Log()->Error(APP_LOG_WARN, 0, "[%s] [%s] Heartbeat took %d ms (interval %d ms)", CONFIG_SECTION_NAME,
+                             Name.c_str(), Elapsed, m_HeartbeatInterval);
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTGBot::InitOutbox() {
+
+            auto OnExecuted = [this](CPQPollQuery *APollQuery) {
+                try {
+                    auto pResult = APollQuery->Results(0);
+
+                    if (pResult->ExecStatus() != PGRES_TUPLES_OK) {
+                        throw Delphi::Exception::EDBError(pResult->GetErrorMessage());
+                    }
+
+                    FetchOutbox();
+                } catch (Delphi::Exception::Exception &E) {
+                    DoError(E);
+                }
+            };
+
+            auto OnException = [](CPQPollQuery *APollQuery, const Delphi::Exception::Exception &E) {
+                DoError(E);
+            };
 
             CStringList SQL;
 
-            SQL.Add("SELECT bot.heartbeat();");
+            SQL.Add("SELECT bot.outbox_reset();");
+
+            m_Outbox.Clear();
+
+            m_OutboxFetching = false;
+            m_OutboxPending = false;
 
             try {
-                ExecSQL(SQL);
+                ExecSQL(SQL, nullptr, OnExecuted, OnException);
             } catch (Delphi::Exception::Exception &E) {
-                DoFatal(E);
+                DoError(E);
             }
         }
         //--------------------------------------------------------------------------------------------------------------
 
-        void CTGBot::Heartbeat(CDateTime Now) {
-            if (Now >= m_CheckDate) {
-                m_CheckDate = Now + (CDateTime) 1 / MinsPerDay; // 1 min
-                CheckListen();
+        void CTGBot::FetchOutbox() {
+
+            if (m_OutboxFetching) {
+                m_OutboxPending = true;
+                return;
             }
 
-            UnloadQueue();
-            CheckTimeOut(Now);
+            auto OnExecuted = [this](CPQPollQuery *APollQuery) {
+                m_OutboxFetching = false;
 
-            if (m_Status == psRunning) {
-                if ((Now >= m_CallDate)) {
-                    m_CallDate = Now + (CDateTime) m_HeartbeatInterval / MSecsPerDay;
-                    CallHeartbeat();
+                try {
+                    auto pResult = APollQuery->Results(0);
+
+                    if (pResult->ExecStatus() != PGRES_TUPLES_OK) {
+                        throw Delphi::Exception::EDBError(pResult->GetErrorMessage());
+                    }
+
+                    for (int row = 0; row < pResult->nTuples(); ++row) {
+                        m_Outbox.Push(pResult->GetValue(row, 1), strtoll(pResult->GetValue(row, 2), nullptr, 10), strtoll(pResult->GetValue(row, 0), nullptr, 10));
+                    }
+
+                    if (pResult->nTuples() == OUTBOX_FETCH_LIMIT)
+                        m_OutboxPending = true;
+
+                    ReleaseOutbox(Now());
+                } catch (Delphi::Exception::Exception &E) {
+                    DoError(E);
+                }
+
+                if (m_OutboxPending) {
+                    m_OutboxPending = false;
+                    FetchOutbox();
+                }
+            };
+
+            auto OnException = [this](CPQPollQuery *APollQuery, const Delphi::Exception::Exception &E) {
+                m_OutboxFetching = false;
+                DoError(E);
+            };
+
+            CStringList SQL;
+
+            SQL.Add(CString().Format("SELECT id, bot_id, chat_id FROM bot.outbox_fetch(%d);", OUTBOX_FETCH_LIMIT));
+
+            try {
+                ExecSQL(SQL, nullptr, OnExecuted, OnException);
+                m_OutboxFetching = true;
+            } catch (Delphi::Exception::Exception &E) {
+                DoError(E);
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTGBot::ReleaseOutbox(CDateTime Now) {
+            if (m_Outbox.Count() == 0)
+                return;
+
+            std::vector<COutboxItem> Items;
+
+            while (m_Outbox.Release(Now, OUTBOX_RELEASE_LIMIT, Items) > 0) {
+                CString Array;
+
+                for (const auto &Item : Items) {
+                    if (!Array.IsEmpty())
+                        Array << ",";
+                    Array << CString().Format("%lld", (long long) Item.Id);
                 }
+
+                auto OnExecuted = [this, Items](CPQPollQuery *APollQuery) {
+                    auto pResult = APollQuery->Results(0);
+
+                    if (pResult->ExecStatus() != PGRES_TUPLES_OK) {
+                        RestoreOutbox(Items);
+                        DoError(Delphi::Exception::EDBError(pResult->GetErrorMessage()));
+                    }
+                };
+
+                auto OnException = [this, Items](CPQPollQuery *APollQuery, const Delphi::Exception::Exception &E) {
+                    RestoreOutbox(Items);
+                    DoError(E);
+                };
+
+                CStringList SQL;
+
+                SQL.Add(CString().Format("SELECT bot.outbox_send(ARRAY[%s]::bigint[]);", Array.c_str()));
+
+                try {
+                    ExecSQL(SQL, nullptr, OnExecuted, OnException);
+                } catch (Delphi::Exception::Exception &E) {
+                    RestoreOutbox(Items);
+                    DoError(E);
+                    break;
+                }
+
+                Items.clear();
             }
         }
         //--------------------------------------------------------------------------------------------------------------
 
-        void CTGBot::DoTimer(CPollEventHandler *AHandler) {
-            uint64_t exp;
+        void CTGBot::RestoreOutbox(const std::vector<COutboxItem> &Items) {
+            // Not sent: the messages stay scheduled (state 1), they go back to the head of their chats
+            for (auto it = Items.rbegin(); it != Items.rend(); ++it) {
+                m_Outbox.Retry(it->BotId, it->ChatId, it->Id, SLEEP_SECOND_AFTER_ERROR, Now());
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
 
-            auto pTimer = dynamic_cast<CEPollTimer *> (AHandler->Binding());
-            pTimer->Read(&exp, sizeof(uint64_t));
+        void CTGBot::RecoverOutbox() {
+            CStringList SQL;
+
+            // Sent messages whose request got no answer are queued again (a wakeup follows)
+            SQL.Add("SELECT bot.outbox_recover();");
 
             try {
-                Heartbeat(AHandler->TimeStamp());
+                ExecSQL(SQL);
             } catch (Delphi::Exception::Exception &E) {
-                DoServerEventHandlerException(AHandler, E);
+                DoError(E);
             }
         }
         //--------------------------------------------------------------------------------------------------------------
 
-        bool CTGBot::DoExecute(CTCPConnection *AConnection) {
-            return true;
+        void CTGBot::RetryOutbox(const CJSON &Payload) {
+            const auto &botId = Payload["bot_id"].AsString();
+            const auto chatId = strtoll(Payload["chat_id"].AsString().c_str(), nullptr, 10);
+            const auto id = strtoll(Payload["id"].AsString().c_str(), nullptr, 10);
+            const auto retryAfter = StrToIntDef(Payload["retry_after"].AsString().c_str(), 1);
+
+            Log()->Notice("[%s] [%s] [%lld] Too Many Requests: retry after %d sec", CONFIG_SECTION_NAME, botId.c_str(), (long long) chatId, retryAfter);
+
+            m_Outbox.Retry(botId.c_str(), chatId, id, retryAfter, Now());
         }
         //--------------------------------------------------------------------------------------------------------------
 
-        void CTGBot::DoPostgresNotify(CPQConnection *AConnection, PGnotify *ANotify) {
-            DebugNotify(AConnection, ANotify);
+        void CTGBot::LoadRegistry() {
 
-            if (CompareString(ANotify->relname, PG_LISTEN_NAME) == 0) {
-#if defined(_GLIBCXX_RELEASE) && (_GLIBCXX_RELEASE >= 9)
-                new CBotHandler(this, ANotify->extra, [this](auto &&Handler) { DoBot(Handler); });
-#else
-                new CBotHandler(this, ANotify->extra, std::bind(&CTGBot::DoBot, this, _1));
-#endif
-                UnloadQueue();
+            if (m_RegistryLoading)
+                return;
+
+            const auto generation = m_Registry.Generation();
+
+            auto OnExecuted = [this, generation](CPQPollQuery *APollQuery) {
+                m_RegistryLoading = false;
+
+                try {
+                    auto pResult = APollQuery->Results(0);
+
+                    if (pResult->ExecStatus() != PGRES_TUPLES_OK) {
+                        throw Delphi::Exception::EDBError(pResult->GetErrorMessage());
+                    }
+
+                    // A bot was updated while loading: the result is stale
+                    if (!m_Registry.Load(pResult, generation)) {
+                        LoadRegistry();
+                        return;
+                    }
+
+                    SyncPolling();
+                } catch (Delphi::Exception::Exception &E) {
+                    DoError(E);
+                }
+            };
+
+            auto OnException = [this](CPQPollQuery *APollQuery, const Delphi::Exception::Exception &E) {
+                m_RegistryLoading = false;
+                DoError(E);
+            };
+
+            CStringList SQL;
+
+            SQL.Add(CBotRegistry::SQL());
+
+            try {
+                ExecSQL(SQL, nullptr, OnExecuted, OnException);
+                m_RegistryLoading = true;
+            } catch (Delphi::Exception::Exception &E) {
+                DoError(E);
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTGBot::UpdateRegistry(const CString &Id) {
+
+            auto OnExecuted = [this, Id](CPQPollQuery *APollQuery) {
+                try {
+                    auto pResult = APollQuery->Results(0);
+
+                    if (pResult->ExecStatus() != PGRES_TUPLES_OK) {
+                        throw Delphi::Exception::EDBError(pResult->GetErrorMessage());
+                    }
+
+                    m_Registry.Update(Id, pResult);
+                    SyncPolling();
+                } catch (Delphi::Exception::Exception &E) {
+                    DoError(E);
+                }
+            };
+
+            auto OnException = [](CPQPollQuery *APollQuery, const Delphi::Exception::Exception &E) {
+                DoError(E);
+            };
+
+            CStringList SQL;
+
+            SQL.Add(CBotRegistry::SQL(Id));
+
+            try {
+                ExecSQL(SQL, nullptr, OnExecuted, OnException);
+            } catch (Delphi::Exception::Exception &E) {
+                DoError(E);
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTGBot::InitDownloads() {
+
+            auto OnExecuted = [this](CPQPollQuery *APollQuery) {
+                try {
+                    auto pResult = APollQuery->Results(0);
+
+                    if (pResult->ExecStatus() != PGRES_TUPLES_OK) {
+                        throw Delphi::Exception::EDBError(pResult->GetErrorMessage());
+                    }
+
+                    FetchDownloads();
+                } catch (Delphi::Exception::Exception &E) {
+                    DoError(E);
+                }
+            };
+
+            auto OnException = [](CPQPollQuery *APollQuery, const Delphi::Exception::Exception &E) {
+                DoError(E);
+            };
+
+            CStringList SQL;
+
+            SQL.Add("SELECT bot.download_reset();");
+
+            m_DownloadFetching = false;
+            m_DownloadPending = false;
+
+            try {
+                ExecSQL(SQL, nullptr, OnExecuted, OnException);
+            } catch (Delphi::Exception::Exception &E) {
+                DoError(E);
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTGBot::FetchDownloads() {
+
+            if (m_DownloadFetching) {
+                m_DownloadPending = true;
+                return;
+            }
+
+            auto OnExecuted = [this](CPQPollQuery *APollQuery) {
+                m_DownloadFetching = false;
+
+                try {
+                    auto pResult = APollQuery->Results(0);
+
+                    if (pResult->ExecStatus() != PGRES_TUPLES_OK) {
+                        throw Delphi::Exception::EDBError(pResult->GetErrorMessage());
+                    }
+
+                    for (int row = 0; row < pResult->nTuples(); ++row) {
+                        m_Transfer.Download(strtoll(pResult->GetValue(row, 0), nullptr, 10), pResult->GetValue(row, 1));
+                    }
+
+                    if (pResult->nTuples() == DOWNLOAD_FETCH_LIMIT)
+                        m_DownloadPending = true;
+                } catch (Delphi::Exception::Exception &E) {
+                    DoError(E);
+                }
+
+                if (m_DownloadPending) {
+                    m_DownloadPending = false;
+                    FetchDownloads();
+                }
+            };
+
+            auto OnException = [this](CPQPollQuery *APollQuery, const Delphi::Exception::Exception &E) {
+                m_DownloadFetching = false;
+                DoError(E);
+            };
+
+            CStringList SQL;
+
+            SQL.Add(CString().Format("SELECT id, url FROM bot.download_fetch(%d);", DOWNLOAD_FETCH_LIMIT));
+
+            try {
+                ExecSQL(SQL, nullptr, OnExecuted, OnException);
+                m_DownloadFetching = true;
+            } catch (Delphi::Exception::Exception &E) {
+                DoError(E);
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTGBot::InitUploads() {
+
+            auto OnExecuted = [this](CPQPollQuery *APollQuery) {
+                try {
+                    auto pResult = APollQuery->Results(0);
+
+                    if (pResult->ExecStatus() != PGRES_TUPLES_OK) {
+                        throw Delphi::Exception::EDBError(pResult->GetErrorMessage());
+                    }
+
+                    pResult = APollQuery->Results(1);
+
+                    if (pResult->ExecStatus() != PGRES_TUPLES_OK) {
+                        throw Delphi::Exception::EDBError(pResult->GetErrorMessage());
+                    }
+
+                    m_UploadCache.Clear();
+
+                    // Most recently used last: they stay at the head of the cache
+                    for (int row = pResult->nTuples() - 1; row >= 0; --row) {
+                        m_UploadCache.Add(pResult->GetValue(row, 0), pResult->GetValue(row, 1), pResult->GetValue(row, 2));
+                    }
+
+                    FetchUploads();
+                } catch (Delphi::Exception::Exception &E) {
+                    DoError(E);
+                }
+            };
+
+            auto OnException = [](CPQPollQuery *APollQuery, const Delphi::Exception::Exception &E) {
+                DoError(E);
+            };
+
+            CStringList SQL;
+
+            SQL.Add("SELECT bot.upload_reset();");
+            SQL.Add(CString().Format("SELECT bot_id, hash, file_id FROM bot.upload_cache_load(%u);", (unsigned) m_UploadCache.Capacity()));
+
+            m_UploadFetching = false;
+            m_UploadPending = false;
+
+            try {
+                ExecSQL(SQL, nullptr, OnExecuted, OnException);
+            } catch (Delphi::Exception::Exception &E) {
+                DoError(E);
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTGBot::FetchUploads() {
+
+            if (m_UploadFetching) {
+                m_UploadPending = true;
+                return;
+            }
+
+            auto OnExecuted = [this](CPQPollQuery *APollQuery) {
+                m_UploadFetching = false;
+
+                try {
+                    auto pResult = APollQuery->Results(0);
+
+                    if (pResult->ExecStatus() != PGRES_TUPLES_OK) {
+                        throw Delphi::Exception::EDBError(pResult->GetErrorMessage());
+                    }
+
+                    for (int row = 0; row < pResult->nTuples(); ++row) {
+                        CTransferJob Job;
+
+                        Job.Id = strtoll(pResult->GetValue(row, 0), nullptr, 10);
+                        Job.Url = pResult->GetValue(row, 1);
+                        Job.Fields.emplace_back("chat_id", pResult->GetValue(row, 2));
+                        if (!pResult->GetIsNull(row, 5))
+                            Job.Fields.emplace_back("caption", pResult->GetValue(row, 5));
+                        Job.Field = "document";
+                        Job.FileName = pResult->GetValue(row, 3);
+                        Job.ContentType = pResult->GetValue(row, 4);
+                        Job.Tag = pResult->GetValue(row, 8);
+
+                        if (!pResult->GetIsNull(row, 9))
+                            Job.Hash = pResult->GetValue(row, 9);
+
+                        if (!pResult->GetIsNull(row, 10)) {
+                            Job.FileId = pResult->GetValue(row, 10);
+                            m_UploadCache.Add(Job.Tag, Job.Hash, Job.FileId);
+                        } else {
+                            const auto pFileId = m_UploadCache.Find(Job.Tag, Job.Hash);
+                            if (pFileId != nullptr)
+                                Job.FileId = *pFileId;
+                        }
+
+                        if (pResult->GetIsNull(row, 6)) {
+                            ExportUpload(std::move(Job), pResult->GetValue(row, 7));
+                        } else {
+                            Job.Path = pResult->GetValue(row, 6);
+                            m_Transfer.Upload(std::move(Job));
+                        }
+                    }
+
+                    if (pResult->nTuples() == UPLOAD_FETCH_LIMIT)
+                        m_UploadPending = true;
+                } catch (Delphi::Exception::Exception &E) {
+                    DoError(E);
+                }
+
+                if (m_UploadPending) {
+                    m_UploadPending = false;
+                    FetchUploads();
+                }
+            };
+
+            auto OnException = [this](CPQPollQuery *APollQuery, const Delphi::Exception::Exception &E) {
+                m_UploadFetching = false;
+                DoError(E);
+            };
+
+            CStringList SQL;
+
+            SQL.Add(CString().Format("SELECT id, url, chat_id, file_name, content_type, caption, path, query, bot_id, hash, file_id FROM bot.upload_fetch(%d);", UPLOAD_FETCH_LIMIT));
+
+            try {
+                ExecSQL(SQL, nullptr, OnExecuted, OnException);
+                m_UploadFetching = true;
+            } catch (Delphi::Exception::Exception &E) {
+                DoError(E);
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTGBot::ExportUpload(CTransferJob &&Job, const CString &Query) {
+            // The query result is streamed to the file store by the importer thread (see DoneExports)
+            m_Import.Export(std::move(Job), Query.c_str());
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTGBot::DoneExports() {
+            std::vector<CExportResult> Results;
+
+            if (m_Import.Exported(Results) == 0)
+                return;
+
+            for (auto &Result : Results) {
+                auto &Job = Result.Job;
+
+                if (!Result.Error.empty()) {
+                    UploadError(Job.Id, Result.Error.c_str());
+                    continue;
+                }
+
+                const auto pFileId = m_UploadCache.Find(Job.Tag, Job.Hash);
+                if (pFileId != nullptr)
+                    Job.FileId = *pFileId;
+
+                m_Transfer.Upload(std::move(Job));
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTGBot::UploadError(int64_t Id, const CString &Error) {
+            Log()->Error(APP_LOG_WARN, 0, "[%s] Upload %lld failed: %s", CONFIG_SECTION_NAME, (long long) Id, Error.c_str());
+
+            CStringList SQL;
+
+            SQL.Add(CString().Format("SELECT bot.upload_done(%lld, -1, null, %s);", (long long) Id, PQQuoteLiteral(Error).c_str()));
+
+            try {
+                ExecSQL(SQL);
+            } catch (Delphi::Exception::Exception &E) {
+                DoError(E);
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTGBot::CacheUpload(const CTransferResult &Result) {
+            if (Result.Hash.empty())
+                return;
+
+            if (Result.Status == 400 && !Result.FileId.empty()) {
+                // Rejected file_id, the document will be uploaded again (see bot.upload_done)
+                m_UploadCache.Delete(Result.Tag, Result.Hash);
+                return;
+            }
+
+            if (Result.Status != 200)
+                return;
+
+            try {
+                CJSON Json;
+
+                Json << Result.Response.c_str();
+
+                const auto &fileId = Json["result"]["document"]["file_id"].AsString();
+                if (!fileId.IsEmpty())
+                    m_UploadCache.Add(Result.Tag, Result.Hash, fileId.c_str());
+            } catch (Delphi::Exception::Exception &E) {
+                Log()->Error(APP_LOG_WARN, 0, "[%s] Upload %lld: %s", CONFIG_SECTION_NAME, (long long) Result.Id, E.what());
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTGBot::ReportTransfers() {
+            std::map<std::string, CTransferHost> Hosts;
+
+            if (m_Transfer.Hosts(Hosts) == 0)
+                return;
+
+            for (const auto &it : Hosts) {
+                const auto &Host = it.second;
+                const auto Count = Host.Done + Host.Failed;
+
+                if (Count == 0 && Host.Queued == 0 && Host.Active == 0)
+                    continue;
+
+                Log()->Debug(APP_LOG_DEBUG_CORE, "[%s] Transfers [%s]: queued %d, active %d, done %llu, failed %llu, reused %llu, latency avg %d ms, max %d ms",
+                             CONFIG_SECTION_NAME, it.first.c_str(), (int) Host.Queued, (int) Host.Active,
+                             (unsigned long long) Host.Done, (unsigned long long) Host.Failed, (unsigned long long) Host.Reused,
+                             Count == 0 ? 0 : (int) (Host.Latency * 1000 / (double) Count), (int) (Host.MaxLatency * 1000));
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTGBot::DoneTransfers() {
+            std::vector<CTransferResult> Results;
+
+            if (m_Transfer.Completed(Results) == 0)
+                return;
+
+            auto Literal = [](const std::string &Value) {
+                return Value.empty() ? CString("null") : PQQuoteLiteral(Value.c_str());
+            };
+
+            for (const auto &Result : Results) {
+                if (!Result.Error.empty())
+                    Log()->Error(APP_LOG_WARN, 0, "[%s] %s %lld failed (%ld): %s", CONFIG_SECTION_NAME, Result.Type == ttUpload ? "Upload" : "Download",
+                                 (long long) Result.Id, Result.Status, Result.Error.c_str());
+
+                CStringList SQL;
+
+                if (Result.Type == ttUpload) {
+                    CacheUpload(Result);
+
+                    SQL.Add(CString().Format("SELECT bot.upload_done(%lld, %ld, %s, %s, %s, %s, %s);",
+                                             (long long) Result.Id,
+                                             Result.Status,
+                                             Literal(Result.Response).c_str(),
+                                             Literal(Result.Error).c_str(),
+                                             Literal(Result.Path).c_str(),
+                                             Literal(Result.Hash).c_str(),
+                                             Literal(Result.FileId).c_str()));
+                } else {
+                    SQL.Add(CString().Format("SELECT bot.download_done(%lld, %s, %llu, %s, %s);",
+                                             (long long) Result.Id,
+                                             Literal(Result.Path).c_str(),
+                                             (unsigned long long) Result.Size,
+                                             Literal(Result.Hash).c_str(),
+                                             Literal(Result.Error).c_str()));
+                }
+
+                try {
+                    ExecSQL(SQL);
+                } catch (Delphi::Exception::Exception &E) {
+                    DoError(E);
+                }
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTGBot::InitImports() {
+
+            auto OnExecuted = [this](CPQPollQuery *APollQuery) {
+                try {
+                    auto pResult = APollQuery->Results(0);
+
+                    if (pResult->ExecStatus() != PGRES_TUPLES_OK) {
+                        throw Delphi::Exception::EDBError(pResult->GetErrorMessage());
+                    }
+
+                    FetchImports();
+                } catch (Delphi::Exception::Exception &E) {
+                    DoError(E);
+                }
+            };
+
+            auto OnException = [](CPQPollQuery *APollQuery, const Delphi::Exception::Exception &E) {
+                DoError(E);
+            };
+
+            CStringList SQL;
+
+            SQL.Add("SELECT bot.import_reset();");
+
+            m_ImportFetching = false;
+            m_ImportPending = false;
+
+            try {
+                ExecSQL(SQL, nullptr, OnExecuted, OnException);
+            } catch (Delphi::Exception::Exception &E) {
+                DoError(E);
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTGBot::FetchImports() {
+
+            if (m_ImportFetching) {
+                m_ImportPending = true;
+                return;
+            }
+
+            auto OnExecuted = [this](CPQPollQuery *APollQuery) {
+                m_ImportFetching = false;
+
+                try {
+                    auto pResult = APollQuery->Results(0);
+
+                    if (pResult->ExecStatus() != PGRES_TUPLES_OK) {
+                        throw Delphi::Exception::EDBError(pResult->GetErrorMessage());
+                    }
+
+                    for (int row = 0; row < pResult->nTuples(); ++row) {
+                        CImportJob Job;
+
+                        Job.Id = strtoll(pResult->GetValue(row, 0), nullptr, 10);
+                        Job.Path = pResult->GetValue(row, 1);
+
+                        if (!pResult->GetIsNull(row, 2))
+                            Job.Encoding = pResult->GetValue(row, 2);
+
+                        m_Import.Add(std::move(Job));
+                    }
+
+                    if (pResult->nTuples() == IMPORT_FETCH_LIMIT)
+                        m_ImportPending = true;
+                } catch (Delphi::Exception::Exception &E) {
+                    DoError(E);
+                }
+
+                if (m_ImportPending) {
+                    m_ImportPending = false;
+                    FetchImports();
+                }
+            };
+
+            auto OnException = [this](CPQPollQuery *APollQuery, const Delphi::Exception::Exception &E) {
+                m_ImportFetching = false;
+                DoError(E);
+            };
+
+            CStringList SQL;
+
+            SQL.Add(CString().Format("SELECT id, path, encoding FROM bot.import_fetch(%d);", IMPORT_FETCH_LIMIT));
+
+            try {
+                ExecSQL(SQL, nullptr, OnExecuted, OnException);
+                m_ImportFetching = true;
+            } catch (Delphi::Exception::Exception &E) {
+                DoError(E);
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTGBot::DoneImports() {
+            std::vector<CImportResult> Results;
+
+            if (m_Import.Completed(Results) == 0)
+                return;
+
+            for (const auto &Result : Results) {
+                if (Result.Error.empty()) {
+                    Log()->Debug(APP_LOG_DEBUG_CORE, "[%s] Import %lld: %d lines, %d rows, %d rejected", CONFIG_SECTION_NAME,
+                                 (long long) Result.Id, Result.Lines, Result.Rows, Result.Rejected);
+                } else {
+                    Log()->Error(APP_LOG_WARN, 0, "[%s] Import %lld failed: %s", CONFIG_SECTION_NAME, (long long) Result.Id, Result.Error.c_str());
+                }
+
+                CStringList SQL;
+
+                SQL.Add(CString().Format("SELECT bot.import_done(%lld, %d, %d, %s);",
+                                         (long long) Result.Id,
+                                         Result.Rows,
+                                         Result.Rejected,
+                                         Result.Error.empty() ? "null" : PQQuoteLiteral(Result.Error.c_str()).c_str()));
+
+                try {
+                    ExecSQL(SQL);
+                } catch (Delphi::Exception::Exception &E) {
+                    DoError(E);
+                }
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTGBot::FlushEventLog() {
+
+            if (m_LogFlushing)
+                return;
+
+            auto OnExecuted = [this](CPQPollQuery *APollQuery) {
+                m_LogFlushing = false;
+
+                try {
+                    auto pResult = APollQuery->Results(0);
+
+                    if (pResult->ExecStatus() != PGRES_TUPLES_OK) {
+                        throw Delphi::Exception::EDBError(pResult->GetErrorMessage());
+                    }
+
+                    // A full batch: the buffer is not empty yet
+                    if (StrToIntDef(pResult->GetValue(0, 0), 0) == LOG_FLUSH_LIMIT)
+                        FlushEventLog();
+                } catch (Delphi::Exception::Exception &E) {
+                    DoError(E);
+                }
+            };
+
+            auto OnException = [this](CPQPollQuery *APollQuery, const Delphi::Exception::Exception &E) {
+                m_LogFlushing = false;
+                DoError(E);
+            };
+
+            CStringList SQL;
+
+            SQL.Add(CString().Format("SELECT bot.FlushEventLog(%d);", LOG_FLUSH_LIMIT));
+
+            try {
+                ExecSQL(SQL, nullptr, OnExecuted, OnException);
+                m_LogFlushing = true;
+            } catch (Delphi::Exception::Exception &E) {
+                DoError(E);
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTGBot::MaintainEventLog() {
+
+            auto OnExecuted = [](CPQPollQuery *APollQuery) {
+                try {
+                    auto pResult = APollQuery->Results(0);
+
+                    if (pResult->ExecStatus() != PGRES_TUPLES_OK) {
+                        throw Delphi::Exception::EDBError(pResult->GetErrorMessage());
+                    }
+
+                    const auto dropped = StrToIntDef(pResult->GetValue(0, 0), 0);
+                    if (dropped > 0)
+                        Log()->Notice("[%s] Event log: %d expired partition(s) dropped", CONFIG_SECTION_NAME, dropped);
+                } catch (Delphi::Exception::Exception &E) {
+                    DoError(E);
+                }
+            };
+
+            auto OnException = [](CPQPollQuery *APollQuery, const Delphi::Exception::Exception &E) {
+                DoError(E);
+            };
+
+            CStringList SQL;
+
+            // An empty retention keeps the history
+            SQL.Add(CString().Format("SELECT bot.log_maintenance(%s);", m_LogRetention.IsEmpty() ? "null" : PQQuoteLiteral(m_LogRetention).c_str()));
+            // Expired responses and callers of lost requests (see bot.fetch_cached)
+            SQL.Add("SELECT bot.fetch_cache_clean();");
+
+            try {
+                ExecSQL(SQL, nullptr, OnExecuted, OnException);
+            } catch (Delphi::Exception::Exception &E) {
+                DoError(E);
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTGBot::SyncPolling() {
+            std::map<std::string, CBotPolling> Polling;
+
+            for (const auto &it : m_Registry.Bots()) {
+                const auto &Bot = it.second;
+
+                if (!Bot.Polling())
+                    continue;
+
+                auto &State = Polling[it.first];
+
+                const auto current = m_Polling.find(it.first);
+                if (current != m_Polling.end())
+                    State = current->second;
+
+                State.Timeout = Bot.PollTimeout;
+            }
+
+            m_Polling.swap(Polling);
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTGBot::Poll(CDateTime Now) {
+            for (auto &it : m_Polling) {
+                auto &State = it.second;
+
+                if (State.Active) {
+                    if (Now < State.Deadline)
+                        continue;
+                    Log()->Error(APP_LOG_WARN, 0, "[%s] [%s] getUpdates: no response in time", CONFIG_SECTION_NAME, it.first.c_str());
+                    State.Active = false;
+                }
+
+                if (Now < State.Next)
+                    continue;
+
+                // bot.poll returns null when no request was issued (the bot is no longer polling): the loop is not active
+                // (the retry is counted from this poll: the query returns at once, no request is in flight)
+                auto Idle = [this, Retry = Now + (CDateTime) POLL_RETRY_INTERVAL / SecsPerDay](const std::string &BotId) {
+                    auto current = m_Polling.find(BotId);
+                    if (current == m_Polling.end())
+                        return;
+                    current->second.Active = false;
+                    current->second.Next = Retry;
+                };
+
+                auto OnExecuted = [Idle, BotId = it.first](CPQPollQuery *APollQuery) {
+                    try {
+                        auto pResult = APollQuery->Results(0);
+
+                        if (pResult->ExecStatus() != PGRES_TUPLES_OK) {
+                            throw Delphi::Exception::EDBError(pResult->GetErrorMessage());
+                        }
+
+                        if (pResult->GetIsNull(0, 0))
+                            Idle(BotId);
+                    } catch (Delphi::Exception::Exception &E) {
+                        Idle(BotId);
+                        DoError(E);
+                    }
+                };
+
+                auto OnException = [Idle, BotId = it.first](CPQPollQuery *APollQuery, const Delphi::Exception::Exception &E) {
+                    Idle(BotId);
+                    DoError(E);
+                };
+
+                CStringList SQL;
+
+                SQL.Add(CString().Format("SELECT bot.poll(%s);", PQQuoteLiteral(it.first.c_str()).c_str()));
+
+                try {
+                    ExecSQL(SQL, nullptr, OnExecuted, OnException);
+
+                    State.Active = true;
+                    State.Deadline = Now + (CDateTime) (State.Timeout + 30) / SecsPerDay;
+                } catch (Delphi::Exception::Exception &E) {
+                    State.Next = Now + (CDateTime) POLL_RETRY_INTERVAL / SecsPerDay;
+                    DoError(E);
+                }
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTGBot::PollDone(const CJSON &Payload) {
+            const auto &event = Payload["event"].AsString();
+
+            auto it = m_Polling.find(Payload["bot_id"].AsString().c_str());
+            if (it == m_Polling.end())
+                return;
+
+            auto &State = it->second;
+
+            State.Active = false;
+            State.Next = event == "done" ? 0 : Now() + (CDateTime) POLL_RETRY_INTERVAL / SecsPerDay;
+
+            if (m_Status == psRunning)
+                Poll(Now());
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTGBot::Heartbeat(CDateTime Now) {
+            if (Now >= m_CheckDate) {
+                m_CheckDate = Now + (CDateTime) 1 / MinsPerDay; // 1 min
+                CheckListen();
+            }
+
+            UnloadQueue();
+            CheckTimeOut(Now);
+
+            if (m_Status == psRunning) {
+                ReleaseOutbox(Now);
+                Poll(Now);
+                DoneTransfers();
+                DoneExports();
+                DoneImports();
+
+                if (Now >= m_FlushDate) {
+                    m_FlushDate = Now + (CDateTime) m_LogFlushInterval / MSecsPerDay;
+                    FlushEventLog();
+                }
+
+                if (Now >= m_MaintenanceDate) {
+                    m_MaintenanceDate = Now + (CDateTime) 60 / MinsPerDay; // 1 hour
+                    MaintainEventLog();
+                }
+
+                if (Now >= m_TransferDate) {
+                    m_TransferDate = Now + (CDateTime) 1 / MinsPerDay; // 1 min
+                    ReportTransfers();
+                }
+
+                if (Now >= m_OutboxDate) {
+                    m_OutboxDate = Now + (CDateTime) 1 / MinsPerDay; // 1 min
+                    RecoverOutbox();
+                }
+
+                if ((Now >= m_CallDate)) {
+                    m_CallDate = Now + (CDateTime) m_HeartbeatInterval / MSecsPerDay;
+                    CallHeartbeat(Now);
+                }
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTGBot::DoTimer(CPollEventHandler *AHandler) {
+            uint64_t exp;
+
+            auto pTimer = dynamic_cast<CEPollTimer *> (AHandler->Binding());
+            pTimer->Read(&exp, sizeof(uint64_t));
+
+            try {
+                Heartbeat(AHandler->TimeStamp());
+            } catch (Delphi::Exception::Exception &E) {
+                DoServerEventHandlerException(AHandler, E);
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        bool CTGBot::DoExecute(CTCPConnection *AConnection) {
+            return true;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTGBot::DoPostgresNotify(CPQConnection *AConnection, PGnotify *ANotify) {
+            DebugNotify(AConnection, ANotify);
+
+            if (CompareString(ANotify->relname, PG_LISTEN_NAME) == 0) {
+#if defined(_GLIBCXX_RELEASE) && (_GLIBCXX_RELEASE >= 9)
+                new CBotHandler(this, ANotify->extra, [this](auto &&Handler) { DoBot(Handler); });
+#else
+                new CBotHandler(this, ANotify->extra, std::bind(&CTGBot::DoBot, this, _1));
+#endif
+                UnloadQueue();
+            } else if (CompareString(ANotify->relname, PG_LISTEN_OUTBOX) == 0) {
+                CJSON Payload;
+
+                try {
+                    Payload << ANotify->extra;
+
+                    if (Payload["event"].AsString() == "retry") {
+                        RetryOutbox(Payload);
+                    } else {
+                        FetchOutbox();
+                    }
+                } catch (Delphi::Exception::Exception &E) {
+                    DoError(E);
+                }
+            } else if (CompareString(ANotify->relname, PG_LISTEN_BOT_LIST) == 0) {
+                CJSON Payload;
+
+                try {
+                    Payload << ANotify->extra;
+
+                    const auto &caId = Payload["id"].AsString();
+
+                    if (Payload["op"].AsString() == "DELETE") {
+                        m_Registry.Delete(caId);
+                        SyncPolling();
+                    } else {
+                        UpdateRegistry(caId);
+                    }
+                } catch (Delphi::Exception::Exception &E) {
+                    DoError(E);
+                }
+            } else if (CompareString(ANotify->relname, PG_LISTEN_DOWNLOAD) == 0) {
+                FetchDownloads();
+            } else if (CompareString(ANotify->relname, PG_LISTEN_UPLOAD) == 0) {
+                FetchUploads();
+            } else if (CompareString(ANotify->relname, PG_LISTEN_IMPORT) == 0) {
+                FetchImports();
+            } else if (CompareString(ANotify->relname, PG_LISTEN_POLL) == 0) {
+                CJSON Payload;
+
+                try {
+                    Payload << ANotify->extra;
+                    PollDone(Payload);
+                } catch (Delphi::Exception::Exception &E) {
+                    DoError(E);
+                }
             }
         }
         //--------------------------------------------------------------------------------------------------------------
@@ -25,6 +25,12 @@ Author:
 #define APOSTOL_PROCESS_TELEGRAM_BOT_HPP
 //----------------------------------------------------------------------------------------------------------------------
 
+#include "BotRegistry.hpp"
+#include "Outbox.hpp"
+#include "Transfer.hpp"
+#include "Import.hpp"
+//----------------------------------------------------------------------------------------------------------------------
+
 extern "C++" {
 
 namespace Apostol {
@@ -38,6 +44,22 @@ namespace Apostol {
         typedef std::function<void (CBotHandler *Handler)> COnBotHandlerEvent;
         //--------------------------------------------------------------------------------------------------------------
 
+        struct CBotPolling {
+            int Timeout = 25;
+            bool Active = false;
+            CDateTime Next = 0;
+            CDateTime Deadline = 0;
+        };
+        //--------------------------------------------------------------------------------------------------------------
+
+        struct CBotHeartbeat {
+            bool Active = false;
+            bool Overrun = false;
+            CDateTime Started = 0;
+            CDateTime Deadline = 0;
+        };
+        //--------------------------------------------------------------------------------------------------------------
+
         class CBotHandler: public CPollConnection {
         private:
 
@@ -89,6 +111,10 @@ namespace Apostol {
 
             CDateTime m_CheckDate;
             CDateTime m_CallDate;
+            CDateTime m_FlushDate;
+            CDateTime m_MaintenanceDate;
+            CDateTime m_TransferDate;
+            CDateTime m_OutboxDate;
 
             size_t m_Progress;
             size_t m_MaxQueue;
@@ -96,6 +122,41 @@ namespace Apostol {
             CProcessStatus m_Status;
 
             int m_HeartbeatInterval;
+            int m_HeartbeatTimeout;
+
+            std::map<std::string, CBotHeartbeat> m_Heartbeats;
+
+            COutboxScheduler m_Outbox;
+
+            bool m_OutboxFetching;
+            bool m_OutboxPending;
+
+            std::map<std::string, CBotPolling> m_Polling;
+
+            CBotRegistry m_Registry;
+
+            bool m_RegistryLoading;
+
+            CTransferManager m_Transfer;
+
+            bool m_DownloadFetching;
+            bool m_DownloadPending;
+
+            CUploadCache m_UploadCache;
+
+            bool m_UploadFetching;
+            bool m_UploadPending;
+
+            CImportManager m_Import;
+
+            bool m_ImportFetching;
+            bool m_ImportPending;
+
+            int m_LogFlushInterval;
+
+            CString m_LogRetention;
+
+            bool m_LogFlushing;
 
             void InitListen();
             void CheckListen();
@@ -108,7 +169,42 @@ namespace Apostol {
             void BeforeRun() override;
             void AfterRun() override;
 
-            void CallHeartbeat();
+            void CallHeartbeat(CDateTime Now);
+            void HeartbeatDone(const CString &BotId, const CString &Error);
+
+            void InitOutbox();
+            void FetchOutbox();
+            void ReleaseOutbox(CDateTime Now);
+            void RestoreOutbox(const std::vector<COutboxItem> &Items);
+            void RetryOutbox(const CJSON &Payload);
+            void RecoverOutbox();
+
+            void LoadRegistry();
+            void UpdateRegistry(const CString &Id);
+
+            void InitDownloads();
+            void FetchDownloads();
+
+            void InitUploads();
+            void FetchUploads();
+            void ExportUpload(CTransferJob &&Job, const CString &Query);
+            void DoneExports();
+            void UploadError(int64_t Id, const CString &Error);
+
+            void CacheUpload(const CTransferResult &Result);
+            void DoneTransfers();
+            void ReportTransfers();
+
+            void InitImports();
+            void FetchImports();
+            void DoneImports();
+
+            void FlushEventLog();
+            void MaintainEventLog();
+
+            void SyncPolling();
+            void Poll(CDateTime Now);
+            void PollDone(const CJSON &Payload);
 
             void Heartbeat(CDateTime Now);
 
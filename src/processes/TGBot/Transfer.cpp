@@ -0,0 +1,690 @@
+/*++
+
+Program name:
+
+  tgpg
+
+Module Name:
+
+  Transfer.cpp
+
+Notices:
+
+  Process: Telegram bot (file transfers)
+
+Author:
+
+  Copyright (c) Prepodobny Alen
+
+  mailto: alienufo@inbox.ru
+  mailto: ufocomp@gmail.com
+
+--*/
+
+#include "Core.hpp"
+#include "Transfer.hpp"
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+//----------------------------------------------------------------------------------------------------------------------
+
+#define TRANSFER_POLL_TIMEOUT 1000
+#define TRANSFER_ERROR_SIZE 4096
+#define TRANSFER_RESPONSE_SIZE 65536
+//----------------------------------------------------------------------------------------------------------------------
+
+extern "C++" {
+
+namespace Apostol {
+
+    namespace Processes {
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        //-- CStoreFile ------------------------------------------------------------------------------------------------
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        CStoreFile::CStoreFile(const std::string &Store): m_Store(Store) {
+            m_File = -1;
+            m_Digest = nullptr;
+            m_Size = 0;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        CStoreFile::~CStoreFile() {
+            Abort();
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        bool CStoreFile::SetError(const std::string &Message) {
+            m_Error = Message + ": " + strerror(errno);
+            return false;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        bool CStoreFile::ForceDirectories(const std::string &Path) {
+            size_t pos = 0;
+
+            while ((pos = Path.find('/', pos + 1)) != std::string::npos) {
+                const auto dir = Path.substr(0, pos);
+                if (mkdir(dir.c_str(), 0750) == -1 && errno != EEXIST)
+                    return false;
+            }
+
+            return mkdir(Path.c_str(), 0750) == 0 || errno == EEXIST;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        bool CStoreFile::Open(const std::string &Name) {
+            Abort();
+
+            if (!ForceDirectories(m_Store + "/tmp"))
+                return SetError("Could not create directory");
+
+            m_Temp = m_Store + "/tmp/" + Name + ".part";
+            m_File = open(m_Temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+
+            if (m_File == -1)
+                return SetError("Could not create file");
+
+            m_Digest = EVP_MD_CTX_new();
+            EVP_DigestInit_ex(m_Digest, EVP_sha256(), nullptr);
+
+            m_Size = 0;
+
+            return true;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        bool CStoreFile::Write(const char *Data, size_t Size) {
+            size_t written = 0;
+
+            while (written < Size) {
+                const auto n = write(m_File, Data + written, Size - written);
+                if (n == -1) {
+                    if (errno == EINTR)
+                        continue;
+                    return SetError("Could not write file");
+                }
+                written += n;
+            }
+
+            EVP_DigestUpdate(m_Digest, Data, Size);
+            m_Size += Size;
+
+            return true;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        bool CStoreFile::Commit(std::string &Path, std::string &Hash) {
+            if (m_File == -1)
+                return false;
+
+            close(m_File);
+            m_File = -1;
+
+            unsigned char digest[EVP_MAX_MD_SIZE];
+            unsigned int length = 0;
+
+            EVP_DigestFinal_ex(m_Digest, digest, &length);
+
+            static const char hex[] = "0123456789abcdef";
+
+            Hash.clear();
+            Hash.reserve(length * 2);
+
+            for (unsigned int i = 0; i < length; ++i) {
+                Hash += hex[digest[i] >> 4];
+                Hash += hex[digest[i] & 0x0f];
+            }
+
+            const auto dir = m_Store + "/" + Hash.substr(0, 2) + "/" + Hash.substr(2, 2);
+
+            Path = dir + "/" + Hash;
+
+            if (!ForceDirectories(dir))
+                return SetError("Could not create directory");
+
+            // The same content could be already in the store
+            if (access(Path.c_str(), F_OK) != 0 && rename(m_Temp.c_str(), Path.c_str()) != 0)
+                return SetError("Could not move file");
+
+            Abort();
+
+            return true;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CStoreFile::Abort() {
+            if (m_File != -1) {
+                close(m_File);
+                m_File = -1;
+            }
+
+            if (!m_Temp.empty()) {
+                unlink(m_Temp.c_str());
+                m_Temp.clear();
+            }
+
+            if (m_Digest != nullptr) {
+                EVP_MD_CTX_free(m_Digest);
+                m_Digest = nullptr;
+            }
+        }
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        //-- CUploadCache ----------------------------------------------------------------------------------------------
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        CUploadCache::CUploadCache(size_t Capacity) {
+            m_Capacity = Capacity == 0 ? 1 : Capacity;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        const std::string *CUploadCache::Find(const std::string &BotId, const std::string &Hash) {
+            if (Hash.empty())
+                return nullptr;
+
+            const auto it = m_Index.find(Key(BotId, Hash));
+            if (it == m_Index.end())
+                return nullptr;
+
+            m_Entries.splice(m_Entries.begin(), m_Entries, it->second);
+
+            return &it->second->second;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CUploadCache::Add(const std::string &BotId, const std::string &Hash, const std::string &FileId) {
+            if (Hash.empty() || FileId.empty())
+                return;
+
+            const auto &key = Key(BotId, Hash);
+            const auto it = m_Index.find(key);
+
+            if (it != m_Index.end()) {
+                it->second->second = FileId;
+                m_Entries.splice(m_Entries.begin(), m_Entries, it->second);
+                return;
+            }
+
+            m_Entries.emplace_front(key, FileId);
+            m_Index.emplace(key, m_Entries.begin());
+
+            while (m_Index.size() > m_Capacity) {
+                m_Index.erase(m_Entries.back().first);
+                m_Entries.pop_back();
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CUploadCache::Delete(const std::string &BotId, const std::string &Hash) {
+            const auto it = m_Index.find(Key(BotId, Hash));
+            if (it == m_Index.end())
+                return;
+
+            m_Entries.erase(it->second);
+            m_Index.erase(it);
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CUploadCache::Clear() {
+            m_Entries.clear();
+            m_Index.clear();
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CUploadCache::Capacity(size_t Value) {
+            m_Capacity = Value == 0 ? 1 : Value;
+
+            while (m_Index.size() > m_Capacity) {
+                m_Index.erase(m_Entries.back().first);
+                m_Entries.pop_back();
+            }
+        }
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        //-- CTransferManager ------------------------------------------------------------------------------------------
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        CTransferManager::CTransferManager() {
+            m_Multi = nullptr;
+            m_Running = false;
+            m_Limit = 8;
+            m_HostLimit = 4;
+            m_Timeout = 300;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        CTransferManager::~CTransferManager() {
+            Stop();
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTransferManager::Start() {
+            if (m_Running)
+                return;
+
+            m_Multi = curl_multi_init();
+            if (m_Multi == nullptr)
+                throw Delphi::Exception::Exception("curl_multi_init() failed.");
+
+            curl_multi_setopt(m_Multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+            curl_multi_setopt(m_Multi, CURLMOPT_MAXCONNECTS, (long) (m_Limit * 2));
+
+            m_Running = true;
+            m_Thread = std::thread(&CTransferManager::Execute, this);
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTransferManager::Stop() {
+            if (!m_Running)
+                return;
+
+            m_Running = false;
+            curl_multi_wakeup(m_Multi);
+
+            if (m_Thread.joinable())
+                m_Thread.join();
+
+            for (auto Handle : m_Handles)
+                curl_easy_cleanup(Handle);
+            m_Handles.clear();
+
+            curl_multi_cleanup(m_Multi);
+            m_Multi = nullptr;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        std::string CTransferManager::HostName(const std::string &Url) {
+            auto start = Url.find("://");
+            start = start == std::string::npos ? 0 : start + 3;
+
+            auto end = Url.find_first_of("/?#", start);
+            if (end == std::string::npos)
+                end = Url.size();
+
+            const auto at = Url.rfind('@', end);
+            if (at != std::string::npos && at >= start)
+                start = at + 1;
+
+            return Url.substr(start, end - start);
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTransferManager::Add(CTransferJob &&Job) {
+            Job.Host = HostName(Job.Url);
+
+            {
+                std::lock_guard<std::mutex> lock(m_Lock);
+                m_Hosts[Job.Host].Queued++;
+                m_Pending.push_back(std::move(Job));
+            }
+
+            if (m_Multi != nullptr)
+                curl_multi_wakeup(m_Multi);
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTransferManager::Download(int64_t Id, const std::string &Url) {
+            CTransferJob Job;
+
+            Job.Type = ttDownload;
+            Job.Id = Id;
+            Job.Url = Url;
+
+            Add(std::move(Job));
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTransferManager::Upload(CTransferJob &&Job) {
+            Job.Type = ttUpload;
+            Add(std::move(Job));
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        size_t CTransferManager::Completed(std::vector<CTransferResult> &Results) {
+            std::lock_guard<std::mutex> lock(m_Lock);
+            Results.swap(m_Completed);
+            m_Completed.clear();
+            return Results.size();
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        size_t CTransferManager::Hosts(std::map<std::string, CTransferHost> &Stats) {
+            std::lock_guard<std::mutex> lock(m_Lock);
+
+            Stats = m_Hosts;
+
+            for (auto it = m_Hosts.begin(); it != m_Hosts.end();) {
+                auto &Host = it->second;
+
+                if (Host.Queued == 0 && Host.Active == 0) {
+                    it = m_Hosts.erase(it);
+                    continue;
+                }
+
+                Host.Done = 0;
+                Host.Failed = 0;
+                Host.Reused = 0;
+                Host.Latency = 0;
+                Host.MaxLatency = 0;
+
+                ++it;
+            }
+
+            return Stats.size();
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        bool CTransferManager::ReadContent(const std::string &Path, std::string &Content, size_t Limit) {
+            const auto fd = open(Path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd == -1)
+                return false;
+
+            char buffer[65536];
+            ssize_t n;
+
+            while (Content.size() < Limit && (n = read(fd, buffer, sizeof(buffer))) > 0)
+                Content.append(buffer, n);
+
+            close(fd);
+
+            if (Content.size() > Limit)
+                Content.resize(Limit);
+
+            return true;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        size_t CTransferManager::DoWrite(char *Data, size_t Size, size_t Count, void *UserData) {
+            auto pTransfer = (CTransfer *) UserData;
+            const auto length = Size * Count;
+
+            if (!pTransfer->File->Write(Data, length))
+                return 0;
+
+            pTransfer->Result.Size += length;
+
+            return length;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        size_t CTransferManager::DoResponse(char *Data, size_t Size, size_t Count, void *UserData) {
+            auto pTransfer = (CTransfer *) UserData;
+            const auto length = Size * Count;
+
+            if (pTransfer->Result.Response.size() + length > TRANSFER_RESPONSE_SIZE)
+                return 0;
+
+            pTransfer->Result.Response.append(Data, length);
+
+            return length;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        bool CTransferManager::StartDownload(CTransfer *ATransfer) {
+            ATransfer->File = new CStoreFile(m_Store);
+
+            if (!ATransfer->File->Open(std::to_string(ATransfer->Job.Id))) {
+                ATransfer->Result.Error = ATransfer->File->Error();
+                return false;
+            }
+
+            curl_easy_setopt(ATransfer->Handle, CURLOPT_WRITEFUNCTION, &CTransferManager::DoWrite);
+            curl_easy_setopt(ATransfer->Handle, CURLOPT_WRITEDATA, ATransfer);
+
+            return true;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        bool CTransferManager::StartUpload(CTransfer *ATransfer) {
+            const auto &Job = ATransfer->Job;
+
+            if (Job.FileId.empty() && access(Job.Path.c_str(), R_OK) != 0) {
+                ATransfer->Result.Error = std::string("Could not read file: ") + strerror(errno);
+                return false;
+            }
+
+            ATransfer->Mime = curl_mime_init(ATransfer->Handle);
+
+            for (const auto &Field : Job.Fields) {
+                auto pPart = curl_mime_addpart(ATransfer->Mime);
+                curl_mime_name(pPart, Field.first.c_str());
+                curl_mime_data(pPart, Field.second.c_str(), Field.second.size());
+            }
+
+            auto pPart = curl_mime_addpart(ATransfer->Mime);
+            curl_mime_name(pPart, Job.Field.c_str());
+
+            if (!Job.FileId.empty()) {
+                // The content was uploaded before, Telegram resends it by file_id
+                curl_mime_data(pPart, Job.FileId.c_str(), Job.FileId.size());
+            } else {
+                // The part is read from the file by curl while sending
+                curl_mime_filedata(pPart, Job.Path.c_str());
+                curl_mime_filename(pPart, Job.FileName.c_str());
+                if (!Job.ContentType.empty())
+                    curl_mime_type(pPart, Job.ContentType.c_str());
+            }
+
+            curl_easy_setopt(ATransfer->Handle, CURLOPT_MIMEPOST, ATransfer->Mime);
+            curl_easy_setopt(ATransfer->Handle, CURLOPT_WRITEFUNCTION, &CTransferManager::DoResponse);
+            curl_easy_setopt(ATransfer->Handle, CURLOPT_WRITEDATA, ATransfer);
+
+            return true;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        CURL *CTransferManager::Acquire() {
+            if (m_Handles.empty())
+                return curl_easy_init();
+
+            auto Handle = m_Handles.back();
+            m_Handles.pop_back();
+
+            return Handle;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTransferManager::Start(CTransfer *ATransfer) {
+            ATransfer->Handle = Acquire();
+
+            const auto started = ATransfer->Job.Type == ttUpload ? StartUpload(ATransfer) : StartDownload(ATransfer);
+
+            if (!started) {
+                Complete(ATransfer);
+                return;
+            }
+
+            curl_easy_setopt(ATransfer->Handle, CURLOPT_URL, ATransfer->Job.Url.c_str());
+            curl_easy_setopt(ATransfer->Handle, CURLOPT_ERRORBUFFER, ATransfer->Error);
+            curl_easy_setopt(ATransfer->Handle, CURLOPT_NOSIGNAL, 1L);
+            curl_easy_setopt(ATransfer->Handle, CURLOPT_FOLLOWLOCATION, 1L);
+            curl_easy_setopt(ATransfer->Handle, CURLOPT_CONNECTTIMEOUT, 30L);
+            curl_easy_setopt(ATransfer->Handle, CURLOPT_TIMEOUT, m_Timeout);
+            curl_easy_setopt(ATransfer->Handle, CURLOPT_USERAGENT, APP_NAME);
+            curl_easy_setopt(ATransfer->Handle, CURLOPT_TCP_KEEPALIVE, 1L);
+            // Wait for a connection that can multiplex rather than open one more to the same host
+            curl_easy_setopt(ATransfer->Handle, CURLOPT_PIPEWAIT, 1L);
+
+            m_Active[ATransfer->Handle] = ATransfer;
+            curl_multi_add_handle(m_Multi, ATransfer->Handle);
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTransferManager::StartPending() {
+            std::deque<CTransferJob> Jobs;
+
+            {
+                std::lock_guard<std::mutex> lock(m_Lock);
+
+                // A host at its limit does not hold up the jobs of other hosts
+                for (auto it = m_Pending.begin(); it != m_Pending.end() && m_Active.size() + Jobs.size() < m_Limit;) {
+                    auto &Host = m_Hosts[it->Host];
+
+                    if (Host.Active >= m_HostLimit) {
+                        ++it;
+                        continue;
+                    }
+
+                    Host.Queued--;
+                    Host.Active++;
+
+                    Jobs.push_back(std::move(*it));
+                    it = m_Pending.erase(it);
+                }
+            }
+
+            for (auto &Job : Jobs) {
+                auto pTransfer = new CTransfer();
+
+                pTransfer->Result.Type = Job.Type;
+                pTransfer->Result.Id = Job.Id;
+                pTransfer->Result.Hash = Job.Hash;
+                pTransfer->Result.FileId = Job.FileId;
+                pTransfer->Result.Tag = Job.Tag;
+                pTransfer->Job = std::move(Job);
+
+                Start(pTransfer);
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTransferManager::FinishDownload(CTransfer *ATransfer) {
+            auto &Result = ATransfer->Result;
+
+            if (Result.Status != 200) {
+                // The body of the failed request is an error description of Bot API
+                ReadContent(ATransfer->File->Temp(), Result.Error, TRANSFER_ERROR_SIZE);
+                ATransfer->File->Abort();
+                return;
+            }
+
+            if (!ATransfer->File->Commit(Result.Path, Result.Hash)) {
+                Result.Error = ATransfer->File->Error();
+                Result.Path.clear();
+            }
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTransferManager::Finish(CURL *Handle, CURLcode Code) {
+            auto it = m_Active.find(Handle);
+            if (it == m_Active.end())
+                return;
+
+            auto pTransfer = it->second;
+            m_Active.erase(it);
+
+            curl_multi_remove_handle(m_Multi, Handle);
+            curl_easy_getinfo(Handle, CURLINFO_RESPONSE_CODE, &pTransfer->Result.Status);
+            curl_easy_getinfo(Handle, CURLINFO_TOTAL_TIME, &pTransfer->Elapsed);
+
+            long connects = 0;
+            curl_easy_getinfo(Handle, CURLINFO_NUM_CONNECTS, &connects);
+            pTransfer->Reused = Code == CURLE_OK && connects == 0;
+
+            if (Code != CURLE_OK) {
+                pTransfer->Result.Error = pTransfer->Error[0] != 0 ? pTransfer->Error : curl_easy_strerror(Code);
+            } else if (pTransfer->Job.Type == ttDownload) {
+                FinishDownload(pTransfer);
+            }
+
+            Complete(pTransfer);
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTransferManager::Complete(CTransfer *ATransfer) {
+            auto &Result = ATransfer->Result;
+
+            if (Result.Type == ttDownload && Result.Path.empty() && Result.Error.empty())
+                Result.Error = "Transfer failed.";
+
+            {
+                std::lock_guard<std::mutex> lock(m_Lock);
+
+                auto &Host = m_Hosts[ATransfer->Job.Host];
+
+                if (Host.Active > 0)
+                    Host.Active--;
+
+                if (Result.Error.empty() && Result.Status >= 200 && Result.Status < 300) {
+                    Host.Done++;
+                } else {
+                    Host.Failed++;
+                }
+
+                if (ATransfer->Reused)
+                    Host.Reused++;
+
+                Host.Latency += ATransfer->Elapsed;
+                if (ATransfer->Elapsed > Host.MaxLatency)
+                    Host.MaxLatency = ATransfer->Elapsed;
+
+                m_Completed.push_back(std::move(Result));
+            }
+
+            Release(ATransfer);
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTransferManager::Release(CTransfer *ATransfer) {
+            delete ATransfer->File;
+
+            // The handle keeps its TLS session cache for the next transfer
+            if (ATransfer->Handle != nullptr) {
+                if (m_Handles.size() < m_Limit) {
+                    curl_easy_reset(ATransfer->Handle);
+                    m_Handles.push_back(ATransfer->Handle);
+                } else {
+                    curl_easy_cleanup(ATransfer->Handle);
+                }
+            }
+
+            if (ATransfer->Mime != nullptr)
+                curl_mime_free(ATransfer->Mime);
+
+            delete ATransfer;
+        }
+        //--------------------------------------------------------------------------------------------------------------
+
+        void CTransferManager::Execute() {
+            int running = 0;
+
+            while (m_Running) {
+                StartPending();
+
+                curl_multi_perform(m_Multi, &running);
+
+                CURLMsg *pMessage;
+                int left = 0;
+
+                while ((pMessage = curl_multi_info_read(m_Multi, &left)) != nullptr) {
+                    if (pMessage->msg == CURLMSG_DONE)
+                        Finish(pMessage->easy_handle, pMessage->data.result);
+                }
+
+                curl_multi_poll(m_Multi, nullptr, 0, TRANSFER_POLL_TIMEOUT, nullptr);
+            }
+
+            // Interrupted transfers are reported with an error and will be repeated
+            for (auto &it : m_Active) {
+                curl_multi_remove_handle(m_Multi, it.first);
+                it.second->Result.Error = "Interrupted.";
+                Complete(it.second);
+            }
+
+            m_Active.clear();
+        }
+    }
+}
+
+}
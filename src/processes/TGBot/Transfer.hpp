@@ -0,0 +1,314 @@
+/*++
+
+Program name:
+
+  tgpg
+
+Module Name:
+
+  Transfer.hpp
+
+Notices:
+
+  Process: Telegram bot (file transfers)
+
+Author:
+
+  Copyright (c) Prepodobny Alen
+
+  mailto: alienufo@inbox.ru
+  mailto: ufocomp@gmail.com
+
+--*/
+
+#ifndef APOSTOL_PROCESS_TELEGRAM_BOT_TRANSFER_HPP
+#define APOSTOL_PROCESS_TELEGRAM_BOT_TRANSFER_HPP
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <atomic>
+#include <deque>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <curl/curl.h>
+#include <openssl/evp.h>
+//----------------------------------------------------------------------------------------------------------------------
+
+extern "C++" {
+
+namespace Apostol {
+
+    namespace Processes {
+
+        enum CTransferType { ttDownload = 0, ttUpload };
+        //--------------------------------------------------------------------------------------------------------------
+
+        struct CTransferJob {
+            CTransferType Type = ttDownload;
+
+            int64_t Id = 0;
+
+            std::string Url;
+
+            std::vector<std::pair<std::string, std::string>> Fields;
+
+            std::string Field;
+            std::string Path;
+            std::string Hash;
+            std::string FileId;
+            std::string FileName;
+            std::string ContentType;
+
+            std::string Tag;
+
+            std::string Host;
+        };
+        //--------------------------------------------------------------------------------------------------------------
+
+        struct CTransferResult {
+            CTransferType Type = ttDownload;
+
+            int64_t Id = 0;
+            long Status = 0;
+            uint64_t Size = 0;
+
+            std::string Path;
+            std::string Hash;
+            std::string FileId;
+            std::string Error;
+            std::string Response;
+
+            std::string Tag;
+        };
+        //--------------------------------------------------------------------------------------------------------------
+
+        /**
+         * Transfers of one host: the queue depth, the running transfers and the counters since the last report.
+         * Latency is the total time of a transfer (sec), Reused - the transfers done over a kept-alive connection.
+         */
+        struct CTransferHost {
+            size_t Queued = 0;
+            size_t Active = 0;
+
+            uint64_t Done = 0;
+            uint64_t Failed = 0;
+            uint64_t Reused = 0;
+
+            double Latency = 0;
+            double MaxLatency = 0;
+        };
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        //-- CStoreFile ------------------------------------------------------------------------------------------------
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        /**
+         * A file written to the content-addressed store: the data is written to <store>/tmp and hashed (SHA-256)
+         * on the fly, Commit() moves the file to <store>/<ab>/<cd>/<sha256>.
+         */
+        class CStoreFile {
+        private:
+
+            std::string m_Store;
+            std::string m_Temp;
+            std::string m_Error;
+
+            int m_File;
+
+            EVP_MD_CTX *m_Digest;
+
+            uint64_t m_Size;
+
+            bool SetError(const std::string &Message);
+
+        public:
+
+            explicit CStoreFile(const std::string &Store);
+
+            ~CStoreFile();
+
+            bool Open(const std::string &Name);
+            bool Write(const char *Data, size_t Size);
+            bool Commit(std::string &Path, std::string &Hash);
+
+            void Abort();
+
+            uint64_t Size() const { return m_Size; };
+
+            const std::string &Temp() const { return m_Temp; };
+            const std::string &Error() const { return m_Error; };
+
+            static bool ForceDirectories(const std::string &Path);
+
+        };
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        //-- CUploadCache ----------------------------------------------------------------------------------------------
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        /**
+         * In-memory front of bot.upload_cache: Telegram file_id by bot and content hash, the least recently used
+         * entries are dropped when the capacity is reached.
+         */
+        class CUploadCache {
+        private:
+
+            typedef std::list<std::pair<std::string, std::string>> CEntries;
+
+            CEntries m_Entries;
+
+            std::unordered_map<std::string, CEntries::iterator> m_Index;
+
+            size_t m_Capacity;
+
+            static std::string Key(const std::string &BotId, const std::string &Hash) { return BotId + ':' + Hash; };
+
+        public:
+
+            explicit CUploadCache(size_t Capacity = 10000);
+
+            const std::string *Find(const std::string &BotId, const std::string &Hash);
+
+            void Add(const std::string &BotId, const std::string &Hash, const std::string &FileId);
+            void Delete(const std::string &BotId, const std::string &Hash);
+
+            void Clear();
+
+            size_t Count() const { return m_Index.size(); };
+
+            size_t Capacity() const { return m_Capacity; };
+            void Capacity(size_t Value);
+
+        };
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        //-- CTransferManager ------------------------------------------------------------------------------------------
+
+        //--------------------------------------------------------------------------------------------------------------
+
+        /**
+         * Transfers files on a worker thread with the curl multi interface. Results are collected by the process timer.
+         * Downloads are streamed to the file store, the callbacks read the files from there.
+         * Uploads are sent as multipart/form-data read from the file store by chunks, memory use does not depend
+         * on the file size.
+         * Connections stay in the cache of the multi handle and are reused by the next transfers of the host (HTTP/2
+         * transfers are multiplexed over one connection), easy handles are recycled with their TLS session cache.
+         * At most HostLimit transfers run against one host, the rest wait in the queue.
+         * Only the file transfers of the bot (bot.download, bot.upload) go through here: http.fetch requests are sent
+         * by the PGFetch module, its connection handling is not affected.
+         */
+        class CTransferManager {
+        private:
+
+            struct CTransfer {
+                CURL *Handle = nullptr;
+                curl_mime *Mime = nullptr;
+
+                CStoreFile *File = nullptr;
+
+                CTransferJob Job;
+                CTransferResult Result;
+
+                char Error[CURL_ERROR_SIZE] = {};
+
+                double Elapsed = 0;
+                bool Reused = false;
+            };
+
+            CURLM *m_Multi;
+
+            std::thread m_Thread;
+
+            std::mutex m_Lock;
+
+            std::deque<CTransferJob> m_Pending;
+            std::vector<CTransferResult> m_Completed;
+
+            std::map<CURL *, CTransfer *> m_Active;
+            std::map<std::string, CTransferHost> m_Hosts;
+
+            std::vector<CURL *> m_Handles;
+
+            std::atomic<bool> m_Running;
+
+            std::string m_Store;
+
+            size_t m_Limit;
+            size_t m_HostLimit;
+
+            long m_Timeout;
+
+            void Execute();
+
+            void StartPending();
+            void Start(CTransfer *ATransfer);
+
+            bool StartDownload(CTransfer *ATransfer);
+            bool StartUpload(CTransfer *ATransfer);
+
+            void Finish(CURL *Handle, CURLcode Code);
+            void FinishDownload(CTransfer *ATransfer);
+
+            void Complete(CTransfer *ATransfer);
+            void Release(CTransfer *ATransfer);
+
+            CURL *Acquire();
+
+            void Add(CTransferJob &&Job);
+
+            static size_t DoWrite(char *Data, size_t Size, size_t Count, void *UserData);
+            static size_t DoResponse(char *Data, size_t Size, size_t Count, void *UserData);
+
+            static bool ReadContent(const std::string &Path, std::string &Content, size_t Limit);
+
+            static std::string HostName(const std::string &Url);
+
+        public:
+
+            CTransferManager();
+
+            ~CTransferManager();
+
+            void Start();
+            void Stop();
+
+            void Download(int64_t Id, const std::string &Url);
+            void Upload(CTransferJob &&Job);
+
+            size_t Completed(std::vector<CTransferResult> &Results);
+
+            size_t Hosts(std::map<std::string, CTransferHost> &Stats);
+
+            bool Running() const { return m_Running; };
+
+            const std::string &Store() const { return m_Store; };
+            void Store(const std::string &Value) { m_Store = Value; };
+
+            size_t Limit() const { return m_Limit; };
+            void Limit(size_t Value) { m_Limit = Value == 0 ? 1 : Value; };
+
+            size_t HostLimit() const { return m_HostLimit; };
+            void HostLimit(size_t Value) { m_HostLimit = Value == 0 ? 1 : Value; };
+
+            long Timeout() const { return m_Timeout; };
+            void Timeout(long Value) { m_Timeout = Value; };
+
+        };
+
+    }
+}
+
+using namespace Apostol::Processes;
+}
+#endif //APOSTOL_PROCESS_TELEGRAM_BOT_TRANSFER_HPP